@@ -0,0 +1,78 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Cluster mode header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "stats.hpp"
+
+// Cluster mode, the ensemble split into contiguous slices over worker nodes
+// connected to the render node over TCP (or Unix domain sockets, see
+// net.hpp). Nodes step their slices in lockstep, one step per request, and
+// answer each with their divergence partials and the end positions of their
+// slice, quantized and delta coded against their previous step. The render
+// node mirrors the end positions into its pendulums as trajectories.
+//
+// Resets are sent only once every node answered the last step, so all nodes
+// reset at the same step. A node that disconnects only loses its slice, and
+// nodes that connect later get a slice with the next reset.
+
+// End positions are rounded to multiples of this before delta coding
+constexpr double clusterPositionQuantum = 1.0 / 64.0;
+
+// Listen for worker nodes on address and start once nodes connected, false
+// if listening failed
+bool StartCluster(std::string_view address, std::size_t nodes);
+
+// Disconnect worker nodes and stop listening
+void StopCluster();
+
+// Whether the render node is listening for worker nodes
+bool ClusterRunning();
+
+// Ask every node for one more step, unless some did not answer the last one
+void RequestClusterStep();
+
+// Reinitialize every node with resets and the current settings, once every
+// node answered the last step, giving slices to nodes that connected since
+void RequestClusterReset(int resets);
+
+// Pass settings that do not need a reset on to every node
+void UpdateClusterSettings();
+
+// Accept nodes, mirror the steps they answered with into pendulums and merge
+// their divergence, pairs across slices are left out
+DivergenceStats CompositeCluster();
+
+// Worker node main, simulate the slices the render node at address gives,
+// keeping performance settings from settingsFilename, until it disconnects
+int RunClusterWorker(std::string_view address, const char* settingsFilename);
@@ -0,0 +1,57 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   CPU feature detection header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// CpuFeatureLevel, instruction set levels the kernels are compiled for
+enum class CpuFeatureLevel {
+	Scalar,
+	SSE42,
+	AVX2,
+	AVX512,
+
+	Count
+};
+
+// Returns the display name of a level ("Scalar", "SSE4.2", "AVX2", "AVX-512")
+const char* CpuFeatureLevelName(CpuFeatureLevel level);
+
+// Parse a level from settings/command line ("scalar", "sse4.2", "avx2",
+// "avx512", case insensitive), return false if text is unknown
+bool ParseCpuFeatureLevel(std::string_view text, CpuFeatureLevel& level);
+
+// Highest level supported by the running CPU and operating system
+CpuFeatureLevel DetectCpuFeatureLevel();
+
+// CPU brand string, or "Unknown CPU" if not available
+std::string GetCpuModelName();
@@ -0,0 +1,100 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Kernel plugin interface header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+// Kernel plugins, step kernels built as shared objects outside the app and
+// loaded while it runs (see plugins.hpp). Plain C, so plugins can be built
+// by any compiler, only this header is needed:
+//   g++ -O2 -shared -fPIC -Igame/include my_kernel.cpp -o my_kernel.so
+//
+// A plugin exports HDP_KERNEL_PLUGIN_ENTRY returning its HdpKernelPlugin.
+// Ensemble state stays in the app, plugins only step the blocks they are
+// given, so they can be swapped between any two frames.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Version of the structures below, bumped on any change to them
+#define HDP_KERNEL_PLUGIN_ABI 1
+
+// Name of the exported entry point, of type HdpKernelPluginEntry
+#define HDP_KERNEL_PLUGIN_ENTRY "hdpKernelPlugin"
+
+// HdpPluginBlock, structure of arrays view of a block of joined pendulums
+// All arrays are indexed [link * stride + member], columns from members to
+// stride are padding copies of the last member and may be stepped or not
+typedef struct HdpPluginBlock {
+	size_t links;
+	size_t members;
+	size_t stride;
+
+	double* angle;
+	double* angularVelocity;
+	double* angularAcceleration;
+
+	const double* length;
+	const double* mass;
+	const double* gravity; // Single row, one per member
+
+	// End positions of every link, written by positions
+	double* positionX;
+	double* positionY;
+} HdpPluginBlock;
+
+// HdpKernelPlugin, functions of a plugin
+// step and positions are called from every worker thread at once, each on
+// its own block
+typedef struct HdpKernelPlugin {
+	uint32_t abi;     // HDP_KERNEL_PLUGIN_ABI the plugin was built with
+	const char* name; // Shown in the overlay
+
+	// Called once after loading, returns 0 on success, may be NULL
+	int (*init)(void);
+
+	// Advance angles, velocities and accelerations of block by steps steps
+	void (*step)(const HdpPluginBlock* block, size_t steps, double deltaTime);
+
+	// Write end positions of every link of block from its angles, first link
+	// anchored at (0, 0)
+	void (*positions)(const HdpPluginBlock* block);
+
+	// Called once before unloading, may be NULL
+	void (*shutdown)(void);
+} HdpKernelPlugin;
+
+typedef const HdpKernelPlugin* (*HdpKernelPluginEntry)(void);
+
+// Put before the entry point definition, for C linkage in C++ plugins
+#ifdef __cplusplus
+#define HDP_KERNEL_PLUGIN_EXPORT extern "C"
+#else
+#define HDP_KERNEL_PLUGIN_EXPORT
+#endif
@@ -0,0 +1,160 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Multi-versioned kernels header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "cpu.hpp"
+
+// Joined pendulums processed by a kernel at once
+constexpr std::size_t kernelBlockSize = 64;
+
+// Doubles of KernelBlock::workspace needed by implicit and chain stepping
+// of links
+constexpr std::size_t GetWorkspaceSize(std::size_t links)
+{
+	return (links * links + links * 8 + 1) * kernelBlockSize;
+}
+
+// Links with chain equations of motion generated at compile time
+constexpr std::size_t chainKernelMinLinks = 2;
+constexpr std::size_t chainKernelMaxLinks = 8;
+
+// BlockDistances, moments of distances between end points of consecutive
+// members in a block
+struct BlockDistances {
+	double sum;
+	double m2; // Sum of squared differences from the mean
+	double max;
+};
+
+// KernelBlock, structure of arrays view of a block of joined pendulums
+// All arrays are indexed [link * kernelBlockSize + member]
+struct KernelBlock {
+	std::size_t links;
+	std::size_t members; // Pendulums in the block, the rest is padding
+
+	double* angle;
+	double* angularVelocity;
+	double* angularAcceleration;
+
+	// Per member parameters, cached when pendulums are initialized
+	const double* length;
+	const double* inverseLength;
+	const double* mass;
+	const double* massSum; // Mass of a link plus the next link's
+	const double* gravity; // Single row, one per member
+
+	// Output end positions of every link
+	double* positionX;
+	double* positionY;
+
+	// Output distance of each member's end point to the next member's, and
+	// their moments over the members - 1 pairs
+	double* distance;
+	BlockDistances* distances;
+
+	// Scratch for implicit and chain stepping, GetWorkspaceSize(links) doubles
+	double* workspace;
+
+	// Added to for every step implicit stepping halved, may be nullptr
+	std::size_t* implicitSplits;
+
+	double deltaTime;
+};
+
+// Kernels, simulation and render kernels compiled for one instruction set level
+struct Kernels {
+	CpuFeatureLevel level;
+	std::size_t lanes; // Doubles per vector register
+	bool strict;       // Built without floating point contraction
+
+	// Step a full block of joined pendulums, measuring neighbor distances
+	void (*stepBlock)(const KernelBlock& block);
+
+	// Same with the implicit midpoint rule on the full chain dynamics, stable
+	// at display rate step sizes for long chains of short, light links
+	void (*stepBlockImplicit)(const KernelBlock& block);
+
+	// Same with explicit steps of the full chain dynamics, by equations of
+	// motion generated at compile time for 2 to 8 links
+	void (*stepBlockChain)(const KernelBlock& block);
+
+	// Angular accelerations of the full chain dynamics only, by the generated
+	// equations, or by the generic runtime solver if generic is set
+	void (*chainAcceleration)(const KernelBlock& block, bool generic);
+
+	// Unroll ring buffer of (x, y) doubles starting at start into linear
+	// (x, y) floats ready for drawing
+	void (*unrollTrajectory)(const double* ring, std::size_t size, std::size_t start, float* out);
+
+	// Multiply-add chains at the peak rate of this level, for roofline
+	// analysis, 128 * lanes * repeats flops (see roofline.hpp)
+	double (*probeFlops)(std::size_t repeats);
+};
+
+// Kernel table getter of a level, strict builds (KERNELS_STRICT) get their own
+#ifdef KERNELS_STRICT
+#define KERNELS_GETTER(level) GetStrictKernels##level
+#define KERNELS_IS_STRICT true
+#else
+#define KERNELS_GETTER(level) GetKernels##level
+#define KERNELS_IS_STRICT false
+#endif
+
+// Kernel tables of each level, nullptr if the compiler could not build them
+const Kernels* GetKernelsScalar();
+const Kernels* GetKernelsSSE42();
+const Kernels* GetKernelsAVX2();
+const Kernels* GetKernelsAVX512();
+const Kernels* GetStrictKernelsScalar();
+const Kernels* GetStrictKernelsSSE42();
+const Kernels* GetStrictKernelsAVX2();
+const Kernels* GetStrictKernelsAVX512();
+
+// Kernels compiled into this binary for level, nullptr if not compiled in
+// Strict kernels give bitwise identical results on every level
+const Kernels* GetCompiledKernels(CpuFeatureLevel level, bool strict = false);
+
+// Select highest supported kernels, or the level named by requested ("auto"
+// or empty to detect), levels above what the CPU supports are never selected
+const Kernels& SelectKernels(std::string_view requested, bool strict = false);
+
+// Largest difference between generated and generic chain accelerations of
+// kernels over random states of links, relative to the largest acceleration
+double CheckChainKernels(const Kernels& kernels, std::size_t links);
+
+// Active kernels, selected at startup
+extern const Kernels* activeKernels;
+
+// Level detected at startup
+extern CpuFeatureLevel detectedCpuFeatureLevel;
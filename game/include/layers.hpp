@@ -0,0 +1,119 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Ensemble layers header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "memoryusage.hpp"
+#include "pendulum.hpp"
+#include "stats.hpp"
+
+// Layers, more ensembles composited over the main one, such as a layer of
+// 3 link pendulums over 2 link ones. Each is made from a settings file
+// applied over the main settings, so it only needs the settings that differ,
+// and is stepped, reset and drawn on its own. Layers step one after another
+// on the worker pool in the step stage, after the main ensemble.
+//
+// Every ensemble, the main one included, has a frameBudget, seconds per
+// frame it may spend stepping and drawing. An ensemble over its budget draws
+// only every n-th pendulum, and skips steps (slowing down) if drawing that
+// few still leaves too little time to step.
+
+// Share of a budget drawing may take at most, the rest is for stepping
+constexpr double budgetDrawShare = 0.5;
+
+// Weight of the latest frame in budget averages
+constexpr double budgetSmoothing = 0.1;
+
+// FrameBudget, decides how much of an ensemble is stepped and drawn in a frame
+struct FrameBudget {
+	double seconds = 0.0;      // Per frame, 0 for no limit
+	double credit = 0.0;       // Unspent seconds, stepping and drawing spend it
+	double stepSeconds = 0.0;  // Average step time
+	double drawSeconds = 0.0;  // Average draw time per pendulum drawn
+	double lastDraw = 0.0;     // Seconds the last frame's drawing took
+	std::size_t stride = 1;    // Pendulums drawn are every stride-th one
+	std::uint64_t skipped = 0; // Steps skipped to stay within budget
+
+	// Whether to step this frame
+	bool StartStep();
+
+	// Account a step that took seconds
+	void Stepped(double seconds);
+
+	// Stride to draw count pendulums with
+	std::size_t DrawStride(std::size_t count);
+
+	// Account drawing drawn pendulums that took seconds
+	void Drawn(double seconds, std::size_t drawn);
+};
+
+// Layer, an ensemble composited over the main one
+struct Layer {
+	std::string filename; // Settings file applied over the main settings
+	long modTime = 0;     // Of the file when loaded
+	Ensemble ensemble;
+	FrameBudget budget;
+	MemoryFit fit; // Lowered to fit what memoryBudget left for it
+	DivergenceStats divergence;
+	int resets = 0;
+	double fadeEnd = 0.0; // When its reset fade ends, 0 if not resetting
+	float alpha = 1.0f;
+};
+
+// Loaded layers
+extern std::vector<Layer> layers;
+
+// Load layers from a list of settings files ("a.txt,b.txt" or "none"), each
+// applied over the current settings. Layers already loaded from a file keep
+// their pendulums unless a setting that needs a reset changed. Each layer is
+// fitted into what memoryBudget leaves after reserved bytes and the layers
+// before it
+// Returns false if a file could not be loaded, which is then left out
+bool LoadLayers(std::string_view list, std::size_t reserved = 0);
+
+// Whether a layer's settings file changed since it was loaded, safe from
+// any stage
+bool LayersChanged();
+
+// Step layers within their budget and reset diverged ones if autoReset,
+// main thread, in the step stage while not paused
+void StepLayers(bool autoReset);
+
+// Fade out and reset every layer
+void ResetLayers();
+
+// Draw layers over the main ensemble, in camera mode
+void DrawLayers(bool debug);
@@ -0,0 +1,87 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Memory accounting header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "pendulum.hpp"
+
+// Memory accounting, bytes held by each subsystem, and fitting settings into
+// memoryBudget before pendulums are made from them. Ensembles are counted by
+// capacity, render and audio buffers are estimates of what raylib allocates.
+
+// raylib's default render batch, positions, texture coordinates, colors and
+// indices of 8192 quads, held in memory and again by the GPU driver
+constexpr std::size_t renderBatchBytes = 2 * 8192 * (4 * 3 * sizeof(float) + 4 * 2 * sizeof(float) + 4 * 4 + 6 * sizeof(unsigned int));
+
+// Bytes per pixel of the window, 4x MSAA color and depth samples, then two
+// resolved color buffers to swap
+constexpr std::size_t framebufferPixelBytes = 4 * (4 + 4) + 2 * 4;
+
+// Trails are shortened down to this many points before pendulums are removed
+constexpr std::size_t memoryMinTrajectoryPoints = 10;
+
+// MemoryUsage, bytes by subsystem
+struct MemoryUsage {
+	std::size_t ensemble = 0; // Pendulums, links, kernel schedule and parameters of the main ensemble
+	std::size_t trails = 0;   // Trajectory ring buffers of the main ensemble
+	std::size_t layers = 0;   // Both of every layer (see layers.hpp)
+	std::size_t render = 0;   // Render batch, framebuffers and trajectory scratch
+	std::size_t audio = 0;    // Music stream buffers
+
+	std::size_t Total() const
+	{
+		return ensemble + trails + layers + render + audio;
+	}
+};
+
+// Render and audio memory for a window of width by height pixels drawing
+// trails of trajectoryPoints points, and music, whatever the ensemble
+std::size_t EstimateFixedMemory(int width, int height, std::size_t trajectoryPoints, const Music& music);
+
+// Memory of the current ensemble and layers, with the fixed estimate
+MemoryUsage MeasureMemoryUsage(int width, int height, const Music& music);
+
+// MemoryFit, settings values as requested before FitMemoryBudget lowered them
+struct MemoryFit {
+	bool adjusted = false;
+	std::size_t trajectoryPoints = 0;
+	std::size_t joinedPendulumsCount = 0;
+	std::string message; // What was lowered and why, for a toast
+};
+
+// Lower trajectoryPoints, then joinedPendulumsCount of fitted until an
+// ensemble made from it fits in its memoryBudget less reserved bytes
+MemoryFit FitMemoryBudget(SimulationSettings& fitted, std::size_t reserved);
+
+// Put back the values fit lowered, to load or save settings as requested
+void UndoMemoryFit(SimulationSettings& fitted, const MemoryFit& fit);
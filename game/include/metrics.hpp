@@ -0,0 +1,110 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Metrics endpoint header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Metrics endpoint, an HTTP listener serving metrics in the Prometheus text
+// format on GET /metrics, for scrapers watching kiosks. The main loop writes
+// metrics through atomics and the listener thread only reads them, so a
+// scrape never blocks a frame.
+
+// Upper bounds of frame and phase time histogram buckets in seconds, +Inf
+// follows
+constexpr std::array<double, 12> metricsTimeBuckets = { 0.0005, 0.001, 0.002, 0.004, 0.008, 0.012, 0.017, 0.025, 0.033, 0.05, 0.1, 0.25 };
+
+// Pipeline stages with their own histogram, the rest are left out
+constexpr std::size_t metricsMaxPhases = 16;
+
+// MetricsHistogram, seconds observed by the main thread
+struct MetricsHistogram {
+	std::array<std::atomic<std::uint64_t>, metricsTimeBuckets.size() + 1> counts = {}; // Not cumulative
+	std::atomic<double> sum = 0.0;
+
+	// Main thread only, the sum is loaded and stored, not added atomically
+	void Observe(double seconds)
+	{
+		std::size_t bucket = 0;
+		while (bucket < metricsTimeBuckets.size() && seconds > metricsTimeBuckets[bucket])
+		{
+			bucket++;
+		}
+		counts[bucket].fetch_add(1, std::memory_order_relaxed);
+		sum.store(sum.load(std::memory_order_relaxed) + seconds, std::memory_order_relaxed);
+	}
+};
+
+// Metrics, everything served, gauges are stored and counters added to
+struct Metrics {
+	MetricsHistogram frame;
+	std::array<MetricsHistogram, metricsMaxPhases> phases;
+	std::vector<std::string> phaseNames; // Set before the listener starts
+
+	std::atomic<std::uint64_t> steps = 0;          // Steps simulated or requested from shards and nodes
+	std::atomic<double> stepsPerSecond = 0.0;      // Over the last second
+	std::atomic<std::uint64_t> pendulums = 0;
+	std::atomic<double> divergence = 0.0;          // Statistic compared with resetThreshold
+	std::atomic<double> divergenceMean = 0.0;
+	std::atomic<double> resetThreshold = 0.0;
+	std::atomic<std::uint64_t> resets = 0;         // Whole ensemble and segment resets
+	std::atomic<std::uint64_t> trailBytes = 0;     // Trajectory points of every pendulum
+	std::atomic<std::uint64_t> ensembleBytes = 0;  // Pendulum state and per ensemble buffers
+	std::atomic<std::uint64_t> layerBytes = 0;     // Ensembles of every layer, trails included
+	std::atomic<std::uint64_t> renderBytes = 0;    // Estimated framebuffer and batch of raylib
+	std::atomic<std::uint64_t> audioBytes = 0;     // Estimated music stream buffers
+	std::atomic<std::uint64_t> memoryBudgetBytes = 0; // 0 for no budget
+	std::atomic<std::uint64_t> audioUnderruns = 0;
+};
+
+extern Metrics metrics;
+
+// Allocations by operator new since startup, counted whether or not the
+// listener runs
+std::uint64_t GetAllocationCount();
+
+// Serve metrics on address, ":port" for localhost only, false if listening
+// failed
+bool StartMetrics(std::string_view address, std::vector<std::string> phaseNames);
+
+// Stop serving metrics
+void StopMetrics();
+
+// Whether metrics are served
+bool MetricsRunning();
+
+// Metrics in the Prometheus text format
+std::string FormatMetrics();
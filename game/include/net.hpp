@@ -0,0 +1,226 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Stream sockets and message framing header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "stats.hpp"
+
+// Stream sockets, TCP ("host:port", ":port" for any interface) or Unix domain
+// ("unix:/path"), -1 on failure with the reason logged
+// Listening sockets do not block on accept, connections block until
+// Connection makes them non-blocking
+int ListenSocket(std::string_view address);
+int ConnectSocket(std::string_view address);
+
+// Accept a pending connection, -1 if there is none
+int AcceptSocket(int listener);
+
+void CloseSocket(int socket);
+
+// Wait up to timeout seconds (negative for no limit) until one of sockets
+// has input or a connection to accept, false on timeout
+bool WaitForInput(const std::vector<int>& sockets, double timeout);
+
+// Raw bytes on a blocking socket, for protocols other than messages (such as
+// HTTP), ReadSocket returns bytes read, 0 once the peer hung up, or -1 on
+// error or after timeout seconds without input
+long ReadSocket(int socket, void* buffer, std::size_t size, double timeout);
+bool WriteSocket(int socket, const void* data, std::size_t size);
+
+// MessageHeader, precedes every message on a Connection
+// Fields are in native byte order, all nodes must share it
+struct MessageHeader {
+	std::uint32_t type;
+	std::uint32_t size; // Payload bytes after the header
+};
+
+// Largest message payload accepted, larger ones close the connection
+constexpr std::uint32_t maxMessageSize = 1u << 30;
+
+// MessageWriter, payload being built
+struct MessageWriter {
+	std::vector<unsigned char> data;
+
+	template<typename T>
+	void Put(const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		PutBytes(&value, sizeof(T));
+	}
+
+	void PutBytes(const void* bytes, std::size_t size)
+	{
+		auto begin = (const unsigned char*)bytes;
+		data.insert(data.end(), begin, begin + size);
+	}
+
+	// Unsigned LEB128, small values in a single byte
+	void PutVarint(std::uint64_t value)
+	{
+		while (value >= 0x80)
+		{
+			data.push_back((unsigned char)(value | 0x80));
+			value >>= 7;
+		}
+		data.push_back((unsigned char)value);
+	}
+
+	// Zigzag, small magnitudes of either sign in a single byte
+	void PutSignedVarint(std::int64_t value)
+	{
+		PutVarint(((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63));
+	}
+};
+
+// MessageReader, payload being taken apart
+// Reading past the end yields zeros and clears ok
+struct MessageReader {
+	const unsigned char* data;
+	std::size_t size;
+	std::size_t offset = 0;
+	bool ok = true;
+
+	MessageReader(const std::vector<unsigned char>& payload) : data(payload.data()), size(payload.size())
+	{
+	}
+
+	template<typename T>
+	T Get()
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		T value = {};
+		GetBytes(&value, sizeof(T));
+		return value;
+	}
+
+	void GetBytes(void* bytes, std::size_t count)
+	{
+		if (!ok || size - offset < count)
+		{
+			ok = false;
+			std::memset(bytes, 0, count);
+			return;
+		}
+		std::memcpy(bytes, data + offset, count);
+		offset += count;
+	}
+
+	std::uint64_t GetVarint()
+	{
+		std::uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (offset >= size)
+			{
+				ok = false;
+				return 0;
+			}
+			unsigned char byte = data[offset++];
+			value |= (std::uint64_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+			{
+				return value;
+			}
+		}
+		ok = false;
+		return 0;
+	}
+
+	std::int64_t GetSignedVarint()
+	{
+		std::uint64_t value = GetVarint();
+		return (std::int64_t)(value >> 1) ^ -(std::int64_t)(value & 1);
+	}
+
+	// Rest of the payload
+	std::string_view GetRest()
+	{
+		std::string_view rest((const char*)data + offset, size - offset);
+		offset = size;
+		return rest;
+	}
+};
+
+// Connection, message stream over a non-blocking socket, buffered both ways
+// so neither side blocks the frame
+struct Connection {
+	int socket = -1;
+	bool closed = true;
+	std::vector<unsigned char> input;  // Received, not taken yet
+	std::vector<unsigned char> output; // Queued, not sent yet
+	std::size_t outputSent = 0;
+
+	Connection() = default;
+	Connection(const Connection&) = delete;
+	Connection& operator=(const Connection&) = delete;
+
+	~Connection()
+	{
+		Close();
+	}
+
+	// Take over a connected socket
+	void Open(int connected);
+
+	void Close();
+
+	// Queue a message and send what the socket takes right away
+	void Send(std::uint32_t type, const MessageWriter& payload);
+	void Send(std::uint32_t type, const void* payload, std::size_t size);
+
+	// Send queued bytes the socket takes without blocking
+	void Flush();
+
+	// Bytes queued but not sent yet, for back-pressure
+	std::size_t Pending() const
+	{
+		return output.size() - outputSent;
+	}
+
+	// Take the next complete message, reading what arrived without blocking,
+	// false if there is none (closed is set once the peer hung up)
+	bool Receive(MessageHeader& header, std::vector<unsigned char>& payload);
+
+	// Same, waiting up to timeout seconds (negative for no limit) for it
+	bool Wait(MessageHeader& header, std::vector<unsigned char>& payload, double timeout = -1.0);
+};
+
+// Divergence moments and their sketch, sparse, as worker nodes and stream
+// servers send them, ReadDivergence is false on malformed input
+void WriteDivergence(MessageWriter& message, const DistanceMoments& moments, const QuantileSketch& sketch);
+bool ReadDivergence(MessageReader& reader, DistanceMoments& moments, QuantileSketch& sketch);
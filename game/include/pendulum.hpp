@@ -31,8 +31,13 @@
 #pragma once
 
 #include "game.hpp"
+#include "stats.hpp"
 
 #include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
 
  // Vector2Double, 2 double precision component vector
 struct Vector2Double {
@@ -54,97 +59,279 @@ struct SimulationSettings {
 
 	// Simulation settings
 	double gravity;
+	double gravitySpread; // Gravity fanned out over pendulums, fraction of it
 	double fixedDeltaTime;
 	double trajectoryAlphaPower;
 
+	// Integrator, "explicit" for pairwise double pendulum formulas,
+	// "implicit" for the full chain dynamics, stable with long chains of
+	// short, light links at display rate delta time, or "chain" for explicit
+	// steps of the full chain dynamics
+	std::string integrator;
+
 	// Requires simulation reset for these
 	std::size_t pendulumsJoined;
 	std::size_t joinedPendulumsCount;
 	std::size_t trajectoryPoints;
 
+	// Mix of link counts cycled over pendulums ("2,3,4"), "none" for
+	// pendulumsJoined only (also needs reset)
+	std::string pendulumsJoinedMix;
+
 	// Pendulum config (also needs reset)
 	double pendulumLength;
 	double pendulumMass;
 
+	// Fan lengths and masses out over pendulums, fraction of the above from
+	// first to last pendulum, 0 for all the same (also needs reset)
+	double pendulumLengthSpread;
+	double pendulumMassSpread;
+
+	// Initial angle of the first link fanned out over pendulums, radians from
+	// first to last pendulum (also needs reset)
+	double initialAngleSpread;
+
 	// Pendulum color settings
 	float pendulumColorSaturation;
 	float pendulumColorValue;
 
-	// Reset when pendulums diverged (average distance) more than threshold
+	// Reset when pendulums diverged more than threshold, by mean distance
+	// between neighbors (resetQuantile 0) or a quantile of it (0.5 for median)
 	double resetThreshold;
-	std::size_t resetSamples;
+	double resetQuantile;
 	double resetFadeTime;
 
+	// Split pendulums into this many contiguous segments that each fade and
+	// reset on their own once their mean distance crosses the threshold, 1 to
+	// always reset everything at once
+	std::size_t resetSegments;
+
+	// Settings files of more ensembles composited over this one, each applied
+	// over these settings (see layers.hpp), "none" for no layers
+	std::string layers;
+
+	// Seconds per frame this ensemble may spend stepping and drawing, 0 for
+	// no limit
+	double frameBudget;
+
+	// Megabytes (MiB) the app may use, trajectoryPoints and then
+	// joinedPendulumsCount are lowered to fit when loaded, 0 for no limit
+	std::size_t memoryBudget;
+
+	// Kernel instruction set level ("auto", "scalar", "sse4.2", "avx2", "avx512")
+	std::string kernelLevel;
+
+	// Kernel plugin shared object stepping pendulums instead of the built in
+	// kernels, "none" for built in (see kernelplugin.hpp)
+	std::string kernelPlugin;
+
+	// Worker threads including main thread (0 for one per core), and
+	// pendulums per work chunk (rounded up to kernel blocks)
+	std::size_t workerThreads;
+	std::size_t workChunkSize;
+
+	// Spread and pin worker threads over NUMA nodes
+	bool numaAware;
+
+	// Bitwise identical results for any thread count and kernel level
+	bool deterministic;
+
+	// Calibrate the three above at startup, cached per CPU and ensemble size
+	bool autoTune;
+
+	// POSIX shared memory region to publish each step into ("/name"), "none"
+	// to not publish (see sharedstate.hpp)
+	std::string sharedMemoryName;
+
+	// Log main thread stack and recent stage timings to hitches.log when a
+	// frame runs longer than this many seconds, 0 to not watch
+	double hitchDeadline;
+
 	SimulationSettings()
 	{
 		gravity = 0.981;
+		gravitySpread = 0.0;
 		fixedDeltaTime = 0.1666667;
 		trajectoryAlphaPower = 2.5;
 
+		integrator = "explicit";
+
 		pendulumsJoined = 2;
 		joinedPendulumsCount = 1000;
 		trajectoryPoints = 50;
 
+		pendulumsJoinedMix = "none";
+
 		pendulumLength = 150.0;
 		pendulumMass = 10.0;
 
+		pendulumLengthSpread = 0.0;
+		pendulumMassSpread = 0.0;
+
+		initialAngleSpread = 0.0001;
+
 		pendulumColorSaturation = 0.5f;
 		pendulumColorValue = 1.0f;
 
 		resetThreshold = 10.0;
-		resetSamples = 100;
+		resetQuantile = 0.0;
 		resetFadeTime = 2.5;
+
+		resetSegments = 1;
+
+		layers = "none";
+		frameBudget = 0.0;
+		memoryBudget = 0;
+
+		kernelLevel = "auto";
+		kernelPlugin = "none";
+
+		workerThreads = 0;
+		workChunkSize = 256;
+
+		numaAware = true;
+
+		deterministic = false;
+
+		autoTune = false;
+
+		sharedMemoryName = "none";
+
+		hitchDeadline = 0.0;
 	}
 
 	// Load settings from file, return true if simulation needs reset
 	bool LoadSettings(std::string_view filename);
 
+	// Same from the text of a settings file
+	bool LoadSettingsText(std::string_view text);
+
 	// Create a file with current settings
-	void SaveSettings(std::string_view filename)
+	void SaveSettings(std::string_view filename) const
+	{
+		// Ray, why does it not take const char* instead of char* ?
+		SaveFileText(std::string(filename).c_str(), (char*)FormatSettings().c_str());
+	}
+
+	// Text of a settings file with current settings
+	std::string FormatSettings() const
 	{
 		auto data = R"(
 ; Simulation settings
-gravity %f
-fixedDeltaTime %f
-trajectoryAlphaPower %f
+gravity %.17g
+gravitySpread %.17g
+fixedDeltaTime %.17g
+trajectoryAlphaPower %.17g
+
+; Integrator, explicit for pairwise double pendulum formulas, implicit for the full chain dynamics (stable with long chains) or chain for explicit steps of the full chain dynamics
+integrator %s
 
 ; Requires simulation reset for these
 pendulumsJoined %zu
 joinedPendulumsCount %zu
 trajectoryPoints %zu
 
+; Mix of link counts cycled over pendulums (such as 2,3,4), none for pendulumsJoined only (also needs reset)
+pendulumsJoinedMix %s
+
 ; Pendulum config (also needs reset)
-pendulumLength %f
-pendulumMass %f
+pendulumLength %.17g
+pendulumMass %.17g
+
+; Fan lengths and masses out over pendulums, fraction of the above from first to last pendulum (also needs reset)
+pendulumLengthSpread %.17g
+pendulumMassSpread %.17g
+
+; Fan the initial angle of the first link out over pendulums, radians from first to last pendulum (also needs reset)
+initialAngleSpread %.17g
 
 ; Pendulum color settings
-pendulumColorSaturation %f
-pendulumColorValue %f
+pendulumColorSaturation %.17g
+pendulumColorValue %.17g
+
+; Reset when pendulums diverged more than threshold, by mean neighbor distance (0) or its quantile (0.5 for median)
+resetThreshold %.17g
+resetQuantile %.17g
+resetFadeTime %.17g
+
+; Reset contiguous segments of pendulums on their own once their mean distance diverged (1 to reset all at once)
+resetSegments %zu
+
+; Settings files of more ensembles composited over this one (such as layer_3links.txt,layer_wide.txt), each applied over these settings, none for no layers
+layers %s
+
+; Seconds per frame this ensemble may spend stepping and drawing (0 for no limit), steps are skipped and fewer pendulums drawn to stay within it
+frameBudget %.17g
+
+; Megabytes the app may use (0 for no limit), trajectoryPoints and then joinedPendulumsCount are lowered to fit when settings are loaded
+memoryBudget %zu
+
+; Kernel instruction set level (auto, scalar, sse4.2, avx2, avx512)
+kernelLevel %s
+
+; Kernel plugin shared object stepping pendulums instead of the built in kernels (such as ./explicit_kernel.so), none for built in, reloaded when rebuilt
+kernelPlugin %s
+
+; Worker threads including main thread (0 for one per core), pendulums per work chunk
+workerThreads %zu
+workChunkSize %zu
+
+; Spread and pin worker threads over NUMA nodes (1 to enable)
+numaAware %d
+
+; Bitwise identical results for any thread count and kernel level (1 to enable)
+deterministic %d
+
+; Calibrate the three above at startup (1 to enable), cached per CPU and ensemble size
+autoTune %d
+
+; POSIX shared memory region to publish each step into for other processes (such as /hdp_state), none to not publish
+sharedMemoryName %s
 
-; Reset when pendulums diverged (average distance) more than threshold
-resetThreshold %f
-resetSamples %zu
-resetFadeTime %zu
+; Log main thread stack and recent stage timings to hitches.log when a frame takes longer than this many seconds (0 to not watch)
+hitchDeadline %.17g
 		)";
 
-		auto formatted = TextFormat(data,
+		// Not TextFormat, its buffer is shorter than the whole file
+		auto format = [data](auto... values) {
+			std::string text(std::snprintf(nullptr, 0, data, values...), '\0');
+			std::snprintf(text.data(), text.size() + 1, data, values...);
+			return text;
+		};
+		return format(
 			gravity,
+			gravitySpread,
 			fixedDeltaTime,
 			trajectoryAlphaPower,
+			integrator.c_str(),
 			pendulumsJoined,
 			joinedPendulumsCount,
 			trajectoryPoints,
+			pendulumsJoinedMix.c_str(),
 			pendulumLength,
 			pendulumMass,
+			pendulumLengthSpread,
+			pendulumMassSpread,
+			initialAngleSpread,
 			pendulumColorSaturation,
 			pendulumColorValue,
 			resetThreshold,
-			resetSamples,
-			resetFadeTime
+			resetQuantile,
+			resetFadeTime,
+			resetSegments,
+			layers.c_str(),
+			frameBudget,
+			memoryBudget,
+			kernelLevel.c_str(),
+			kernelPlugin.c_str(),
+			workerThreads,
+			workChunkSize,
+			(int)numaAware,
+			(int)deterministic,
+			(int)autoTune,
+			sharedMemoryName.c_str(),
+			hitchDeadline
 		);
-
-		// Ray, why does it not take const char* instead of char* ?
-		SaveFileText(std::string(filename).c_str(), (char*)formatted);
 	}
 };
 
@@ -199,11 +386,11 @@ struct JoinedPendulum {
 		std::size_t trajectoriesSize
 	);
 
-	// Update pendulums
-	void Update();
+	// Capture last pendulum position as trajectory
+	void CaptureTrajectory();
 
-	// Draw last pendulum trajectories
-	void DrawTrajectory(Color color) const;
+	// Draw last pendulum trajectories, faded by fade[point]
+	void DrawTrajectory(Color color, const float* fade) const;
 
 	// Draw all pendulums (lines)
 	void DrawPendulums(Color color) const;
@@ -212,14 +399,101 @@ struct JoinedPendulum {
 // Simulation pendulums
 extern std::vector<JoinedPendulum> pendulums;
 
-// Initialize pendulums
+// Steps since pendulums were initialized
+extern std::uint64_t simulationStep;
+
+// Link counts of a pendulumsJoinedMix ("2,3,4" or "none"), throws
+// std::invalid_argument if invalid
+std::vector<std::size_t> ParseLinkCounts(std::string_view text);
+
+// Simulate only pendulums [first, first + count) of the ensemble here, the
+// rest is simulated by other processes (see shards.hpp)
+// Takes effect from the next InitializePendulums
+void SetEnsembleSlice(std::size_t first, std::size_t count);
+
+// Pendulums of the ensemble before the ones simulated here
+std::size_t GetEnsembleSliceFirst();
+
+// Initialize pendulums, bucketed by link count for the kernels
 void InitializePendulums(int resets = 0);
 
+// Replace pendulums with loaded ones, in any mix of link counts, lengths and
+// masses, to step them from their current angles and angular velocities
+// Gravity still comes from settings
+void LoadPendulums(std::vector<JoinedPendulum> loaded);
+
 // Update pendulums
 void UpdatePendulums();
 
-// Draw pendulum trajectories
-void DrawPendulumTrajectories(float alpha = 1.0f, bool debug = false);
+// Draw pendulum trajectories, each segment further faded by segmentAlpha,
+// only every stride-th pendulum
+void DrawPendulumTrajectories(float alpha = 1.0f, bool debug = false, const std::vector<float>& segmentAlpha = {}, std::size_t stride = 1);
+
+// Number of reset segments, at most resetSegments
+std::size_t GetSegmentCount();
+
+// Reinitialize pendulums of a segment in place, its divergence is not
+// measured again until the next step
+void InitializeSegment(std::size_t segment, int resets);
+
+// Get divergence, statistics of distances between end points of every pair of
+// neighboring pendulums, gathered by the kernels in the last step
+DivergenceStats GetDivergence();
+
+// Times implicit stepping halved a step to converge in the last step, over
+// every kernel block
+std::size_t GetImplicitSplits();
+
+// Hash of the simulation state (angles, angular velocities and trajectory
+// index), the same for any thread count, to compare runs at a given step
+std::uint64_t GetStateHash();
+
+// EnsembleInternals, schedule and cached parameters of an ensemble
+struct EnsembleInternals;
+
+// Ensemble, pendulums with the settings they were made with
+// The globals above are the current ensemble, the functions above work on
+// it. Other ensembles (see layers.hpp) are swapped in to be initialized or
+// stepped, which is only safe while no stage reads the current one
+struct Ensemble {
+	SimulationSettings settings;
+	std::vector<JoinedPendulum> pendulums;
+	std::uint64_t simulationStep = 0;
+	std::unique_ptr<EnsembleInternals> internals;
+
+	Ensemble();
+	Ensemble(Ensemble&& other) noexcept;
+	Ensemble& operator=(Ensemble&& other) noexcept;
+	~Ensemble();
+};
+
+// Swap ensemble with the current one
+void SwapEnsemble(Ensemble& ensemble);
+
+// Draw trajectories of an ensemble that is not current, only every
+// stride-th pendulum
+void DrawEnsembleTrajectories(const Ensemble& ensemble, float alpha, bool debug, std::size_t stride = 1);
+
+// EnsembleMemory, bytes held by an ensemble
+struct EnsembleMemory {
+	std::size_t state;  // Pendulums and links, kernel schedule and parameters
+	std::size_t trails; // Trajectory ring buffers
+};
+
+// Memory of the current ensemble, and of one that is not current, without
+// walking pendulums (their links and trails are measured when made)
+EnsembleMemory GetEnsembleMemory();
+EnsembleMemory GetEnsembleMemory(const Ensemble& ensemble);
+
+// Estimate of the memory of an ensemble made with settings, before making it
+EnsembleMemory EstimateEnsembleMemory(const SimulationSettings& estimated);
+
+// EnergyTotals, mechanical energy of pendulums
+struct EnergyTotals {
+	double energy; // Kinetic plus potential
+	double scale;  // Largest potential energy of the chains, to relate drift to
+};
 
-// Get divergence (average distance for samples)
-double GetDivergence();
+// Energy of the pendulums simulated here, from link angles and angular
+// velocities with each pendulum's own gravity
+EnergyTotals GetEnergy();
@@ -0,0 +1,266 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Frame pipeline header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// StageThread, where a coroutine runs
+enum class StageThread {
+	Main,   // The thread running frames, the only one allowed to call raylib
+	Workers // Any worker thread, alongside everything else
+};
+
+// Task, lazily started coroutine for a pipeline stage or a job over frames
+struct Task {
+
+	struct promise_type {
+		std::function<void()> completion; // Called once finished, on whichever thread
+		std::exception_ptr exception;
+
+		// Calls completion without touching the frame afterwards, since it
+		// may be destroyed by then
+		struct FinalAwaiter {
+			bool await_ready() noexcept { return false; }
+			void await_resume() noexcept {}
+
+			void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+			{
+				auto completion = std::move(handle.promise().completion);
+				if (completion)
+				{
+					completion();
+				}
+			}
+		};
+
+		Task get_return_object()
+		{
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void return_void() {}
+
+		void unhandled_exception()
+		{
+			exception = std::current_exception();
+		}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+
+	Task() = default;
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+	Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	Task(const Task&) = delete;
+
+	Task& operator=(Task&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Reset();
+			handle = std::exchange(other.handle, nullptr);
+		}
+		return *this;
+	}
+
+	~Task()
+	{
+		Reset();
+	}
+
+	// Destroy the coroutine, it must not be running
+	void Reset()
+	{
+		if (handle)
+		{
+			handle.destroy();
+			handle = nullptr;
+		}
+	}
+};
+
+// FramePipeline, runs a frame as stages with declared dependencies
+// Each frame, every stage runs once after all of its dependencies finished.
+// Stages on different threads with no dependency between them overlap. A
+// stage can move itself between threads with co_await SwitchTo(), and jobs
+// spanning several frames park on a stage with co_await NextFrame() or
+// Delay() to be resumed when that stage runs next.
+struct FramePipeline {
+
+	// Stage body, returns the coroutine to run this frame
+	using StageFunction = std::function<Task()>;
+
+	// Stage index of work outside of any stage
+	static constexpr std::size_t noStage = (std::size_t)-1;
+
+	// Job parked until a stage runs at or after time
+	struct Parked {
+		std::coroutine_handle<> handle;
+		double time;
+	};
+
+	// Stage, one step of a frame
+	struct Stage {
+		std::string name;
+		StageThread thread;
+		std::vector<std::size_t> dependents;
+		std::size_t dependencies = 0;
+		StageFunction function;
+
+		// Per frame state
+		std::size_t waitingOn = 0;
+		Task task;
+		std::vector<Parked> parked;
+		double started = 0.0;
+		double seconds = 0.0; // Of clock from start to finish last frame, jobs due included
+	};
+
+	// Awaitable, continue on thread
+	struct SwitchAwaiter {
+		FramePipeline& pipeline;
+		StageThread thread;
+
+		bool await_ready() const noexcept { return false; }
+		void await_resume() const noexcept {}
+
+		void await_suspend(std::coroutine_handle<> handle) const
+		{
+			pipeline.Resume(handle, thread);
+		}
+	};
+
+	// Awaitable, continue when stage runs at or after time
+	struct ParkAwaiter {
+		FramePipeline& pipeline;
+		std::size_t stage;
+		double time;
+
+		bool await_ready() const noexcept { return false; }
+		void await_resume() const noexcept {}
+
+		void await_suspend(std::coroutine_handle<> handle) const
+		{
+			std::lock_guard lock(pipeline.mutex);
+			pipeline.stages[stage].parked.push_back({ handle, time });
+		}
+	};
+
+	std::vector<Stage> stages;
+	std::vector<Task> jobs;                         // Spawned jobs
+	std::vector<std::coroutine_handle<>> jobsDone; // Jobs to destroy after this frame
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::pair<std::size_t, std::function<void()>>> mainQueue; // Stages and coroutines for the main thread, by stage
+	std::atomic<std::size_t> mainStage = noStage;  // Stage the main thread runs work of, for watchdogs
+	std::size_t finished = 0;                      // Stages finished this frame
+	std::exception_ptr exception;                  // First exception thrown this frame
+	double frameSeconds = 0.0;                     // Of clock taken by the last RunFrame
+
+	// Clock used for Delay in seconds, steady clock if empty
+	std::function<double()> clock;
+
+	FramePipeline() = default;
+	FramePipeline(const FramePipeline&) = delete;
+	FramePipeline& operator=(const FramePipeline&) = delete;
+
+	// Add a stage running after the named stages, which must be added before
+	void AddStage(const std::string& name, StageThread thread, const std::vector<std::string>& after, StageFunction function);
+
+	// Add a stage running a plain function
+	template<typename Function>
+		requires std::is_void_v<std::invoke_result_t<Function&>>
+	void AddStage(const std::string& name, StageThread thread, const std::vector<std::string>& after, Function function)
+	{
+		AddStage(name, thread, after, StageFunction([function = std::function<void()>(function)] {
+			return RunFunction(function);
+		}));
+	}
+
+	// Coroutine for a stage that never suspends
+	static Task RunFunction(std::function<void()> function);
+
+	// Index of the named stage, throws std::invalid_argument if missing
+	std::size_t FindStage(const std::string& name) const;
+
+	// Start a job on the calling thread, it runs until its first suspension
+	void Spawn(Task job);
+
+	// Run all stages once, returns when all have finished
+	// Rethrows the first exception a stage or job threw
+	void RunFrame();
+
+	// Continue handle on thread
+	void Resume(std::coroutine_handle<> handle, StageThread thread);
+
+	// Awaitable, move the current coroutine to thread
+	SwitchAwaiter SwitchTo(StageThread thread)
+	{
+		return { *this, thread };
+	}
+
+	// Awaitable, park until the named stage runs next
+	ParkAwaiter NextFrame(const std::string& stage)
+	{
+		return { *this, FindStage(stage), 0.0 };
+	}
+
+	// Awaitable, park until the named stage runs after seconds passed
+	ParkAwaiter Delay(double seconds, const std::string& stage)
+	{
+		return { *this, FindStage(stage), Now() + seconds };
+	}
+
+	// Current time of clock
+	double Now() const;
+
+	// Start stage on its thread
+	void StartStage(std::size_t index);
+
+	// Run stage body and its due jobs on the current thread
+	void RunStage(std::size_t index);
+
+	// Mark stage done and start stages that were waiting only on it
+	void FinishStage(std::size_t index);
+};
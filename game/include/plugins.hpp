@@ -0,0 +1,67 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Kernel plugin loader header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "kernelplugin.hpp"
+
+// Kernel plugin loader, steps pendulums with a kernel plugin instead of the
+// built in kernels (see kernelplugin.hpp)
+//
+// The shared object is copied to a temporary file before loading, so a
+// rebuilt plugin at the same path loads as a new library. Loading and
+// unloading is only safe between frames, while no block is stepped.
+// Plugins are only loaded on Linux and macOS.
+
+// Plugin stepping pendulums, nullptr for the built in kernels
+extern const HdpKernelPlugin* activeKernelPlugin;
+
+// Load the plugin at path in place of the loaded one, "none" to unload
+// Keeps the loaded plugin and returns false if path can not be loaded
+bool LoadKernelPlugin(std::string_view path);
+
+// Unload the loaded plugin
+void UnloadKernelPlugin();
+
+// Whether the loaded plugin's file changed since it was loaded
+bool KernelPluginChanged();
+
+// Path of the loaded plugin, "none" if none
+const std::string& GetKernelPluginPath();
+
+// Loaded plugin even while disabled, nullptr if none
+const HdpKernelPlugin* GetKernelPlugin();
+
+// Step with the loaded plugin or the built in kernels, to compare them
+void EnableKernelPlugin(bool enable);
+bool KernelPluginEnabled();
@@ -0,0 +1,77 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Sampling profiler header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Sampling profiler, SIGPROF from an interval timer of the process CPU time
+// interrupts whichever thread is running, main or worker, and its signal
+// handler stores the thread's stack into a lock-free ring buffer. The main
+// thread moves samples out of the ring each frame and writes them in the
+// folded stack format of flame graph tools, one "thread;outer;...;inner
+// count" line per distinct stack.
+//
+// Only on Linux, symbols come from the executable's own symbol table (static
+// functions included, unless stripped) and from dladdr for shared libraries.
+
+// Samples per second of CPU time when not given
+constexpr int profilerDefaultFrequency = 997;
+
+// Frames of a sample, deeper stacks lose their outermost frames
+constexpr std::size_t profilerMaxDepth = 48;
+
+// Samples the ring holds between collections, more are dropped
+constexpr std::size_t profilerRingSize = 1 << 13;
+
+// Start sampling at frequency samples per second of CPU time over every
+// thread, false if not supported on this platform
+bool StartProfiler(int frequency);
+
+// Stop sampling, collected samples are kept until written
+void StopProfiler();
+
+// Whether samples are being taken
+bool ProfilerRunning();
+
+// Move samples out of the ring into the collected stacks, main thread only,
+// often enough that the ring does not fill (once per frame)
+void CollectProfile();
+
+// Write stacks collected since the last write to filename in folded format
+// and forget them, returns samples written, dropped is set to samples lost
+// to a full ring meanwhile
+std::size_t WriteProfile(const char* filename, std::size_t& dropped);
+
+// Function names of frames, innermost first as backtrace gives them, from
+// any thread
+std::vector<std::string> SymbolizeStack(void* const* frames, std::size_t depth);
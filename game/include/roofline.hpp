@@ -0,0 +1,123 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Roofline analysis header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Roofline analysis, whether a kernel is held back by floating point
+// throughput or by memory bandwidth. The roofs come from small probes: chains
+// of multiply-adds built for the active kernel level, and a triad over
+// buffers larger than the caches. Kernel costs are counted by hand from
+// kernels_impl.hpp, so the counts below must follow changes there.
+//
+// The bandwidth roof of a kernel is measured over as many bytes as the kernel
+// moves in a pass over the ensemble, so ensembles that fit in cache are held
+// to cache bandwidth rather than to memory bandwidth.
+//
+// Flops count additions, multiplications, divisions and square roots, a
+// fused multiply-add as two. Bytes count traffic between memory and the
+// kernel blocks (gather, scatter, cached parameters and the trajectory
+// point), the block itself stays in cache.
+
+// Newton iterations per implicit step assumed by the count, the kernel takes
+// up to 6 and splits steps that do not converge
+constexpr int rooflineImplicitIterations = 3;
+
+// Bytes of the triad measuring memory bandwidth, well past the last level
+// cache
+constexpr std::size_t rooflineMemoryBytes = std::size_t(96) << 20;
+
+// RooflinePeaks, roofs measured on some threads over some bytes
+struct RooflinePeaks {
+	std::size_t threads;
+	double flopsPerSecond;
+	double bytesPerSecond;
+
+	// Flops per byte where the roofs meet, kernels below are memory bound
+	double RidgePoint() const
+	{
+		return flopsPerSecond / bytesPerSecond;
+	}
+
+	// Attainable flops per second at intensity
+	double Roof(double intensity) const
+	{
+		return intensity * bytesPerSecond < flopsPerSecond ? intensity * bytesPerSecond : flopsPerSecond;
+	}
+};
+
+// KernelCost, work per pendulum step (or trajectory point)
+struct KernelCost {
+	double flops;
+	double bytes;
+
+	// Flops per byte
+	double Intensity() const
+	{
+		return bytes > 0.0 ? flops / bytes : 0.0;
+	}
+};
+
+// RooflinePoint, a kernel measured on the ensemble
+struct RooflinePoint {
+	std::string name;
+	KernelCost cost;
+	double unitsPerSecond; // Pendulum steps (or trajectory points)
+	double footprint;      // Bytes moved in a pass over the ensemble
+	bool active;           // Used with current settings
+	bool mainThread;       // Runs on the main thread only, not on workers
+};
+
+// Peak flops per second of the active kernels, over every worker or on the
+// calling thread alone
+double MeasurePeakFlops(bool allWorkers);
+
+// Bytes per second of a triad over bytes in all, from cache or memory
+// depending on bytes
+double MeasureBandwidth(bool allWorkers, std::size_t bytes);
+
+// Cost of stepping a pendulum of links with integrator ("explicit",
+// "implicit" or "chain")
+KernelCost CountStepCost(std::string_view integrator, std::size_t links);
+
+// Cost of unrolling a trajectory point for drawing
+KernelCost CountUnrollCost();
+
+// Cost per pendulum step of the ensemble with integrator, padding of partial
+// kernel blocks included
+KernelCost CountEnsembleStepCost(std::string_view integrator);
+
+// Step the ensemble steps times with each integrator and unroll every
+// trajectory, the integrator is restored but pendulums are left reinitialized
+std::vector<RooflinePoint> MeasureRooflinePoints(std::size_t steps);
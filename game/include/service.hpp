@@ -0,0 +1,106 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Simulation service header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Simulation service, the pendulum engine behind a socket (usually a Unix
+// domain socket, "unix:/path", see net.hpp) for tools that want end
+// positions of their own initial conditions without a copy of the physics.
+// Requests of every client arriving within serviceBatchWindow of each other
+// are coalesced into one batch, stepped together in kernel blocks by the
+// worker pool, and answered as soon as their own duration is reached.
+//
+// Messages are a MessageHeader (net.hpp) and its payload, native byte order:
+//   ServiceSimulate, client to service:
+//     uint64_t id, double seconds, uint32_t pendulums, then for each pendulum
+//     uint32_t links and a ServiceLink per link, from the anchor outwards
+//   ServiceResult, service to client, once per ServiceSimulate:
+//     ServiceResultHeader, then double (x, y) end position of each pendulum
+//   ServiceStatsRequest, client to service, empty
+//   ServiceStatsReply, service to client: ServiceStats
+// Angles are from straight down, positions relative to the anchor with y
+// downwards. Gravity, integrator and fixedDeltaTime are the service's own
+// settings, seconds are rounded to whole steps of fixedDeltaTime.
+
+enum ServiceMessage : std::uint32_t {
+	ServiceSimulate = 1,
+	ServiceResult = 2,
+	ServiceStatsRequest = 3,
+	ServiceStatsReply = 4,
+};
+
+// Seconds to wait for more requests after the first one of a batch
+constexpr double serviceBatchWindow = 0.002;
+
+// Pendulums pending to run a batch right away instead
+constexpr std::uint64_t serviceBatchPendulums = 1 << 16;
+
+// Limits of a single request, larger ones are answered as invalid
+constexpr std::uint32_t serviceMaxLinks = 64;
+constexpr std::uint64_t serviceMaxSteps = 1 << 20;
+
+// ServiceLink, initial state of a link
+struct ServiceLink {
+	double length;
+	double mass;
+	double angle;
+	double angularVelocity;
+};
+
+// ServiceResultHeader, start of a ServiceResult
+struct ServiceResultHeader {
+	std::uint64_t id;
+	std::uint32_t status;         // 0 if simulated, 1 if the request was invalid
+	std::uint32_t pendulums;
+	std::uint64_t steps;          // Steps of fixedDeltaTime simulated
+	std::uint64_t batchPendulums; // Pendulums of every request in its batch
+	double latency;               // Seconds from receiving the request to answering it
+};
+
+// ServiceStats, totals since the service started
+struct ServiceStats {
+	std::uint64_t requests;
+	std::uint64_t pendulums;
+	std::uint64_t pendulumSteps;
+	std::uint64_t batches;
+	double uptime;                 // Seconds
+	double busy;                   // Seconds spent running batches
+	double latencyMedian;          // Seconds, from a QuantileSketch of every request
+	double latencyP99;
+	double latencyMax;
+	double pendulumStepsPerSecond; // While busy
+};
+
+// Service main, serve requests at address with settings of settingsFilename
+// until interrupted
+int RunService(std::string_view address, const char* settingsFilename);
@@ -0,0 +1,68 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Ensemble shard processes header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "stats.hpp"
+
+// Sharded mode, the ensemble split into contiguous slices, each simulated by
+// a headless shard process on its own slice and published with trajectories
+// into its own shared memory region (see sharedstate.hpp). The render
+// process drives the shards through the region headers and composites their
+// slices into its pendulums for the usual draw path. A shard that exits only
+// loses its slice, which is started again with the next full reset.
+
+// Start count shard processes running executable, false if not supported
+// Shards fit settings into memoryBudget after memoryReserved bytes, the same
+// as the render process did, so their slices line up with its pendulums
+bool StartShards(std::size_t count, const char* executable, std::size_t memoryReserved = 0);
+
+// Stop shard processes and remove their regions
+void StopShards();
+
+// Whether shard processes were started
+bool ShardsRunning();
+
+// Ask every shard for one more step
+void RequestShardStep();
+
+// Ask every shard to reinitialize with resets, starting lost shards again
+void RequestShardReset(int resets);
+
+// Copy the latest step of every shard into pendulums and merge their
+// divergence, pairs across slices are left out
+DivergenceStats CompositeShards();
+
+// Shard process main, simulate slice index of count with settings from
+// settingsFilename, fitted into memoryBudget after memoryReserved bytes,
+// until the render process exits
+int RunShard(std::size_t index, std::size_t count, const char* settingsFilename, std::size_t memoryReserved = 0);
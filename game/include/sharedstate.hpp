@@ -0,0 +1,126 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Shared memory state export header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "stats.hpp"
+
+// Shared state export, the ensemble of each step published into a POSIX
+// shared memory region for other processes to read in place
+//
+// Layout, native byte order, offsets in bytes:
+//   SharedStateHeader at the region start
+//   Two SharedStateSlot, at slotOffset[0] and slotOffset[1], each followed
+//   by its arrays at offsets from the slot start:
+//     double   endPosition[pendulums * 2] (x, y) of each pendulum's last link
+//     double   angle[links]               every link, pendulum by pendulum
+//     uint32_t linkCount[pendulums]
+//     double   position[links * 2]        (x, y) end of every link
+//     uint32_t sketch[QuantileSketch::bucketCount] of divergence
+//   and if trajectoryPoints is not 0:
+//     double   trajectory[pendulums * trajectoryPoints * 2] ring buffers
+//     uint32_t trajectoryIndex[pendulums] next ring position to write
+//
+// The writer fills the slot that is not latest and then makes it latest, so
+// readers rarely read the slot being written. Each slot is a seqlock, and
+// the header's layout counter another one over region size and offsets:
+//   do {
+//       layout = header.layout (acquire), again while odd
+//       map again if header.regionSize grew
+//       slot = header.latest, sequence = slot.sequence (acquire), again while odd
+//       read the slot in place
+//       acquire fence
+//   } while (slot.sequence != sequence || header.layout != layout)
+// The writer never waits for readers.
+
+constexpr char sharedStateMagic[8] = { 'H', 'D', 'P', 'S', 'T', 'A', 'T', 'E' };
+constexpr std::uint32_t sharedStateVersion = 2;
+
+// Counters are shared between processes, so they must not use locks
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+// SharedStateHeader, start of the region
+struct alignas(64) SharedStateHeader {
+	char magic[8];                     // sharedStateMagic
+	std::uint32_t version;             // sharedStateVersion
+	std::uint32_t headerSize;          // sizeof(SharedStateHeader)
+	std::atomic<std::uint64_t> layout; // Odd while the region is resized
+	std::uint64_t regionSize;
+	std::uint64_t slotOffset[2];
+	std::atomic<std::uint64_t> latest; // Slot of the last complete step
+
+	// Written by a reader driving the writer, only shard processes act on
+	// them (see shards.hpp)
+	std::atomic<std::uint64_t> requestedSteps;
+	std::atomic<std::uint64_t> requestedResets;
+};
+
+// SharedStateSlot, one step of the ensemble
+struct alignas(64) SharedStateSlot {
+	std::atomic<std::uint64_t> sequence; // Odd while being written
+	std::uint64_t step;                  // Steps since pendulums were initialized
+	std::uint64_t resets;                // Resets they were initialized with
+	std::uint64_t pendulums;
+	std::uint64_t links;                 // Over all pendulums
+	std::uint64_t first;                 // Index of the first pendulum in the ensemble
+	std::uint64_t ensemble;              // Pendulums in the whole ensemble
+	std::uint64_t trajectoryPoints;      // 0 if trajectories are left out
+
+	std::uint64_t endPositionOffset;
+	std::uint64_t angleOffset;
+	std::uint64_t linkCountOffset;
+	std::uint64_t positionOffset;
+	std::uint64_t sketchOffset;
+	std::uint64_t trajectoryOffset;
+	std::uint64_t trajectoryIndexOffset;
+
+	// Distances between end points of neighboring pendulums
+	std::uint64_t divergenceCount; // Pairs
+	double divergenceMean;
+	double divergenceStandardDeviation;
+	double divergenceMedian;
+	double divergenceMax;
+};
+
+// Publish pendulums and divergence of the last step into the region named by
+// settings.sharedMemoryName, (re)creating it when the name or the ensemble's
+// size changed, nothing for "none"
+// Trajectories are published too if trajectories is set, and resets is
+// passed on to readers as is
+void PublishSharedState(const DivergenceStats& divergence, bool trajectories = false, std::uint64_t resets = 0);
+
+// Header of the region published into, nullptr if none is open
+SharedStateHeader* GetSharedStateHeader();
+
+// Unmap and remove the region, readers keep what they mapped
+void CloseSharedState();
@@ -0,0 +1,156 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Ensemble statistics header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// QuantileSketch, log-linear histogram of non-negative values
+// Values are binned by binary exponent and the top subBucketBits of the
+// mantissa, so a quantile is off by at most 1 / 2^(subBucketBits + 1) relative
+// error. Counts are integers, so merging in any order gives the same sketch.
+struct QuantileSketch {
+	static constexpr int minExponent = -32; // Smaller values share the first bucket
+	static constexpr int maxExponent = 32;  // Larger values share the last bucket
+	static constexpr int subBucketBits = 3;
+	static constexpr std::size_t bucketCount = (std::size_t)(maxExponent - minExponent) << subBucketBits;
+
+	std::array<std::uint32_t, bucketCount> counts = {};
+	std::uint64_t total = 0;
+
+	// Bucket of value, from the bits of the double
+	static std::size_t Bucket(double value)
+	{
+		auto bits = std::bit_cast<std::uint64_t>(value);
+		int exponent = (int)((bits >> 52) & 0x7FF) - 1023;
+		if (exponent < minExponent || value <= 0.0)
+		{
+			return 0;
+		}
+		if (exponent >= maxExponent)
+		{
+			return bucketCount - 1;
+		}
+
+		std::size_t sub = (bits >> (52 - subBucketBits)) & ((1 << subBucketBits) - 1);
+		return ((std::size_t)(exponent - minExponent) << subBucketBits) | sub;
+	}
+
+	void Add(double value)
+	{
+		counts[Bucket(value)]++;
+		total++;
+	}
+
+	void Merge(const QuantileSketch& other)
+	{
+		for (std::size_t i = 0; i < bucketCount; i++)
+		{
+			counts[i] += other.counts[i];
+		}
+		total += other.total;
+	}
+
+	void Clear()
+	{
+		counts.fill(0);
+		total = 0;
+	}
+
+	// Value at quantile q (0 to 1), the middle of its bucket
+	double Quantile(double q) const;
+};
+
+// DistanceMoments, count, mean, variance and max of distances
+// Uses Chan's parallel update, so moments of consecutive ranges merge without
+// another pass over the distances
+struct DistanceMoments {
+	std::size_t count = 0; // Pairs
+	double mean = 0.0;
+	double m2 = 0.0;       // Sum of squared differences from mean
+	double max = 0.0;
+
+	// Add a single distance
+	void Add(double distance)
+	{
+		Merge(1, distance, 0.0, distance);
+	}
+
+	// Merge moments of count distances
+	void Merge(std::size_t otherCount, double otherMean, double otherM2, double otherMax)
+	{
+		if (otherCount == 0)
+		{
+			return;
+		}
+
+		std::size_t total = count + otherCount;
+		double delta = otherMean - mean;
+		mean += delta * otherCount / total;
+		m2 += otherM2 + delta * delta * count * otherCount / total;
+		max = count == 0 || otherMax > max ? otherMax : max;
+		count = total;
+	}
+
+	double Variance() const
+	{
+		return count > 1 ? m2 / (count - 1) : 0.0;
+	}
+
+	double StandardDeviation() const
+	{
+		return std::sqrt(Variance());
+	}
+};
+
+// DivergenceStats, distances between end points of neighboring pendulums,
+// over the whole ensemble and within each reset segment
+struct DivergenceStats : DistanceMoments {
+	QuantileSketch sketch;
+	std::vector<DistanceMoments> segments; // Pairs across segment boundaries are left out
+
+	// Add a single distance
+	void Add(double distance)
+	{
+		DistanceMoments::Add(distance);
+		sketch.Add(distance);
+	}
+
+	// Mean for q = 0, otherwise quantile q of the sketch
+	double Statistic(double q) const
+	{
+		return q <= 0.0 ? mean : sketch.Quantile(q);
+	}
+};
@@ -0,0 +1,94 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Remote viewing header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "stats.hpp"
+
+// Remote viewing, the ensemble simulated by a stream server without window
+// and drawn by thin viewers elsewhere, over TCP (or Unix domain sockets, see
+// net.hpp). The server steps at streamStepRate and sends each viewer a frame
+// per step: the end positions of every pendulum, or the positions of every
+// link while the viewer shows pendulums (F3), quantized and delta coded
+// against the last frame sent to that viewer, with divergence and reset fade.
+// Viewers mirror them into their pendulums as trajectories, without stepping.
+//
+// Viewers acknowledge the frames they took once per drawn frame. Frames for a
+// viewer with streamFramesInFlight frames not acknowledged yet, or with bytes
+// of earlier frames still queued, are dropped, so a slow viewer or link gets
+// fewer trajectory points instead of falling behind. Deltas are against the
+// last frame actually sent, so dropping needs no keyframes.
+//
+// The server resets the whole ensemble, as with shards or nodes, and sends
+// every viewer the reset count and settings to reinitialize its mirror with.
+
+// Positions are rounded to multiples of this before delta coding
+constexpr double streamPositionQuantum = 1.0 / 64.0;
+
+// Steps per second of the server, one per frame of a viewer at 60 FPS
+constexpr double streamStepRate = 60.0;
+
+// Frames sent to a viewer and not acknowledged yet before dropping more
+constexpr std::uint64_t streamFramesInFlight = 4;
+
+// StreamView, what a viewer shows besides the mirrored pendulums
+struct StreamView {
+	bool connected = false;
+	int resets = 0;
+	float alpha = 1.0f;          // Reset fade of the server
+	DivergenceStats divergence;  // Of the last frame taken
+	std::uint64_t step = 0;      // Server step of the last frame taken
+	std::uint64_t frames = 0;    // Frames taken
+	std::uint64_t dropped = 0;   // Frames the server dropped for this viewer
+};
+
+// Stream server main, simulate with settings of settingsFilename and stream
+// every step to viewers connecting on address, until interrupted
+int RunStreamServer(std::string_view address, const char* settingsFilename);
+
+// Connect to the stream server at address, reconnecting whenever it is lost
+void StartStreamViewer(std::string_view address);
+
+// Disconnect from the stream server
+void StopStreamViewer();
+
+// Whether pendulums mirror a stream server
+bool StreamViewerRunning();
+
+// Mirror the frames that arrived into pendulums, capturing trajectories if
+// capture is set, and acknowledge them, asking for every link if full is set
+const StreamView& ReceiveStream(bool full, bool capture);
+
+// Ask the stream server to fade out and reset
+void RequestStreamReset();
@@ -0,0 +1,88 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Parameter sweep header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Parameter sweep, settings given several values each, expanded into a job
+// per combination. A coordinator process hands the jobs to headless worker
+// processes over sockets, local ones through a Unix domain socket and ones
+// on other machines over TCP, one job at a time each. Jobs of a worker that
+// exits are handed out again, up to sweepAttempts times. Results are
+// gathered into one table.
+
+// Times a job is handed out before it counts as failed
+constexpr int sweepAttempts = 3;
+
+// SweepParameter, a setting and the values it takes
+struct SweepParameter {
+	std::string key;
+	std::vector<std::string> values;
+};
+
+// SweepResult, measurements of one job
+struct SweepResult {
+	std::uint64_t steps;      // Until divergence or the step limit
+	bool diverged;
+	double divergenceTime;    // Simulated seconds to the first resetThreshold crossing
+	double energyDrift;       // Change of energy over the run, relative to EnergyTotals::scale
+	double stepNanoseconds;   // Per pendulum step
+	double stepSeconds;       // Spent stepping in all, on one thread
+};
+
+// Parameters of a sweep file, a setting per line followed by its values,
+// each a single value or start:stop:count, throws std::invalid_argument if
+// invalid
+std::vector<SweepParameter> ParseSweep(std::string_view text);
+
+// Values of every combination of parameters, the first parameter varying
+// slowest
+std::vector<std::vector<std::string>> ExpandSweep(const std::vector<SweepParameter>& parameters);
+
+// Simulate current settings from a fresh start for up to steps steps,
+// stopping at the first divergence
+SweepResult RunSweepJob(std::uint64_t steps);
+
+// Coordinator main, run every combination of sweepFilename over the settings
+// of settingsFilename on localWorkers worker processes, and on workers
+// connecting to listenAddress unless empty, printing progress, then print the
+// results and save them to resultsFilename, and as comma separated values to
+// csvFilename
+// Worker processes run executable (argv[0])
+int RunSweep(const char* sweepFilename, const char* settingsFilename, const char* resultsFilename, const char* csvFilename, std::size_t localWorkers, std::string_view listenAddress, std::uint64_t steps, const char* executable);
+
+// Worker main, run jobs of the coordinator at address in localWorkers
+// worker processes (this one included) until it disconnects
+int RunSweepWorker(std::string_view address, const char* settingsFilename, std::size_t localWorkers, const char* executable);
@@ -0,0 +1,63 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Watchdog header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "pipeline.hpp"
+
+// Hitch watchdog, a thread watching the main loop for frames that run past a
+// deadline. When one does, it names the stage the main thread is in, samples
+// the main thread's stack and appends both with the stage timings of the
+// last frames as a JSON line to the hitch log, then another line once the
+// frame finished. Frames themselves only store a few numbers.
+//
+// Stacks are only taken on Linux, where SIGUSR2 interrupts the main thread.
+
+// Frames before a hitch whose stage timings are logged with it
+constexpr std::size_t watchdogHistory = 8;
+
+// Frames of a main thread stack, deeper stacks lose their outermost frames
+constexpr std::size_t watchdogMaxDepth = 48;
+
+// Watch frames of pipeline from the main thread for running longer than
+// deadline seconds, logging hitches to filename, 0 to stop watching
+// Restarts only when deadline or filename changed, so it can follow settings
+bool StartWatchdog(const FramePipeline& pipeline, double deadline, const char* filename);
+
+// Stop watching
+void StopWatchdog();
+
+// Whether frames are watched
+bool WatchdogRunning();
+
+// Mark the start of a frame, main thread only, before pipeline.RunFrame()
+void WatchdogFrame();
@@ -0,0 +1,192 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Worker thread pool header file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// CPUs of each NUMA node, a single node with no CPUs listed if unknown
+std::vector<std::vector<int>> GetNumaNodes();
+
+// WorkerPool, fixed set of threads running parallel loops with the caller
+// A loop's chunks are split into one contiguous partition per thread, so
+// repeated loops over the same range touch the same memory from the same
+// thread (and NUMA node). Threads that finish early steal from partitions
+// on their own node, and from other nodes only under imbalance.
+// Between loops, threads also run tasks submitted from any thread.
+struct WorkerPool {
+
+	// Range job, called with [begin, end) of a chunk
+	using RangeFunction = std::function<void(std::size_t begin, std::size_t end)>;
+
+	// Task, run once by any worker thread
+	using TaskFunction = std::function<void()>;
+
+	// Partition, chunks [next, end) owned by one thread
+	struct alignas(64) Partition {
+		std::atomic<std::size_t> next = 0;
+		std::size_t end = 0;
+		std::size_t node = 0;
+	};
+
+	// Least chunks left in a partition on another node before stealing from it
+	static constexpr std::size_t crossNodeStealMinimum = 2;
+
+	// Range of each partial result in deterministic reductions
+	static constexpr std::size_t reduceBlockSize = 1024;
+
+	std::vector<std::thread> threads;
+	std::unique_ptr<Partition[]> partitions; // Index 0 is the caller
+	std::size_t nodes = 1;
+	bool numaAware = false;
+	std::thread::id owner; // Thread that started the pool, runs parallel loops
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::uint64_t generation = 0;
+	bool stopping = false;
+
+	// Current job, valid while chunks are left or threads are still in it
+	const RangeFunction* job = nullptr;
+	std::size_t jobCount = 0;
+	std::size_t jobChunk = 0;
+	std::atomic<std::size_t> remaining = 0; // Chunks not finished yet
+	std::size_t busy = 0; // Threads inside the current job
+
+	// Submitted tasks, run in order by whichever thread is free
+	std::deque<TaskFunction> tasks;
+
+	WorkerPool() = default;
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	~WorkerPool()
+	{
+		Stop();
+	}
+
+	// (Re)start with total threads including the caller, 0 for one per core
+	// With numa, threads are spread over NUMA nodes and pinned to them
+	void Start(std::size_t total, bool numa = true);
+
+	// Join all threads
+	void Stop();
+
+	// Threads taking part in a parallel loop, including the caller
+	std::size_t Size() const
+	{
+		return threads.size() + 1;
+	}
+
+	// Index of the calling thread in [0, Size()), 0 for the owner and any
+	// thread outside the pool, for per-thread partial results
+	static std::size_t ThreadIndex();
+
+	// Run task on a worker thread, or right away if there are none
+	// Tasks must not block on each other, and do not take part in loops
+	void Submit(TaskFunction task);
+
+	// Run function over [0, count) in chunks of chunkSize, returns when all
+	// chunks are done
+	// Only the owner thread runs loops in parallel, others (such as tasks)
+	// run the whole range inline
+	void ParallelFor(std::size_t count, std::size_t chunkSize, const RangeFunction& function);
+
+	// Combine partial(begin, end) results over [0, count) with combine
+	// Deterministic reductions take partials of fixed reduceBlockSize ranges
+	// and combine them in a fixed pairwise tree, so the result is the same
+	// for any thread count, chunk size and schedule. Otherwise partials of
+	// chunkSize ranges are combined in the order they finish.
+	template<typename T, typename Partial, typename Combine>
+	T ParallelReduce(std::size_t count, std::size_t chunkSize, bool deterministic, T identity, Partial partial, Combine combine)
+	{
+		if (!deterministic)
+		{
+			T result = identity;
+			std::mutex resultMutex;
+			ParallelFor(count, chunkSize, [&](std::size_t begin, std::size_t end) {
+				T value = partial(begin, end);
+				std::lock_guard lock(resultMutex);
+				result = combine(result, value);
+			});
+			return result;
+		}
+
+		const std::size_t blocks = (count + reduceBlockSize - 1) / reduceBlockSize;
+		if (blocks == 0)
+		{
+			return identity;
+		}
+
+		std::vector<T> partials(blocks, identity);
+		ParallelFor(blocks, std::max<std::size_t>(chunkSize / reduceBlockSize, 1), [&](std::size_t begin, std::size_t end) {
+			for (std::size_t b = begin; b < end; b++)
+			{
+				partials[b] = partial(b * reduceBlockSize, std::min((b + 1) * reduceBlockSize, count));
+			}
+		});
+
+		for (std::size_t stride = 1; stride < blocks; stride *= 2)
+		{
+			for (std::size_t i = 0; i + stride < blocks; i += stride * 2)
+			{
+				partials[i] = combine(partials[i], partials[i + stride]);
+			}
+		}
+		return partials[0];
+	}
+
+	// Run chunks of own partition, then steal until none are left
+	void RunChunks(std::size_t self);
+
+	// Run chunks of partition until empty, or until fewer than keep are left
+	void RunPartition(Partition& partition, std::size_t keep);
+
+	// Count a finished chunk, waking the owner after the last one
+	void FinishChunk();
+
+	// Worker thread main loop, seen is the last job generation at start and
+	// pinTo the node to run on (empty to not pin)
+	void WorkerMain(std::size_t self, std::uint64_t seen, std::vector<int> pinTo);
+};
+
+// Workers shared by simulation and tools
+extern WorkerPool workers;
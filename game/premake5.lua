@@ -49,6 +49,34 @@ project (workspaceName)
 		
     filter{}
 
+    -- Multi-versioned kernels, each source is built for its own instruction
+    -- set and the best one is picked at startup (see kernels.cpp)
+    filter {"files:src/kernels_sse42*.cpp", "platforms:x64 or x86", "action:not vs*"}
+        buildoptions {"-msse4.2"}
+
+    filter {"files:src/kernels_avx2*.cpp", "platforms:x64 or x86", "action:not vs*"}
+        buildoptions {"-mavx2", "-mfma"}
+
+    filter {"files:src/kernels_avx2*.cpp", "platforms:x64 or x86", "action:vs*"}
+        buildoptions {"/arch:AVX2"}
+
+    filter {"files:src/kernels_avx512*.cpp", "platforms:x64 or x86", "action:not vs*"}
+        buildoptions {"-mavx512f", "-mavx512dq", "-mavx512vl", "-mfma"}
+
+    filter {"files:src/kernels_avx512*.cpp", "platforms:x64 or x86", "action:vs*"}
+        buildoptions {"/arch:AVX512"}
+
+    -- Square root as a single instruction, and vector loops with a scalar
+    -- tail, so the distance loops (63 pairs per block) vectorize at -O2
+    filter {"files:src/kernels_*.cpp", "action:not vs*"}
+        buildoptions {"-fno-math-errno", "-fvect-cost-model=cheap"}
+
+    -- Strict kernels for deterministic mode, MSVC does not contract by default
+    filter {"files:src/kernels_*_strict.cpp", "action:not vs*"}
+        buildoptions {"-ffp-contract=off"}
+
+    filter{}
+
   
     includedirs { "./" }
     includedirs { "src" }
@@ -0,0 +1,425 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Cluster mode source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "cluster.hpp"
+#include "kernels.hpp"
+#include "net.hpp"
+#include "pendulum.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Message types, render node to worker nodes and back
+enum ClusterMessage : std::uint32_t {
+    ClusterAssign = 1,   // Slice, resets and settings, reinitializes the node
+    ClusterSettings = 2, // Settings that do not need a reset
+    ClusterStep = 3,     // Step once and answer with a frame
+    ClusterFrame = 4,    // Divergence partials and end position deltas of a step
+};
+
+// Leads every assignment, a node of another version or byte order refuses it
+constexpr std::uint32_t clusterProtocol = 0x48445031; // "HDP1"
+
+// Connection attempts of a worker node before giving up, a second apart
+constexpr int clusterConnectAttempts = 30;
+
+// End position in quanta
+static std::int64_t Quantize(double value)
+{
+    return (std::int64_t)std::llround(value / clusterPositionQuantum);
+}
+
+// First pendulum and pendulums of slice index of count
+static void GetClusterSlice(std::size_t index, std::size_t count, std::size_t ensemble, std::size_t& first, std::size_t& size)
+{
+    first = ensemble * index / count;
+    size = ensemble * (index + 1) / count - first;
+}
+
+// ClusterNode, a worker node as seen by the render node
+struct ClusterNode {
+    Connection connection;
+    bool assigned = false;  // Has a slice of the current ensemble
+    bool stepping = false;  // Asked for a step, not answered yet
+    std::size_t first = 0;
+    std::size_t count = 0;
+    std::vector<std::int64_t> quantized; // (x, y) end positions answered last, in quanta
+    DistanceMoments moments;             // Of the step answered last
+    QuantileSketch sketch;
+};
+
+static int clusterListener = -1;
+static std::vector<std::unique_ptr<ClusterNode>> clusterNodes;
+static std::size_t clusterNodesExpected = 0;
+static bool clusterStarted = false;    // Nodes got their first slices
+static bool clusterResetPending = false;
+static int clusterResets = 0;
+
+// Whether some node did not answer the last step yet
+static bool ClusterStepping()
+{
+    return std::any_of(clusterNodes.begin(), clusterNodes.end(), [](const auto& node) { return node->stepping; });
+}
+
+// Take connections of nodes waiting to join
+static void AcceptClusterNodes()
+{
+    for (int s = AcceptSocket(clusterListener); s >= 0; s = AcceptSocket(clusterListener))
+    {
+        auto node = std::make_unique<ClusterNode>();
+        node->connection.Open(s);
+        clusterNodes.push_back(std::move(node));
+        TraceLog(LOG_INFO, TextFormat("CLUSTER: Node %zu connected", clusterNodes.size() - 1));
+    }
+}
+
+// Split the ensemble over every connected node and reinitialize them, only
+// while no step is outstanding so all of them start from the same step
+static void AssignClusterSlices()
+{
+    const std::string text = settings.FormatSettings();
+    const std::size_t ensemble = settings.joinedPendulumsCount;
+    for (std::size_t n = 0; n < clusterNodes.size(); n++)
+    {
+        auto& node = *clusterNodes[n];
+        GetClusterSlice(n, clusterNodes.size(), ensemble, node.first, node.count);
+        node.assigned = true;
+        node.stepping = false;
+        node.quantized.assign(node.count * 2, 0);
+        node.moments = DistanceMoments();
+        node.sketch.Clear();
+
+        MessageWriter message;
+        message.Put(clusterProtocol);
+        message.Put<std::uint64_t>(node.first);
+        message.Put<std::uint64_t>(node.count);
+        message.Put<std::int64_t>(clusterResets);
+        message.PutBytes(text.data(), text.size());
+        node.connection.Send(ClusterAssign, message);
+    }
+    clusterResetPending = false;
+}
+
+// Mirror a frame of node into pendulums, unless a reset is waiting for it
+// (the mirror was reinitialized already)
+static bool ReadClusterFrame(ClusterNode& node, const std::vector<unsigned char>& payload)
+{
+    MessageReader reader(payload);
+    reader.Get<std::uint64_t>(); // Step
+    DistanceMoments moments;
+    QuantileSketch sketch;
+    if (!ReadDivergence(reader, moments, sketch))
+    {
+        return false;
+    }
+
+    const bool mirror = !clusterResetPending && node.first + node.count <= pendulums.size();
+    for (std::size_t i = 0; i < node.count && reader.ok; i++)
+    {
+        auto& x = node.quantized[i * 2];
+        auto& y = node.quantized[i * 2 + 1];
+        x += reader.GetSignedVarint();
+        y += reader.GetSignedVarint();
+        if (mirror && !pendulums[node.first + i].pendulums.empty())
+        {
+            auto& jp = pendulums[node.first + i];
+            jp.pendulums.back().position = Vector2Double(x * clusterPositionQuantum, y * clusterPositionQuantum);
+            jp.CaptureTrajectory();
+        }
+    }
+    if (!reader.ok)
+    {
+        return false;
+    }
+
+    node.moments = moments;
+    node.sketch = sketch;
+    return true;
+}
+
+// Forget a node that disconnected, its slice fades out of the mirror
+static void DropClusterNode(std::size_t n)
+{
+    auto& node = *clusterNodes[n];
+    TraceLog(LOG_WARNING, TextFormat("CLUSTER: Node %zu disconnected, its slice is lost until the next reset", n));
+    if (node.assigned && node.first + node.count <= pendulums.size())
+    {
+        for (std::size_t i = node.first; i < node.first + node.count; i++)
+        {
+            std::fill(pendulums[i].trajectories.begin(), pendulums[i].trajectories.end(), Vector2Double());
+        }
+    }
+    clusterNodes.erase(clusterNodes.begin() + n);
+}
+
+bool StartCluster(std::string_view address, std::size_t nodes)
+{
+    StopCluster();
+
+    clusterListener = ListenSocket(address);
+    if (clusterListener < 0)
+    {
+        return false;
+    }
+    clusterNodesExpected = std::max<std::size_t>(nodes, 1);
+    TraceLog(LOG_INFO, TextFormat("CLUSTER: Waiting for %zu nodes on %s", clusterNodesExpected, std::string(address).c_str()));
+    return true;
+}
+
+void StopCluster()
+{
+    clusterNodes.clear();
+    CloseSocket(clusterListener);
+    clusterListener = -1;
+    clusterStarted = false;
+    clusterResetPending = false;
+}
+
+bool ClusterRunning()
+{
+    return clusterListener >= 0;
+}
+
+void RequestClusterStep()
+{
+    if (!clusterStarted || ClusterStepping())
+    {
+        return;
+    }
+    if (clusterResetPending)
+    {
+        AssignClusterSlices();
+    }
+
+    for (auto& node : clusterNodes)
+    {
+        if (node->assigned)
+        {
+            node->stepping = true;
+            node->connection.Send(ClusterStep, nullptr, 0);
+        }
+    }
+}
+
+void RequestClusterReset(int resets)
+{
+    clusterResets = resets;
+    clusterResetPending = true;
+    if (clusterStarted && !ClusterStepping())
+    {
+        AssignClusterSlices();
+    }
+}
+
+void UpdateClusterSettings()
+{
+    const std::string text = settings.FormatSettings();
+    for (auto& node : clusterNodes)
+    {
+        if (node->assigned)
+        {
+            node->connection.Send(ClusterSettings, text.data(), text.size());
+        }
+    }
+}
+
+DivergenceStats CompositeCluster()
+{
+    DivergenceStats divergence;
+    if (!ClusterRunning())
+    {
+        return divergence;
+    }
+    AcceptClusterNodes();
+
+    MessageHeader header;
+    std::vector<unsigned char> payload;
+    for (std::size_t n = 0; n < clusterNodes.size();)
+    {
+        auto& node = *clusterNodes[n];
+        while (node.connection.Receive(header, payload))
+        {
+            if (header.type != ClusterFrame || !node.stepping || !ReadClusterFrame(node, payload))
+            {
+                TraceLog(LOG_WARNING, TextFormat("CLUSTER: Unexpected message from node %zu", n));
+                node.connection.Close();
+                break;
+            }
+            node.stepping = false;
+        }
+
+        if (node.connection.closed)
+        {
+            DropClusterNode(n);
+            continue;
+        }
+        n++;
+    }
+
+    // Start with the nodes asked for, later nodes join with the next reset,
+    // or right away once every node with a slice is gone
+    bool anyAssigned = std::any_of(clusterNodes.begin(), clusterNodes.end(), [](const auto& node) { return node->assigned; });
+    if (!clusterStarted && clusterNodes.size() >= clusterNodesExpected)
+    {
+        clusterStarted = true;
+        TraceLog(LOG_INFO, TextFormat("CLUSTER: Starting with %zu nodes", clusterNodes.size()));
+        AssignClusterSlices();
+    }
+    else if (clusterStarted && !clusterNodes.empty() && (!anyAssigned || clusterResetPending) && !ClusterStepping())
+    {
+        AssignClusterSlices();
+    }
+
+    for (auto& node : clusterNodes)
+    {
+        divergence.Merge(node->moments.count, node->moments.mean, node->moments.m2, node->moments.max);
+        divergence.sketch.Merge(node->sketch);
+    }
+    return divergence;
+}
+
+// Settings of text, with performance settings of this node kept from local
+static void ApplyClusterSettings(std::string_view text, const SimulationSettings& local)
+{
+    SimulationSettings loaded = settings;
+    loaded.LoadSettingsText(text);
+    loaded.kernelLevel = local.kernelLevel;
+    loaded.workerThreads = local.workerThreads;
+    loaded.workChunkSize = local.workChunkSize;
+    loaded.numaAware = local.numaAware;
+    loaded.autoTune = false;
+    loaded.sharedMemoryName = "none";
+    settings = loaded;
+    SelectKernels(settings.kernelLevel, settings.deterministic);
+}
+
+// Frame of the last step of the slice simulated here, end positions delta
+// coded against quantized, which is updated to them
+static void WriteClusterFrame(MessageWriter& message, std::vector<std::int64_t>& quantized)
+{
+    DivergenceStats divergence = GetDivergence();
+    message.Put<std::uint64_t>(simulationStep);
+    WriteDivergence(message, divergence, divergence.sketch);
+
+    quantized.resize(pendulums.size() * 2, 0);
+    for (std::size_t i = 0; i < pendulums.size(); i++)
+    {
+        auto position = pendulums[i].pendulums.empty() ? Vector2Double() : pendulums[i].pendulums.back().position;
+        std::int64_t x = Quantize(position.x);
+        std::int64_t y = Quantize(position.y);
+        message.PutSignedVarint(x - quantized[i * 2]);
+        message.PutSignedVarint(y - quantized[i * 2 + 1]);
+        quantized[i * 2] = x;
+        quantized[i * 2 + 1] = y;
+    }
+}
+
+int RunClusterWorker(std::string_view address, const char* settingsFilename)
+{
+    SimulationSettings local;
+    if (FileExists(settingsFilename))
+    {
+        local.LoadSettings(settingsFilename);
+    }
+    settings = local;
+    SelectKernels(settings.kernelLevel, settings.deterministic);
+    workers.Start(settings.workerThreads, settings.numaAware);
+
+    // The render node may still be starting
+    Connection connection;
+    for (int attempt = 0; attempt < clusterConnectAttempts && connection.closed; attempt++)
+    {
+        if (attempt > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        connection.Open(ConnectSocket(address));
+    }
+    if (connection.closed)
+    {
+        workers.Stop();
+        return 1;
+    }
+    TraceLog(LOG_INFO, TextFormat("CLUSTER: Connected to %s", std::string(address).c_str()));
+
+    MessageHeader header;
+    std::vector<unsigned char> payload;
+    std::vector<std::int64_t> quantized;
+    MessageWriter frame;
+    bool assigned = false;
+    while (connection.Wait(header, payload))
+    {
+        MessageReader reader(payload);
+        if (header.type == ClusterAssign)
+        {
+            if (reader.Get<std::uint32_t>() != clusterProtocol)
+            {
+                TraceLog(LOG_ERROR, "CLUSTER: Render node speaks another protocol version or byte order");
+                break;
+            }
+            std::size_t first = reader.Get<std::uint64_t>();
+            std::size_t count = reader.Get<std::uint64_t>();
+            int resets = (int)reader.Get<std::int64_t>();
+            ApplyClusterSettings(reader.GetRest(), local);
+
+            SetEnsembleSlice(first, count);
+            InitializePendulums(resets);
+            quantized.assign(pendulums.size() * 2, 0);
+            assigned = true;
+            TraceLog(LOG_INFO, TextFormat("CLUSTER: Simulating pendulums %zu to %zu, reset %d", first, first + count, resets));
+        }
+        else if (header.type == ClusterSettings)
+        {
+            ApplyClusterSettings(reader.GetRest(), local);
+        }
+        else if (header.type == ClusterStep && assigned)
+        {
+            UpdatePendulums();
+            frame.data.clear();
+            WriteClusterFrame(frame, quantized);
+            connection.Send(ClusterFrame, frame);
+        }
+        else
+        {
+            TraceLog(LOG_ERROR, TextFormat("CLUSTER: Unexpected message %u from render node", header.type));
+            break;
+        }
+    }
+
+    TraceLog(LOG_INFO, "CLUSTER: Disconnected from render node");
+    workers.Stop();
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   CPU feature detection source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "cpu.hpp"
+
+#include <array>
+#include <cctype>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define CPU_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+const char* CpuFeatureLevelName(CpuFeatureLevel level)
+{
+    switch (level)
+    {
+    case CpuFeatureLevel::Scalar: return "Scalar";
+    case CpuFeatureLevel::SSE42: return "SSE4.2";
+    case CpuFeatureLevel::AVX2: return "AVX2";
+    case CpuFeatureLevel::AVX512: return "AVX-512";
+    default: return "Unknown";
+    }
+}
+
+bool ParseCpuFeatureLevel(std::string_view text, CpuFeatureLevel& level)
+{
+    std::string name(text);
+    for (auto& c : name)
+    {
+        c = (char)std::tolower((unsigned char)c);
+    }
+
+    if (name == "scalar") level = CpuFeatureLevel::Scalar;
+    else if (name == "sse4.2" || name == "sse42") level = CpuFeatureLevel::SSE42;
+    else if (name == "avx2") level = CpuFeatureLevel::AVX2;
+    else if (name == "avx512" || name == "avx-512") level = CpuFeatureLevel::AVX512;
+    else return false;
+
+    return true;
+}
+
+#ifdef CPU_X86
+
+// Registers from cpuid instruction, { eax, ebx, ecx, edx }
+static std::array<unsigned, 4> Cpuid(unsigned leaf, unsigned subleaf = 0)
+{
+    std::array<unsigned, 4> r = {};
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuidex(regs, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; i++) r[i] = (unsigned)regs[i];
+#else
+    __cpuid_count(leaf, subleaf, r[0], r[1], r[2], r[3]);
+#endif
+    return r;
+}
+
+// Register state the OS saves on context switch (XCR0)
+static unsigned long long Xgetbv()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+CpuFeatureLevel DetectCpuFeatureLevel()
+{
+    unsigned maxLeaf = Cpuid(0)[0];
+    if (maxLeaf < 1) return CpuFeatureLevel::Scalar;
+
+    auto leaf1 = Cpuid(1);
+    bool sse42 = leaf1[2] & (1u << 20);
+    bool fma = leaf1[2] & (1u << 12);
+    bool osxsave = leaf1[2] & (1u << 27);
+    bool avx = leaf1[2] & (1u << 28);
+
+    if (!sse42) return CpuFeatureLevel::Scalar;
+
+    // AVX registers must be enabled by the OS, not only by the CPU
+    if (!avx || !osxsave || maxLeaf < 7) return CpuFeatureLevel::SSE42;
+    unsigned long long xcr0 = Xgetbv();
+    bool ymmState = (xcr0 & 0x6) == 0x6;
+    bool zmmState = (xcr0 & 0xE6) == 0xE6;
+    if (!ymmState) return CpuFeatureLevel::SSE42;
+
+    auto leaf7 = Cpuid(7);
+    bool avx2 = leaf7[1] & (1u << 5);
+    bool avx512f = leaf7[1] & (1u << 16);
+    bool avx512dq = leaf7[1] & (1u << 17);
+    bool avx512vl = leaf7[1] & (1u << 31);
+
+    if (!avx2 || !fma) return CpuFeatureLevel::SSE42;
+    if (!avx512f || !avx512dq || !avx512vl || !zmmState) return CpuFeatureLevel::AVX2;
+    return CpuFeatureLevel::AVX512;
+}
+
+std::string GetCpuModelName()
+{
+    if (Cpuid(0x80000000)[0] < 0x80000004) return "Unknown CPU";
+
+    char brand[49] = {};
+    for (unsigned i = 0; i < 3; i++)
+    {
+        auto r = Cpuid(0x80000002 + i);
+        std::memcpy(brand + i * 16, r.data(), 16);
+    }
+
+    // Trim the padding some vendors put around the brand string
+    std::string name = brand;
+    name.erase(0, name.find_first_not_of(' '));
+    name.erase(name.find_last_not_of(' ') + 1);
+    return name.empty() ? "Unknown CPU" : name;
+}
+
+#else
+
+CpuFeatureLevel DetectCpuFeatureLevel()
+{
+    return CpuFeatureLevel::Scalar;
+}
+
+std::string GetCpuModelName()
+{
+    return "Unknown CPU";
+}
+
+#endif
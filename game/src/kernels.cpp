@@ -0,0 +1,154 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Kernel dispatch source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "raylib.h"
+
+const Kernels* activeKernels = GetKernelsScalar();
+CpuFeatureLevel detectedCpuFeatureLevel = CpuFeatureLevel::Scalar;
+
+const Kernels* GetCompiledKernels(CpuFeatureLevel level, bool strict)
+{
+    switch (level)
+    {
+    case CpuFeatureLevel::Scalar: return strict ? GetStrictKernelsScalar() : GetKernelsScalar();
+    case CpuFeatureLevel::SSE42: return strict ? GetStrictKernelsSSE42() : GetKernelsSSE42();
+    case CpuFeatureLevel::AVX2: return strict ? GetStrictKernelsAVX2() : GetKernelsAVX2();
+    case CpuFeatureLevel::AVX512: return strict ? GetStrictKernelsAVX512() : GetKernelsAVX512();
+    default: return nullptr;
+    }
+}
+
+const Kernels& SelectKernels(std::string_view requested, bool strict)
+{
+    detectedCpuFeatureLevel = DetectCpuFeatureLevel();
+
+    CpuFeatureLevel level = detectedCpuFeatureLevel;
+    if (!requested.empty() && requested != "auto")
+    {
+        CpuFeatureLevel forced;
+        if (!ParseCpuFeatureLevel(requested, forced))
+        {
+            TraceLog(LOG_WARNING, TextFormat("Unknown kernel level \"%s\", using auto detection", std::string(requested).c_str()));
+        }
+
+        // Forcing a level the CPU lacks would crash with illegal instruction
+        else if (forced > detectedCpuFeatureLevel)
+        {
+            TraceLog(LOG_WARNING, TextFormat("Kernel level %s is not supported by this CPU, using %s",
+                CpuFeatureLevelName(forced), CpuFeatureLevelName(detectedCpuFeatureLevel)));
+        }
+        else
+        {
+            level = forced;
+        }
+    }
+
+    // Fall back to the next lower level compiled into this binary
+    const Kernels* selected = nullptr;
+    for (int i = (int)level; i >= 0 && !selected; i--)
+    {
+        selected = GetCompiledKernels((CpuFeatureLevel)i, strict);
+    }
+
+    activeKernels = selected;
+    TraceLog(LOG_INFO, TextFormat("KERNELS: Using %s%s kernels (CPU supports %s)",
+        activeKernels->strict ? "strict " : "", CpuFeatureLevelName(activeKernels->level), CpuFeatureLevelName(detectedCpuFeatureLevel)));
+    return *activeKernels;
+}
+
+double CheckChainKernels(const Kernels& kernels, std::size_t links)
+{
+    constexpr std::size_t w = kernelBlockSize;
+    const std::size_t row = links * w;
+
+    // Fixed seed, so every level is checked on the same states
+    std::mt19937_64 random(links);
+    auto uniform = [&](double low, double high) {
+        return std::uniform_real_distribution<double>(low, high)(random);
+    };
+
+    std::vector<double> state(row * 4);
+    std::vector<double> parameters(row * 4 + w);
+    std::vector<double> workspace(GetWorkspaceSize(links));
+    std::vector<double> generated(row);
+    BlockDistances distances = {};
+
+    KernelBlock block = {};
+    block.links = links;
+    block.members = w;
+    block.angle = state.data();
+    block.angularVelocity = block.angle + row;
+    block.angularAcceleration = block.angularVelocity + row;
+    block.length = parameters.data();
+    block.inverseLength = block.length + row;
+    block.mass = block.inverseLength + row;
+    block.massSum = block.mass + row;
+    block.gravity = block.massSum + row;
+    block.distances = &distances;
+    block.workspace = workspace.data();
+
+    double largest = 0.0;
+    double difference = 0.0;
+    for (std::size_t trial = 0; trial < 16; trial++)
+    {
+        for (std::size_t i = 0; i < row; i++)
+        {
+            block.angle[i] = uniform(-PI, PI);
+            block.angularVelocity[i] = uniform(-2.0, 2.0);
+            parameters[i] = uniform(0.5, 2.0);
+            parameters[row + i] = 1.0 / parameters[i];
+            parameters[row * 2 + i] = uniform(0.5, 2.0);
+        }
+        for (std::size_t m = 0; m < w; m++)
+        {
+            parameters[row * 4 + m] = uniform(0.5, 2.0);
+        }
+
+        kernels.chainAcceleration(block, false);
+        std::copy(block.angularAcceleration, block.angularAcceleration + row, generated.begin());
+        kernels.chainAcceleration(block, true);
+
+        for (std::size_t i = 0; i < row; i++)
+        {
+            largest = std::max(largest, std::abs(block.angularAcceleration[i]));
+            difference = std::max(difference, std::abs(generated[i] - block.angularAcceleration[i]));
+        }
+    }
+
+    return largest > 0.0 ? difference / largest : difference;
+}
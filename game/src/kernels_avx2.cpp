@@ -0,0 +1,54 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   AVX2 kernels source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+// Compiled with its own instruction set flags from premake5.lua, and once more
+// without floating point contraction as kernels_avx2_strict.cpp
+
+#include "kernels.hpp"
+
+#if defined(__AVX2__)
+
+#include "kernels_impl.hpp"
+
+static const Kernels kernels = { CpuFeatureLevel::AVX2, 4, KERNELS_IS_STRICT, StepBlock, StepBlockImplicit, StepBlockChain, ChainAcceleration, UnrollTrajectory, ProbeFlops<4> };
+
+const Kernels* KERNELS_GETTER(AVX2)()
+{
+    return &kernels;
+}
+
+#else
+
+const Kernels* KERNELS_GETTER(AVX2)()
+{
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,885 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Kernel implementation, compiled once per instruction set level.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+// Included only by the kernels_*.cpp sources, each compiled with its own
+// instruction set flags. Everything here must stay in the anonymous namespace
+// and must not use library code, otherwise the linker may pick a function
+// compiled for a newer instruction set than the running CPU supports. The
+// one exception is std::sqrt, a single instruction built with -fno-math-errno.
+
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include "kernels.hpp"
+
+// Inline every call in a function regardless of size, so unrolled kernel
+// bodies end up in one loop that vectorizes
+#ifdef __GNUC__
+#define KERNELS_FLATTEN __attribute__((flatten))
+#else
+#define KERNELS_FLATTEN
+#endif
+
+namespace
+{
+	// Round to nearest integer, valid for |x| < 2^51
+	// Relies on strict floating point, do not build kernels with -ffast-math
+	inline double RoundNearest(double x)
+	{
+		constexpr double magic = 6755399441055744.0; // 1.5 * 2^52
+		return (x + magic) - magic;
+	}
+
+	// Branch free sin and cos, so the loops calling it vectorize
+	// Reduction by pi/2 in three parts and fdlibm polynomials on [-pi/4, pi/4]
+	inline void SinCos(double x, double& s, double& c)
+	{
+		constexpr double twoOverPi = 6.36619772367581382433e-01;
+		constexpr double pio2_1 = 1.57079632673412561417e+00;
+		constexpr double pio2_2 = 6.07710050630396597660e-11;
+		constexpr double pio2_3 = 2.02226624871116645580e-21;
+
+		double q = RoundNearest(x * twoOverPi);
+		double r = ((x - q * pio2_1) - q * pio2_2) - q * pio2_3;
+
+		// Quadrant, q mod 4
+		double k = q - 4.0 * RoundNearest(q * 0.25 - 0.375);
+
+		double z = r * r;
+		double ps = r + r * z * (-1.66666666666666324348e-01 + z * (8.33333333332248946124e-03
+			+ z * (-1.98412698298579493134e-04 + z * (2.75573137070700676789e-06
+			+ z * (-2.50507602534068634195e-08 + z * 1.58969099521155010221e-10)))));
+		double pc = 1.0 - 0.5 * z + z * z * (4.16666666666666019037e-02 + z * (-1.38888888888741095749e-03
+			+ z * (2.48015872894767294178e-05 + z * (-2.75573143513906633035e-07
+			+ z * (2.08757232129817482790e-09 + z * -1.13596475577881948265e-11)))));
+
+		bool odd = k == 1.0 || k == 3.0;
+		double ss = odd ? pc : ps;
+		double cc = odd ? ps : pc;
+		s = k >= 2.0 ? -ss : ss;
+		c = k == 1.0 || k == 2.0 ? -cc : cc;
+	}
+
+	// Angular acceleration of a pair, by the pairwise double pendulum formula
+	// Cached reciprocals and mass sums leave a single division per pair
+	inline void AccelerationRow(
+		const double* __restrict a1, const double* __restrict a2,
+		const double* __restrict w1, const double* __restrict w2,
+		const double* __restrict l1, const double* __restrict l2,
+		const double* __restrict il1, const double* __restrict il2,
+		const double* __restrict m1, const double* __restrict m2,
+		const double* __restrict mass12, const double* __restrict g,
+		double* __restrict acc1, double* __restrict acc2)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double s1, c1, s2, c2;
+			SinCos(a1[m], s1, c1);
+			SinCos(a2[m], s2, c2);
+
+			// Angle differences from the sums, saves two sin/cos per pair
+			double sd = s1 * c2 - c1 * s2; // sin(a1 - a2)
+			double cd = c1 * c2 + s1 * s2; // cos(a1 - a2)
+			double s12 = sd * c2 - cd * s2; // sin(a1 - 2 * a2)
+			double c2d = cd * cd - sd * sd; // cos(2 * a1 - 2 * a2)
+
+			double ms = mass12[m];
+			double v1 = w1[m] * w1[m] * l1[m];
+			double v2 = w2[m] * w2[m] * l2[m];
+			double invD = 1.0 / (m1[m] + ms - m2[m] * c2d);
+
+			double n1 = -g[m] * (m1[m] + ms) * s1;
+			double n2 = -m2[m] * g[m] * s12;
+			double n3 = -2.0 * sd * m2[m];
+			double n4 = v2 + v1 * cd;
+			acc1[m] = (n1 + n2 + n3 * n4) * il1[m] * invD;
+
+			acc2[m] = (2.0 * sd * (v1 * ms + g[m] * ms * c1 + v2 * m2[m] * cd)) * il2[m] * invD;
+		}
+	}
+
+	// Integrate a row and place it at the end of the previous row (or center)
+	inline void IntegrateRow(
+		double* __restrict a, double* __restrict av, const double* __restrict acc,
+		const double* __restrict l, const double* __restrict px, const double* __restrict py,
+		double* __restrict x, double* __restrict y,
+		double dt)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			av[m] += acc[m] * dt;
+			a[m] += av[m] * dt;
+
+			double s, c;
+			SinCos(a[m], s, c);
+			x[m] = px[m] + l[m] * s;
+			y[m] = py[m] + l[m] * c;
+		}
+	}
+
+	// Place a row at the end of the previous row (or center)
+	inline void PlaceRow(
+		const double* __restrict a, const double* __restrict l,
+		const double* __restrict px, const double* __restrict py,
+		double* __restrict x, double* __restrict y)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double s, c;
+			SinCos(a[m], s, c);
+			x[m] = px[m] + l[m] * s;
+			y[m] = py[m] + l[m] * c;
+		}
+	}
+
+	// Lone pendulum, velocity is this step's acceleration times the step
+	// rather than accumulated, as the original scalar update had it
+	inline void SingleRow(
+		double* __restrict a, double* __restrict av, double* __restrict acc,
+		const double* __restrict l, const double* __restrict il, const double* __restrict g,
+		double* __restrict x, double* __restrict y,
+		double dt)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double s, c;
+			SinCos(a[m], s, c);
+			acc[m] = -g[m] * il[m] * s;
+			av[m] = acc[m] * dt;
+			a[m] += av[m] * dt;
+
+			SinCos(a[m], s, c);
+			x[m] = l[m] * s;
+			y[m] = l[m] * c;
+		}
+	}
+
+	// Distances between end points of consecutive members and their moments
+	// Sums run in member order on every level, for strict kernels to agree
+	inline void DistanceRow(
+		const double* __restrict x, const double* __restrict y,
+		double* __restrict d, std::size_t members, BlockDistances& out)
+	{
+		for (std::size_t m = 0; m + 1 < kernelBlockSize; m++)
+		{
+			double dx = x[m + 1] - x[m];
+			double dy = y[m + 1] - y[m];
+			d[m] = std::sqrt(dx * dx + dy * dy);
+		}
+		d[kernelBlockSize - 1] = 0.0;
+
+		const std::size_t pairs = members > 1 ? members - 1 : 0;
+		double sum = 0.0;
+		double max = 0.0;
+		for (std::size_t m = 0; m < pairs; m++)
+		{
+			sum += d[m];
+			max = d[m] > max ? d[m] : max;
+		}
+
+		double mean = pairs > 0 ? sum / pairs : 0.0;
+		double m2 = 0.0;
+		for (std::size_t m = 0; m < pairs; m++)
+		{
+			m2 += (d[m] - mean) * (d[m] - mean);
+		}
+
+		out = { sum, m2, max };
+	}
+
+	void StepBlock(const KernelBlock& b)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		const std::size_t n = b.links;
+
+		if (n == 1)
+		{
+			SingleRow(b.angle, b.angularVelocity, b.angularAcceleration, b.length, b.inverseLength, b.gravity, b.positionX, b.positionY, b.deltaTime);
+			DistanceRow(b.positionX, b.positionY, b.distance, b.members, *b.distances);
+			return;
+		}
+
+		// Update angular acceleration
+		for (std::size_t k = 0; k + 1 < n; k++)
+		{
+			const std::size_t i = k * w;
+			const std::size_t j = (k + 1) * w;
+			AccelerationRow(
+				b.angle + i, b.angle + j,
+				b.angularVelocity + i, b.angularVelocity + j,
+				b.length + i, b.length + j,
+				b.inverseLength + i, b.inverseLength + j,
+				b.mass + i, b.mass + j,
+				b.massSum + i, b.gravity,
+				b.angularAcceleration + i, b.angularAcceleration + j
+			);
+		}
+
+		// Update angle and position, first pendulum anchored at center
+		static constexpr double center[kernelBlockSize] = {};
+		for (std::size_t k = 0; k < n; k++)
+		{
+			const std::size_t i = k * w;
+			IntegrateRow(
+				b.angle + i, b.angularVelocity + i, b.angularAcceleration + i,
+				b.length + i,
+				k == 0 ? center : b.positionX + i - w,
+				k == 0 ? center : b.positionY + i - w,
+				b.positionX + i, b.positionY + i,
+				b.deltaTime
+			);
+		}
+
+		// End points of the last links, still in cache
+		const std::size_t last = (n - 1) * w;
+		DistanceRow(b.positionX + last, b.positionY + last, b.distance, b.members, *b.distances);
+	}
+
+	// Newton iterations per implicit step at most, largest angle change of
+	// the last one to count as converged, relative to the largest angle
+	// change over the half step plus a floor for chains at rest, and times a
+	// step may be halved
+	constexpr int implicitIterations = 6;
+	constexpr double implicitTolerance = 1e-6;
+	constexpr double implicitMinTolerance = 1e-12;
+	constexpr int implicitMaxSplits = 6;
+
+	// ImplicitRows, rows of KernelBlock::workspace used by implicit stepping
+	struct ImplicitRows {
+		double* jacobian;     // links * links rows
+		double* massBelow;    // Mass of each link and all below it
+		double* sine;         // Of midpoint angles
+		double* cosine;
+		double* theta;        // Midpoint angles
+		double* velocity;     // Midpoint angular velocity
+		double* acceleration; // Midpoint angular acceleration
+		double* residual;     // Newton step once solved
+		double* inverse;      // Inverse pivots
+		double* factor;       // Single row
+
+		ImplicitRows(double* workspace, std::size_t n)
+		{
+			const std::size_t row = n * kernelBlockSize;
+			jacobian = workspace;
+			massBelow = jacobian + n * row;
+			sine = massBelow + row;
+			cosine = sine + row;
+			theta = cosine + row;
+			velocity = theta + row;
+			acceleration = velocity + row;
+			residual = acceleration + row;
+			inverse = residual + row;
+			factor = inverse + row;
+		}
+	};
+
+	// Midpoint state of a link from its midpoint angle, with its own terms
+	// of the residual and the Jacobian diagonal (see ImplicitResidual)
+	inline void MidpointRow(
+		const double* __restrict theta, const double* __restrict a, const double* __restrict av,
+		const double* __restrict S, const double* __restrict l, const double* __restrict g,
+		double* __restrict sn, double* __restrict cs, double* __restrict wm, double* __restrict q,
+		double* __restrict residual, double* __restrict jii,
+		double k2)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double sine, cosine;
+			SinCos(theta[m], sine, cosine);
+			sn[m] = sine;
+			cs[m] = cosine;
+			wm[m] = k2 * (theta[m] - a[m]);
+			q[m] = k2 * (wm[m] - av[m]);
+
+			double mii = S[m] * l[m] * l[m];
+			double gravity = g[m] * S[m] * l[m];
+			residual[m] = mii * q[m] + gravity * sine;
+			jii[m] = k2 * k2 * mii + gravity * cosine;
+		}
+	}
+
+	// Coupling of link i to link j != i, S the mass below the lower of them
+	inline void CouplingRow(
+		const double* __restrict S, const double* __restrict li, const double* __restrict lj,
+		const double* __restrict sni, const double* __restrict csi,
+		const double* __restrict snj, const double* __restrict csj,
+		const double* __restrict wmj, const double* __restrict qj,
+		double* __restrict residual, double* __restrict jij, double* __restrict jii,
+		double k2)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double coefficient = S[m] * li[m] * lj[m];
+			double mij = coefficient * (csi[m] * csj[m] + sni[m] * snj[m]);
+			double cij = coefficient * (sni[m] * csj[m] - csi[m] * snj[m]);
+			double w2 = wmj[m] * wmj[m];
+			residual[m] += mij * qj[m] + cij * w2;
+
+			// Through q[j] and w[j], and through a[j] and a[i] in M and C
+			double cross = cij * qj[m] - mij * w2;
+			jij[m] = k2 * k2 * mij + 2.0 * k2 * cij * wmj[m] + cross;
+			jii[m] -= cross;
+		}
+	}
+
+	// Residual and Jacobian of the implicit midpoint rule at midpoint angles
+	// For a chain of point masses, with S the mass of a link and all below it,
+	// M(a) a'' + C(a) w^2 + G(a) = 0 where
+	//   M[i][j] = S[max(i, j)] l[i] l[j] cos(a[i] - a[j])
+	//   C[i][j] = S[max(i, j)] l[i] l[j] sin(a[i] - a[j])
+	//   G[i] = g S[i] l[i] sin(a[i])
+	// evaluated with midpoint velocity w and acceleration q from the angles
+	inline void ImplicitResidual(const KernelBlock& b, const ImplicitRows& r, double k2)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		const std::size_t n = b.links;
+
+		for (std::size_t i = 0; i < n; i++)
+		{
+			const std::size_t ri = i * w;
+			MidpointRow(
+				r.theta + ri, b.angle + ri, b.angularVelocity + ri,
+				r.massBelow + ri, b.length + ri, b.gravity,
+				r.sine + ri, r.cosine + ri, r.velocity + ri, r.acceleration + ri,
+				r.residual + ri, r.jacobian + (i * n + i) * w,
+				k2
+			);
+		}
+
+		for (std::size_t i = 0; i < n; i++)
+		{
+			const std::size_t ri = i * w;
+			for (std::size_t j = 0; j < n; j++)
+			{
+				if (j == i)
+				{
+					continue;
+				}
+				const std::size_t rj = j * w;
+				CouplingRow(
+					r.massBelow + (i > j ? ri : rj), b.length + ri, b.length + rj,
+					r.sine + ri, r.cosine + ri, r.sine + rj, r.cosine + rj,
+					r.velocity + rj, r.acceleration + rj,
+					r.residual + ri, r.jacobian + (i * n + j) * w, r.jacobian + (i * n + i) * w,
+					k2
+				);
+			}
+		}
+	}
+
+	// y -= f * x over a row
+	inline void SubtractRow(double* __restrict y, const double* __restrict f, const double* __restrict x)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			y[m] -= f[m] * x[m];
+		}
+	}
+
+	// Solve the system in jacobian in place of residual, by Gaussian
+	// elimination without pivoting (the mass matrix term dominates the
+	// diagonal at the step sizes used)
+	inline void Solve(double* __restrict jacobian, double* __restrict residual, double* __restrict inverse, double* __restrict factor, std::size_t n)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		for (std::size_t k = 0; k < n; k++)
+		{
+			const double* __restrict jkk = jacobian + (k * n + k) * w;
+			double* __restrict ik = inverse + k * w;
+			for (std::size_t m = 0; m < w; m++)
+			{
+				ik[m] = 1.0 / jkk[m];
+			}
+
+			for (std::size_t i = k + 1; i < n; i++)
+			{
+				const double* __restrict jik = jacobian + (i * n + k) * w;
+				for (std::size_t m = 0; m < w; m++)
+				{
+					factor[m] = jik[m] * ik[m];
+				}
+				for (std::size_t j = k + 1; j < n; j++)
+				{
+					SubtractRow(jacobian + (i * n + j) * w, factor, jacobian + (k * n + j) * w);
+				}
+				SubtractRow(residual + i * w, factor, residual + k * w);
+			}
+		}
+
+		for (std::size_t k = n; k-- > 0;)
+		{
+			for (std::size_t j = k + 1; j < n; j++)
+			{
+				SubtractRow(residual + k * w, jacobian + (k * n + j) * w, residual + j * w);
+			}
+			double* __restrict rk = residual + k * w;
+			const double* __restrict ik = inverse + k * w;
+			for (std::size_t m = 0; m < w; m++)
+			{
+				rk[m] *= ik[m];
+			}
+		}
+	}
+
+	// Apply a Newton step to a row of angles, keeping the largest change of
+	// each member (per member, so the loop vectorizes)
+	inline void NewtonRow(double* __restrict theta, const double* __restrict step, double* __restrict largest)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			theta[m] -= step[m];
+			double change = step[m] < 0.0 ? -step[m] : step[m];
+			largest[m] = change > largest[m] ? change : largest[m];
+		}
+	}
+
+	// End of step state of a row from its midpoint angle
+	inline void ExtrapolateRow(
+		double* __restrict a, double* __restrict av, double* __restrict acc,
+		const double* __restrict theta,
+		double h)
+	{
+		const double k2 = 2.0 / h;
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double velocity = 2.0 * k2 * (theta[m] - a[m]) - av[m];
+			acc[m] = (velocity - av[m]) / h;
+			av[m] = velocity;
+			a[m] = 2.0 * theta[m] - a[m];
+		}
+	}
+
+	// Implicit midpoint rule over step h, solving for the midpoint angles
+	// with Newton iterations batched over the block's members, then
+	// extrapolating to the end of the step
+	// If any member does not converge (a whipping chain end), the step is
+	// split in halves instead, up to implicitMaxSplits times, and the last
+	// split is taken as is
+	void ImplicitStep(const KernelBlock& b, const ImplicitRows& r, double h, int splits)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		const std::size_t n = b.links;
+
+		// Guess from the last acceleration, then refine
+		double scale = 0.0;
+		for (std::size_t k = 0; k < n; k++)
+		{
+			const std::size_t i = k * w;
+			for (std::size_t m = 0; m < w; m++)
+			{
+				double half = 0.5 * h * (b.angularVelocity[i + m] + 0.25 * h * b.angularAcceleration[i + m]);
+				r.theta[i + m] = b.angle[i + m] + half;
+				half = half < 0.0 ? -half : half;
+				scale = half > scale ? half : scale;
+			}
+		}
+		const double tolerance = implicitTolerance * scale + implicitMinTolerance;
+
+		// Stop early once steps no longer shrink, that start is too far off
+		bool converged = false;
+		bool diverged = false;
+		double previous = 0.0;
+		for (int iteration = 0; iteration < implicitIterations && !converged && !diverged; iteration++)
+		{
+			ImplicitResidual(b, r, 2.0 / h);
+			Solve(r.jacobian, r.residual, r.inverse, r.factor, n);
+
+			double* largest = r.factor;
+			for (std::size_t m = 0; m < w; m++)
+			{
+				largest[m] = 0.0;
+			}
+			for (std::size_t k = 0; k < n; k++)
+			{
+				NewtonRow(r.theta + k * w, r.residual + k * w, largest);
+			}
+
+			double change = 0.0;
+			for (std::size_t m = 0; m < w; m++)
+			{
+				change = largest[m] > change ? largest[m] : change;
+			}
+			converged = change <= tolerance;
+			diverged = iteration > 0 && change >= previous;
+			previous = change;
+		}
+
+		if (!converged && splits < implicitMaxSplits)
+		{
+			if (b.implicitSplits)
+			{
+				++*b.implicitSplits;
+			}
+			ImplicitStep(b, r, h * 0.5, splits + 1);
+			ImplicitStep(b, r, h * 0.5, splits + 1);
+			return;
+		}
+
+		for (std::size_t k = 0; k < n; k++)
+		{
+			const std::size_t i = k * w;
+			ExtrapolateRow(b.angle + i, b.angularVelocity + i, b.angularAcceleration + i, r.theta + i, h);
+		}
+	}
+
+	// Mass of each link and all below it
+	inline void MassBelow(const KernelBlock& b, const ImplicitRows& r)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		const std::size_t n = b.links;
+		for (std::size_t k = n; k-- > 0;)
+		{
+			const std::size_t i = k * w;
+			for (std::size_t m = 0; m < w; m++)
+			{
+				r.massBelow[i + m] = b.mass[i + m] + (k + 1 < n ? r.massBelow[i + w + m] : 0.0);
+			}
+		}
+	}
+
+	// Implicit counterpart of StepBlock, integrating the full chain rather
+	// than pairwise double pendulum formulas
+	void StepBlockImplicit(const KernelBlock& b)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		const std::size_t n = b.links;
+		const ImplicitRows r(b.workspace, n);
+
+		MassBelow(b, r);
+		ImplicitStep(b, r, b.deltaTime, 0);
+
+		// Place links, first pendulum anchored at center
+		static constexpr double center[kernelBlockSize] = {};
+		for (std::size_t k = 0; k < n; k++)
+		{
+			const std::size_t i = k * w;
+			PlaceRow(
+				b.angle + i, b.length + i,
+				k == 0 ? center : b.positionX + i - w,
+				k == 0 ? center : b.positionY + i - w,
+				b.positionX + i, b.positionY + i
+			);
+		}
+
+		const std::size_t last = (n - 1) * w;
+		DistanceRow(b.positionX + last, b.positionY + last, b.distance, b.members, *b.distances);
+	}
+
+	// Call f(std::integral_constant<std::size_t, I>()) for I in [0, N), so
+	// loops over links become straight-line code with constant indices
+	template<typename F, std::size_t... I>
+	inline void UnrollSequence(F& f, std::index_sequence<I...>)
+	{
+		(f(std::integral_constant<std::size_t, I>()), ...);
+	}
+
+	template<std::size_t N, typename F>
+	inline void Unroll(F&& f)
+	{
+		UnrollSequence(f, std::make_index_sequence<N>());
+	}
+
+	// Explicit chain dynamics of N links, M(a) a'' = -C(a) w^2 - G(a) with
+	// the terms of ImplicitResidual, generated at compile time
+	// Every index is a constant, so the mass matrix, forcing terms and their
+	// LDL^T solve are straight-line code per member kept in registers, and
+	// the sin and cos of each angle difference is shared between M and C
+	template<std::size_t N>
+	KERNELS_FLATTEN inline void ChainAccelerationRow(
+		const double* __restrict a, const double* __restrict av,
+		const double* __restrict l, const double* __restrict mass, const double* __restrict g,
+		double* __restrict acc)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		for (std::size_t m = 0; m < w; m++)
+		{
+			double sn[N], cs[N], w2[N], len[N], S[N];
+			double f[N];    // Forcing terms, then the solution
+			double L[N][N]; // M below the diagonal, then its unit lower factor
+			double D[N];    // M diagonal, then its pivots
+			double invD[N];
+
+			Unroll<N>([&](auto i) {
+				double s, c;
+				SinCos(a[i * w + m], s, c);
+				sn[i] = s;
+				cs[i] = c;
+				w2[i] = av[i * w + m] * av[i * w + m];
+				len[i] = l[i * w + m];
+			});
+
+			// Mass of each link and all below it
+			Unroll<N>([&](auto k) {
+				constexpr std::size_t i = N - 1 - decltype(k)::value;
+				if constexpr (i + 1 < N)
+				{
+					S[i] = mass[i * w + m] + S[i + 1];
+				}
+				else
+				{
+					S[i] = mass[i * w + m];
+				}
+			});
+
+			Unroll<N>([&](auto i) {
+				D[i] = S[i] * len[i] * len[i];
+				f[i] = -g[m] * S[i] * len[i] * sn[i];
+			});
+
+			// Lower triangle, S[max(i, j)] = S[i] for j < i
+			Unroll<N>([&](auto i) {
+				Unroll<decltype(i)::value>([&](auto j) {
+					double coefficient = S[i] * len[i] * len[j];
+					double cd = cs[i] * cs[j] + sn[i] * sn[j]; // cos(a[i] - a[j])
+					double sd = sn[i] * cs[j] - cs[i] * sn[j]; // sin(a[i] - a[j])
+					double c = coefficient * sd;
+					L[i][j] = coefficient * cd;
+					f[i] -= c * w2[j];
+					f[j] += c * w2[i];
+				});
+			});
+
+			// M = L D L^T, column by column
+			Unroll<N>([&](auto k) {
+				constexpr std::size_t K = decltype(k)::value;
+				Unroll<K>([&](auto p) {
+					D[k] -= L[k][p] * L[k][p] * D[p];
+				});
+				invD[k] = 1.0 / D[k];
+				Unroll<N - K - 1>([&](auto o) {
+					constexpr std::size_t i = K + 1 + decltype(o)::value;
+					Unroll<K>([&](auto p) {
+						L[i][k] -= L[i][p] * L[k][p] * D[p];
+					});
+					L[i][k] *= invD[k];
+				});
+			});
+
+			Unroll<N>([&](auto i) {
+				Unroll<decltype(i)::value>([&](auto p) {
+					f[i] -= L[i][p] * f[p];
+				});
+			});
+			Unroll<N>([&](auto k) {
+				constexpr std::size_t i = N - 1 - decltype(k)::value;
+				f[i] *= invD[i];
+				Unroll<N - i - 1>([&](auto o) {
+					constexpr std::size_t p = i + 1 + decltype(o)::value;
+					f[i] -= L[p][i] * f[p];
+				});
+			});
+
+			Unroll<N>([&](auto i) {
+				acc[i * w + m] = f[i];
+			});
+		}
+	}
+
+	// Own terms of link i in the chain dynamics, M[i][i] and -G[i]
+	inline void ChainOwnRow(
+		const double* __restrict a, const double* __restrict S,
+		const double* __restrict l, const double* __restrict g,
+		double* __restrict sn, double* __restrict cs,
+		double* __restrict f, double* __restrict mii)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double sine, cosine;
+			SinCos(a[m], sine, cosine);
+			sn[m] = sine;
+			cs[m] = cosine;
+			mii[m] = S[m] * l[m] * l[m];
+			f[m] = -g[m] * S[m] * l[m] * sine;
+		}
+	}
+
+	// Coupling of link i to link j != i, M[i][j] and -C[i][j] w[j]^2
+	inline void ChainCouplingRow(
+		const double* __restrict S, const double* __restrict li, const double* __restrict lj,
+		const double* __restrict sni, const double* __restrict csi,
+		const double* __restrict snj, const double* __restrict csj,
+		const double* __restrict avj,
+		double* __restrict f, double* __restrict mij)
+	{
+		for (std::size_t m = 0; m < kernelBlockSize; m++)
+		{
+			double coefficient = S[m] * li[m] * lj[m];
+			mij[m] = coefficient * (csi[m] * csj[m] + sni[m] * snj[m]);
+			f[m] -= coefficient * (sni[m] * csj[m] - csi[m] * snj[m]) * avj[m] * avj[m];
+		}
+	}
+
+	// Same dynamics as ChainAccelerationRow for any link count, building the
+	// full system in the workspace and solving it at runtime
+	inline void ChainAccelerationGeneric(const KernelBlock& b, const ImplicitRows& r)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		const std::size_t n = b.links;
+
+		for (std::size_t i = 0; i < n; i++)
+		{
+			const std::size_t ri = i * w;
+			ChainOwnRow(
+				b.angle + ri, r.massBelow + ri, b.length + ri, b.gravity,
+				r.sine + ri, r.cosine + ri,
+				r.residual + ri, r.jacobian + (i * n + i) * w
+			);
+		}
+
+		for (std::size_t i = 0; i < n; i++)
+		{
+			const std::size_t ri = i * w;
+			for (std::size_t j = 0; j < n; j++)
+			{
+				if (j == i)
+				{
+					continue;
+				}
+				const std::size_t rj = j * w;
+				ChainCouplingRow(
+					r.massBelow + (i > j ? ri : rj), b.length + ri, b.length + rj,
+					r.sine + ri, r.cosine + ri, r.sine + rj, r.cosine + rj,
+					b.angularVelocity + rj,
+					r.residual + ri, r.jacobian + (i * n + j) * w
+				);
+			}
+		}
+
+		Solve(r.jacobian, r.residual, r.inverse, r.factor, n);
+		for (std::size_t k = 0; k < n * w; k++)
+		{
+			b.angularAcceleration[k] = r.residual[k];
+		}
+	}
+
+	// Angular accelerations of the full chain dynamics, by the generated
+	// kernel of the link count if there is one and generic is not set
+	void ChainAcceleration(const KernelBlock& b, bool generic)
+	{
+		if (!generic)
+		{
+			bool generated = false;
+			Unroll<chainKernelMaxLinks - chainKernelMinLinks + 1>([&](auto k) {
+				constexpr std::size_t N = chainKernelMinLinks + decltype(k)::value;
+				if (!generated && b.links == N)
+				{
+					ChainAccelerationRow<N>(b.angle, b.angularVelocity, b.length, b.mass, b.gravity, b.angularAcceleration);
+					generated = true;
+				}
+			});
+			if (generated)
+			{
+				return;
+			}
+		}
+
+		const ImplicitRows r(b.workspace, b.links);
+		MassBelow(b, r);
+		ChainAccelerationGeneric(b, r);
+	}
+
+	// Explicit counterpart of StepBlockImplicit, integrating the full chain
+	// dynamics with the same semi-implicit Euler update as StepBlock
+	void StepBlockChain(const KernelBlock& b)
+	{
+		constexpr std::size_t w = kernelBlockSize;
+		const std::size_t n = b.links;
+
+		ChainAcceleration(b, false);
+
+		// Update angle and position, first pendulum anchored at center
+		static constexpr double center[kernelBlockSize] = {};
+		for (std::size_t k = 0; k < n; k++)
+		{
+			const std::size_t i = k * w;
+			IntegrateRow(
+				b.angle + i, b.angularVelocity + i, b.angularAcceleration + i,
+				b.length + i,
+				k == 0 ? center : b.positionX + i - w,
+				k == 0 ? center : b.positionY + i - w,
+				b.positionX + i, b.positionY + i,
+				b.deltaTime
+			);
+		}
+
+		const std::size_t last = (n - 1) * w;
+		DistanceRow(b.positionX + last, b.positionY + last, b.distance, b.members, *b.distances);
+	}
+
+	// Peak floating point throughput probe, eight independent chains of
+	// multiply-adds per vector lane, each kept in a register for eight of them
+	// so neither latency nor loads and stores limit it
+	// Counts 2 flops per multiply-add, 128 * Lanes * repeats in all, contracted
+	// to FMA unless built strict, returns the sum so the work is kept
+	template<std::size_t Lanes>
+	KERNELS_FLATTEN double ProbeFlops(std::size_t repeats)
+	{
+		constexpr std::size_t width = Lanes * 8;
+		double x[width];
+		for (std::size_t m = 0; m < width; m++)
+		{
+			x[m] = 1.0 + m * 1e-3;
+		}
+		for (std::size_t r = 0; r < repeats; r++)
+		{
+			for (std::size_t m = 0; m < width; m++)
+			{
+				double v = x[m];
+				Unroll<8>([&](auto) {
+					v = v * 0.999999 + 1e-6;
+				});
+				x[m] = v;
+			}
+		}
+		double sum = 0.0;
+		for (std::size_t m = 0; m < width; m++)
+		{
+			sum += x[m];
+		}
+		return sum;
+	}
+
+	void UnrollTrajectory(const double* __restrict ring, std::size_t size, std::size_t start, float* __restrict out)
+	{
+		const std::size_t head = (size - start) * 2;
+		const double* __restrict tail = ring + start * 2;
+		for (std::size_t i = 0; i < head; i++)
+		{
+			out[i] = (float)tail[i];
+		}
+		for (std::size_t i = 0; i < start * 2; i++)
+		{
+			out[head + i] = (float)ring[i];
+		}
+	}
+}
@@ -0,0 +1,239 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Ensemble layers source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "layers.hpp"
+#include "raylib.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ranges>
+#include <utility>
+
+std::vector<Layer> layers;
+
+bool FrameBudget::StartStep()
+{
+    if (seconds <= 0.0)
+    {
+        return true;
+    }
+
+    // Drawing is paid first, unspent time carries over for at most a frame
+    credit = std::min(credit + seconds - lastDraw, seconds);
+    if (credit > 0.0)
+    {
+        return true;
+    }
+    skipped++;
+    return false;
+}
+
+void FrameBudget::Stepped(double stepped)
+{
+    stepSeconds = stepSeconds > 0.0 ? stepSeconds + (stepped - stepSeconds) * budgetSmoothing : stepped;
+    if (seconds > 0.0)
+    {
+        credit -= stepped;
+    }
+}
+
+std::size_t FrameBudget::DrawStride(std::size_t count)
+{
+    stride = 1;
+    if (seconds > 0.0 && drawSeconds > 0.0)
+    {
+        double estimate = drawSeconds * count;
+        stride = std::max<std::size_t>((std::size_t)std::ceil(estimate / (seconds * budgetDrawShare)), 1);
+    }
+    return stride;
+}
+
+void FrameBudget::Drawn(double drawn, std::size_t count)
+{
+    lastDraw = seconds > 0.0 ? drawn : 0.0;
+    if (count > 0)
+    {
+        double each = drawn / count;
+        drawSeconds = drawSeconds > 0.0 ? drawSeconds + (each - drawSeconds) * budgetSmoothing : each;
+    }
+}
+
+// Settings of a layer, its file applied over the current settings
+// Layers do not have layers of their own
+static bool LoadLayerSettings(const std::string& filename, SimulationSettings& loaded)
+{
+    if (!FileExists(filename.c_str()))
+    {
+        TraceLog(LOG_ERROR, TextFormat("LAYERS: File %s does not exist", filename.c_str()));
+        return false;
+    }
+
+    loaded = settings;
+    loaded.LoadSettings(filename);
+    loaded.layers = "none";
+    return true;
+}
+
+// Reinitialize a layer's pendulums, with it as the current ensemble
+static void InitializeLayer(Layer& layer)
+{
+    SwapEnsemble(layer.ensemble);
+    InitializePendulums(layer.resets);
+    SwapEnsemble(layer.ensemble);
+    layer.divergence = {};
+}
+
+bool LoadLayers(std::string_view list, std::size_t reserved)
+{
+    std::vector<std::string> filenames;
+    if (list != "none")
+    {
+        for (auto part : list | std::views::split(','))
+        {
+            filenames.emplace_back(part.begin(), part.end());
+        }
+    }
+
+    bool loadedAll = true;
+    std::vector<Layer> loaded;
+    for (const auto& filename : filenames)
+    {
+        long modTime = GetFileModTime(filename.c_str());
+        SimulationSettings layerSettings;
+        if (!LoadLayerSettings(filename, layerSettings))
+        {
+            loadedAll = false;
+            continue;
+        }
+        MemoryFit fit = FitMemoryBudget(layerSettings, reserved);
+        if (fit.adjusted)
+        {
+            TraceLog(LOG_WARNING, TextFormat("LAYERS: %s: %s", filename.c_str(), fit.message.c_str()));
+        }
+        EnsembleMemory estimate = EstimateEnsembleMemory(layerSettings);
+        reserved += estimate.state + estimate.trails;
+
+        Layer layer;
+        bool needsReset = true;
+        auto existing = std::ranges::find(layers, filename, &Layer::filename);
+        if (existing != layers.end())
+        {
+            layer = std::move(*existing);
+            existing->filename.clear();
+            SimulationSettings previous = layer.ensemble.settings;
+            needsReset = previous.LoadSettingsText(layerSettings.FormatSettings());
+        }
+
+        layer.filename = filename;
+        layer.modTime = modTime;
+        layer.fit = fit;
+        layer.ensemble.settings = layerSettings;
+        layer.budget.seconds = layerSettings.frameBudget;
+        if (needsReset)
+        {
+            InitializeLayer(layer);
+        }
+        loaded.push_back(std::move(layer));
+    }
+
+    layers = std::move(loaded);
+    return loadedAll;
+}
+
+bool LayersChanged()
+{
+    return std::ranges::any_of(layers, [](const Layer& layer) {
+        return FileExists(layer.filename.c_str()) && GetFileModTime(layer.filename.c_str()) != layer.modTime;
+    });
+}
+
+void StepLayers(bool autoReset)
+{
+    const double now = GetTime();
+    for (auto& layer : layers)
+    {
+        const auto& layerSettings = layer.ensemble.settings;
+
+        // Fade out, then reset, like the main ensemble without segments
+        if (layer.fadeEnd > 0.0)
+        {
+            if (now >= layer.fadeEnd)
+            {
+                layer.resets++;
+                InitializeLayer(layer);
+                layer.fadeEnd = 0.0;
+                layer.alpha = 1.0f;
+            }
+            else
+            {
+                layer.alpha = (float)((layer.fadeEnd - now) / std::max(layerSettings.resetFadeTime, 1e-9));
+            }
+        }
+        else if (autoReset && layer.divergence.Statistic(layerSettings.resetQuantile) > layerSettings.resetThreshold)
+        {
+            layer.fadeEnd = now + layerSettings.resetFadeTime;
+        }
+
+        if (!layer.budget.StartStep())
+        {
+            continue;
+        }
+
+        SwapEnsemble(layer.ensemble);
+        double started = GetTime();
+        UpdatePendulums();
+        layer.budget.Stepped(GetTime() - started);
+        layer.divergence = GetDivergence();
+        SwapEnsemble(layer.ensemble);
+    }
+}
+
+void ResetLayers()
+{
+    for (auto& layer : layers)
+    {
+        if (layer.fadeEnd == 0.0)
+        {
+            layer.fadeEnd = GetTime() + layer.ensemble.settings.resetFadeTime;
+        }
+    }
+}
+
+void DrawLayers(bool debug)
+{
+    for (auto& layer : layers)
+    {
+        const std::size_t count = layer.ensemble.pendulums.size();
+        const std::size_t stride = layer.budget.DrawStride(count);
+        double started = GetTime();
+        DrawEnsembleTrajectories(layer.ensemble, layer.alpha, debug, stride);
+        layer.budget.Drawn(GetTime() - started, (count + stride - 1) / stride);
+    }
+}
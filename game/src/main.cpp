@@ -31,24 +31,146 @@
 #include "raylib.h"
 #include "raymath.h"
 
+#include "cluster.hpp"
 #include "game.hpp"
 #include "pendulum.hpp"
+#include "kernels.hpp"
+#include "layers.hpp"
+#include "memoryusage.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+#include "plugins.hpp"
+#include "profiler.hpp"
+#include "roofline.hpp"
+#include "service.hpp"
+#include "shards.hpp"
+#include "sharedstate.hpp"
+#include "stream.hpp"
+#include "sweep.hpp"
+#include "tuning.hpp"
+#include "watchdog.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
 
 #define SETTINGS_FILENAME "settings.txt"
 #define MUSIC_FILENAME "music.mp3"
+#define TUNING_FILENAME "tuning.txt"
+#define SWEEP_RESULTS_FILENAME "sweep_results.txt"
+#define SWEEP_CSV_FILENAME "sweep_results.csv"
+#define HITCH_LOG_FILENAME "hitches.log"
+
+// Seconds between music stream updates counted as an underrun, about as long
+// as raylib's default stream buffer lasts
+constexpr double audioUnderrunGap = 0.1;
+
+// Weight of the latest step in the step time averages, about a second at 60 FPS
+constexpr double stepTimeSmoothing = 0.05;
 
 static FreeCamera2D camera;         // Main camera
 static bool showInfo = true;        // Show usage information
 static bool showPendulums = false;  // Show pendulum itself (not just trajectories)
 static bool paused = true;          // Simulation paused
-static double divergence;           // Divergence (average distance for samples)
+static DivergenceStats divergence; // Divergence used for reset and shown
+static DivergenceStats latestDivergence; // Divergence from the last divergence stage
+static DivergenceStats shardDivergence;  // Divergence of the shard or node slices composited last
 static int resets = 0;              // Number of times it has been reset
-static double initiatedReset = 0.0; // Initiated reset at time
+static bool resetting = false;      // Reset fade in progress
+static float resetAlpha = 1.0f;     // Trajectory alpha while fading out to reset
+static std::vector<float> segmentAlpha;    // Trajectory alpha of each reset segment
+static std::vector<int> segmentResets;     // Number of times each segment has been reset
+static std::vector<bool> segmentResetting; // Segment fade in progress
+static std::uint64_t ensembleVersion = 0;  // Bumped when all pendulums are reinitialized
 static int settingsModTime;         // File modification time for settings file
-static double toastMessageTimer = 0.0; // Timer for a toast message
+static std::uint64_t toastSerial = 0; // Latest toast message, older ones do not clear it
 static std::string toastMessage;    // Toast message shown at bottom right
+static FramePipeline pipeline;      // Stages of a frame
 static Music music;                 // Background music
 static bool muted = false;          // Mute background music
+static std::string kernelOverride;  // Kernel level forced from command line
+static std::size_t benchmarkSteps = 0; // Steps to benchmark without window, 0 to run normally
+static std::size_t rooflineSteps = 0; // Steps of each integrator to place on the roofline, 0 to run normally
+static bool recalibrate = false;    // Ignore cached tuning once, from command line
+static bool checkChain = false;     // Check generated chain kernels and exit
+static std::size_t shardCount = 0;  // Shard processes simulating the ensemble, 0 to simulate here
+static std::size_t shardIndex = 0;  // Slice simulated as a shard process, of shardOf
+static std::size_t shardOf = 0;     // 0 if not a shard process
+static std::size_t shardReserved = 0; // Bytes the render process left out of memoryBudget
+static const char* executable = ""; // argv[0], to start shard processes
+static std::string clusterListen;   // Address to listen on for worker nodes, empty to simulate here
+static std::size_t clusterNodes = 1; // Worker nodes to wait for before starting
+static std::string clusterWorker;   // Render node address to simulate for as a worker node
+static std::string sweepFilename;   // Sweep to coordinate, empty to run normally
+static std::string sweepListen;     // Address to listen on for sweep workers of other machines
+static std::string sweepWorker;     // Coordinator address to run sweep jobs for
+static std::size_t sweepWorkers = 0; // Sweep worker processes on this machine, 0 for default
+static std::size_t sweepSteps = 2000; // Step limit of a sweep job
+static std::string serviceAddress;  // Address to serve simulation requests on, empty to run normally
+static std::string streamServer;    // Address to stream the simulation to viewers on, empty to run normally
+static std::string streamViewer;    // Stream server address to show instead of simulating here
+static StreamView streamView;       // Last frames taken from the stream server
+static std::string metricsAddress;  // Address to serve metrics on, empty for none
+static double musicUpdated = 0.0;   // Time of the last music stream update, 0 while paused
+static double metricsSecond = 0.0;  // Start of the second steps per second are counted over
+static std::uint64_t metricsSecondSteps = 0;
+static int profileFrequency = 0;    // Profiler samples per second of CPU time, 0 to not profile
+static int profilesWritten = 0;     // Numbers profile files
+static double builtinStepNanoseconds = 0.0; // Average step time per pendulum of the built in kernels
+static double pluginStepNanoseconds = 0.0;  // Same of the kernel plugin, 0 until it stepped
+static FrameBudget mainBudget;      // Frame budget of the main ensemble, layers have their own
+static MemoryFit memoryFit;         // What memoryBudget lowered in settings
+static std::size_t fixedMemory = 0; // Bytes memoryBudget leaves for drawing and music, estimated at startup so shards fit the same
+static MemoryUsage memoryUsage;     // Measured after each frame
+
+// Select kernels, command line takes priority over settings
+static void ApplyKernelLevel()
+{
+    SelectKernels(kernelOverride.empty() ? settings.kernelLevel : kernelOverride, settings.deterministic);
+}
+
+// Load layers from settings, only over an ensemble simulated here, in what
+// memoryBudget leaves after the main ensemble
+static bool ApplyLayers()
+{
+    if (ShardsRunning() || ClusterRunning() || StreamViewerRunning())
+    {
+        return LoadLayers("none");
+    }
+    EnsembleMemory ensemble = EstimateEnsembleMemory(settings);
+    return LoadLayers(settings.layers, fixedMemory + ensemble.state + ensemble.trails);
+}
+
+// Auto-tune if enabled, then apply kernel level and worker threads
+// Returns true if calibration ran (pendulums were reinitialized)
+static bool ApplyPerformanceSettings()
+{
+    bool calibrated = false;
+    if (settings.autoTune || recalibrate)
+    {
+        calibrated = !AutoTune(TUNING_FILENAME, recalibrate).cached;
+        recalibrate = false;
+    }
+
+    ApplyKernelLevel();
+    workers.Start(settings.workerThreads, settings.numaAware);
+    return calibrated;
+}
+
+// Forget segment fades and resets, after all pendulums were reinitialized or
+// segments changed
+static void ResetSegments()
+{
+    segmentAlpha.assign(GetSegmentCount(), 1.0f);
+    segmentResets.assign(GetSegmentCount(), 0);
+    segmentResetting.assign(GetSegmentCount(), false);
+    ensembleVersion++;
+}
 
 // Initialize everything
 static void GameInit()
@@ -64,23 +186,178 @@ static void GameInit()
         settings.SaveSettings(SETTINGS_FILENAME);
     }
 
+    // Music first, its buffers count against memoryBudget
+    music = LoadMusicStream(MUSIC_FILENAME);
     settings.LoadSettings(SETTINGS_FILENAME);
+    fixedMemory = EstimateFixedMemory(GetScreenWidth(), GetScreenHeight(), settings.trajectoryPoints, music);
+    memoryFit = FitMemoryBudget(settings, fixedMemory);
+    if (memoryFit.adjusted)
+    {
+        TraceLog(LOG_WARNING, TextFormat("MEMORY: %s", memoryFit.message.c_str()));
+    }
     settingsModTime = GetFileModTime(SETTINGS_FILENAME);
-    music = LoadMusicStream(MUSIC_FILENAME);
+    ApplyPerformanceSettings();
+    LoadKernelPlugin(settings.kernelPlugin);
     PlayMusicStream(music);
 
     InitializePendulums();
+    ResetSegments();
+
+    // Pendulums here only mirror the shards' slices for drawing
+    if (shardCount > 0)
+    {
+        StartShards(shardCount, executable, fixedMemory);
+    }
+    else if (!clusterListen.empty())
+    {
+        StartCluster(clusterListen, clusterNodes);
+    }
+
+    // Nothing to simulate, show the stream right away
+    else if (!streamViewer.empty())
+    {
+        StartStreamViewer(streamViewer);
+        paused = false;
+    }
+    ApplyLayers();
 }
 
 // Close everything
 static void GameCleanup()
 {
+    StopShards();
+    StopCluster();
+    StopStreamViewer();
+    StopWatchdog();
+    UnloadKernelPlugin();
+    StopMetrics();
+    StopProfiler();
+    CloseSharedState();
+    workers.Stop();
     UnloadMusicStream(music);
     CloseWindow();
 }
 
-// Update everything
-static bool GameUpdate()
+// Show message at bottom right for a few seconds
+static Task ToastSequence(std::string message)
+{
+    std::uint64_t serial = ++toastSerial;
+    toastMessage = std::move(message);
+
+    co_await pipeline.Delay(5.0, "draw");
+    if (serial == toastSerial)
+    {
+        toastMessage.clear();
+    }
+}
+
+// Shorthand for spawning ToastSequence, main thread only
+static void ShowToast(std::string message)
+{
+    pipeline.Spawn(ToastSequence(std::move(message)));
+}
+
+// Load the kernel plugin from settings if it changed or was rebuilt, the
+// ensemble keeps stepping from where it is
+static void ApplyKernelPlugin()
+{
+    if (settings.kernelPlugin == GetKernelPluginPath() && !KernelPluginChanged())
+    {
+        return;
+    }
+
+    if (!LoadKernelPlugin(settings.kernelPlugin))
+    {
+        ShowToast(TextFormat("Failed to load kernel plugin %s, see log", settings.kernelPlugin.c_str()));
+        return;
+    }
+    pluginStepNanoseconds = 0.0;
+    if (auto plugin = GetKernelPlugin())
+    {
+        ShowToast(TextFormat("Loaded kernel plugin %s", plugin->name ? plugin->name : settings.kernelPlugin.c_str()));
+    }
+}
+
+// Overlay lines of memory, of the main frame budget and of each layer
+static std::string FormatBudgetInfo()
+{
+    constexpr double mib = 1 << 20;
+    std::string text = TextFormat("Memory: %.1f MiB%s (ensemble %.1f, trails %.1f, layers %.1f, render %.1f, audio %.1f)\n",
+        memoryUsage.Total() / mib, settings.memoryBudget > 0 ? TextFormat(" of %zu MiB budget", settings.memoryBudget) : "",
+        memoryUsage.ensemble / mib, memoryUsage.trails / mib, memoryUsage.layers / mib, memoryUsage.render / mib, memoryUsage.audio / mib);
+    if (memoryFit.adjusted)
+    {
+        text += "  " + memoryFit.message + "\n";
+    }
+    if (mainBudget.seconds > 0.0)
+    {
+        text += TextFormat("Frame budget: %.2f ms, step %.2f ms, %llu steps skipped, drawing 1 in %zu\n",
+            mainBudget.seconds * 1000.0, mainBudget.stepSeconds * 1000.0, (unsigned long long)mainBudget.skipped, mainBudget.stride);
+    }
+    for (const auto& layer : layers)
+    {
+        text += TextFormat("Layer %s: %zu pendulums%s, %d resets, step %.2f ms (budget %.2f ms), %llu steps skipped, drawing 1 in %zu\n",
+            layer.filename.c_str(), layer.ensemble.pendulums.size(), layer.fit.adjusted ? " (lowered to fit memoryBudget)" : "", layer.resets,
+            layer.budget.stepSeconds * 1000.0, layer.budget.seconds * 1000.0, (unsigned long long)layer.budget.skipped, layer.budget.stride);
+    }
+    return text;
+}
+
+// Average the time a step took per pendulum, for whichever kernels stepped
+static void RecordStepTime(double seconds)
+{
+    double& average = activeKernelPlugin ? pluginStepNanoseconds : builtinStepNanoseconds;
+    double nanoseconds = seconds * 1e9 / std::max<std::size_t>(pendulums.size(), 1);
+    average = average > 0.0 ? average + (nanoseconds - average) * stepTimeSmoothing : nanoseconds;
+}
+
+// Fade out trajectories, then reset
+static Task ResetSequence()
+{
+    resetting = true;
+    double end = GetTime() + settings.resetFadeTime;
+    while (GetTime() < end)
+    {
+        resetAlpha = (end - GetTime()) / settings.resetFadeTime;
+        co_await pipeline.NextFrame("reset");
+    }
+
+    resets++;
+    metrics.resets.fetch_add(1, std::memory_order_relaxed);
+    InitializePendulums(resets);
+    RequestShardReset(resets);
+    RequestClusterReset(resets);
+    ResetSegments();
+    resetAlpha = 1.0f;
+    resetting = false;
+}
+
+// Fade out a segment, then reset only that segment
+// Ends early if all pendulums were reinitialized meanwhile
+static Task SegmentResetSequence(std::size_t segment)
+{
+    std::uint64_t version = ensembleVersion;
+    segmentResetting[segment] = true;
+    double end = GetTime() + settings.resetFadeTime;
+    while (GetTime() < end)
+    {
+        segmentAlpha[segment] = (end - GetTime()) / settings.resetFadeTime;
+        co_await pipeline.NextFrame("reset");
+        if (version != ensembleVersion)
+        {
+            co_return;
+        }
+    }
+
+    segmentResets[segment]++;
+    metrics.resets.fetch_add(1, std::memory_order_relaxed);
+    InitializeSegment(segment, segmentResets[segment]);
+    segmentAlpha[segment] = 1.0f;
+    segmentResetting[segment] = false;
+}
+
+// Keys and camera
+static void InputStage()
 {
     if (IsKeyPressed(KEY_SPACE) || IsKeyPressedRepeat(KEY_SPACE))
     {
@@ -108,32 +385,40 @@ static bool GameUpdate()
         ToggleBorderlessWindowed();
     }
 
-    // Reload settings
-    int newModTime = GetFileModTime(SETTINGS_FILENAME);
-    if (settingsModTime != newModTime)
+    // Compare the kernel plugin with the built in kernels on the same ensemble
+    if (IsKeyPressed(KEY_F10))
     {
-        settingsModTime = newModTime;
+        if (auto plugin = GetKernelPlugin())
+        {
+            EnableKernelPlugin(!KernelPluginEnabled());
+            ShowToast(TextFormat("Stepping with %s", KernelPluginEnabled() ? (plugin->name ? plugin->name : "kernel plugin") : "built in kernels"));
+        }
+        else
+        {
+            ShowToast("Set kernelPlugin in " SETTINGS_FILENAME " to compare kernels");
+        }
+    }
 
-        // Reset simulation if required
-        if (settings.LoadSettings(SETTINGS_FILENAME))
+    // Write stacks sampled since the last profile
+    if (IsKeyPressed(KEY_F9))
+    {
+        if (ProfilerRunning())
         {
-            resets = 0;
-            InitializePendulums();
-            toastMessageTimer = GetTime() + 5;
-            toastMessage = "Reloaded file " SETTINGS_FILENAME " and reset simulation";
+            const char* filename = TextFormat("profile_%d.folded", ++profilesWritten);
+            std::size_t dropped = 0;
+            std::size_t samples = WriteProfile(filename, dropped);
+            ShowToast(TextFormat("Wrote %zu samples (%zu dropped) to %s", samples, dropped, filename));
         }
         else
         {
-            toastMessageTimer = GetTime() + 5;
-            toastMessage = "Reloaded file " SETTINGS_FILENAME;
+            ShowToast("Start with --profile to sample stacks");
         }
     }
 
     // Open settings
     if ((IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) && IsKeyPressed(KEY_O))
     {
-        toastMessageTimer = GetTime() + 5;
-        toastMessage = "Opened file " SETTINGS_FILENAME " in system text editor";
+        ShowToast("Opened file " SETTINGS_FILENAME " in system text editor");
 #ifdef _WIN32
         std::system("start " SETTINGS_FILENAME);
 #elif __linux__
@@ -141,51 +426,234 @@ static bool GameUpdate()
 #elif __APPLE__
         std::system("open " SETTINGS_FILENAME); // Untested
 #else
-        toastMessageTimer = GetTime() + 5;
-        toastMessage = "Unsupported OS, please manually edit " SETTINGS_FILENAME " from current working directory";
+        ShowToast("Unsupported OS, please manually edit " SETTINGS_FILENAME " from current working directory");
 #endif
     }
 
     // Save settings
     if ((IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL)) && IsKeyPressed(KEY_S))
     {
-        settings.SaveSettings(SETTINGS_FILENAME);
-        toastMessageTimer = GetTime() + 5;
-        toastMessage = "Saved file " SETTINGS_FILENAME " in current working directory";
+        // Save what was asked for, not what memoryBudget lowered it to
+        SimulationSettings requested = settings;
+        UndoMemoryFit(requested, memoryFit);
+        requested.SaveSettings(SETTINGS_FILENAME);
+        ShowToast("Saved file " SETTINGS_FILENAME " in current working directory");
     }
 
-    // Reset after divergence
-    divergence = GetDivergence();
-    if (initiatedReset != 0.0)
+    camera.Update();
+}
+
+// Background music
+static void AudioStage()
+{
+    if (paused)
+    {
+        musicUpdated = 0.0;
+        return;
+    }
+
+    double now = GetTime();
+    if (musicUpdated > 0.0 && now - musicUpdated > audioUnderrunGap && IsMusicStreamPlaying(music))
+    {
+        metrics.audioUnderruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    UpdateMusicStream(music);
+    musicUpdated = now;
+}
+
+// Reload settings when the file changed, parsed on a worker thread
+static Task SettingsStage()
+{
+    // A viewer shows the settings of the stream server
+    if (StreamViewerRunning())
     {
-        if (GetTime() >= initiatedReset)
+        co_return;
+    }
+
+    // A rebuilt kernel plugin is swapped in before this frame's step
+    int newModTime = GetFileModTime(SETTINGS_FILENAME);
+    if (settingsModTime == newModTime)
+    {
+        if (KernelPluginChanged() || LayersChanged())
         {
-            resets++;
-            InitializePendulums(resets);
-            initiatedReset = 0.0;
+            co_await pipeline.SwitchTo(StageThread::Main);
+            ApplyKernelPlugin();
+            if (!ApplyLayers())
+            {
+                ShowToast("Failed to load a layer, see log");
+            }
         }
+        co_return;
     }
+    settingsModTime = newModTime;
 
-    // Reset calculation
+    // Compared with the values requested before memoryBudget lowered them
+    SimulationSettings loaded = settings;
+    UndoMemoryFit(loaded, memoryFit);
+    bool needsReset = loaded.LoadSettings(SETTINGS_FILENAME);
+
+    // Applying restarts workers and may reinitialize pendulums
+    co_await pipeline.SwitchTo(StageThread::Main);
+    MemoryFit fit = FitMemoryBudget(loaded, fixedMemory);
+    needsReset |= loaded.trajectoryPoints != settings.trajectoryPoints || loaded.joinedPendulumsCount != settings.joinedPendulumsCount;
+    settings = loaded;
+    memoryFit = fit;
+    needsReset |= ApplyPerformanceSettings();
+    StartWatchdog(pipeline, settings.hitchDeadline, HITCH_LOG_FILENAME);
+    ApplyKernelPlugin();
+
+    // Reset simulation if required
+    if (needsReset)
+    {
+        resets = 0;
+        metrics.resets.fetch_add(1, std::memory_order_relaxed);
+        InitializePendulums();
+        RequestShardReset(resets);
+        RequestClusterReset(resets);
+        ResetSegments();
+        ShowToast("Reloaded file " SETTINGS_FILENAME " and reset simulation");
+    }
     else
     {
-        bool resetKey = IsKeyPressed(KEY_R) || IsKeyPressedRepeat(KEY_R);
-        bool continueKey = IsKeyDown(KEY_C);
-        bool diverged = divergence > settings.resetThreshold;
-        if (!continueKey && (resetKey || diverged))
+        UpdateClusterSettings();
+        ShowToast("Reloaded file " SETTINGS_FILENAME);
+    }
+    if (memoryFit.adjusted)
+    {
+        ShowToast(memoryFit.message);
+    }
+
+    // Segment fades in progress no longer line up with segments
+    if (segmentAlpha.size() != GetSegmentCount())
+    {
+        ResetSegments();
+    }
+
+    // Layers follow the settings they are applied over
+    if (!ApplyLayers())
+    {
+        ShowToast("Reloaded file " SETTINGS_FILENAME ", but failed to load a layer, see log");
+    }
+}
+
+// Start resetting after divergence or on request
+static void ResetStage()
+{
+    // Last frame's divergence stage is done by now
+    divergence = latestDivergence;
+
+    bool resetKey = IsKeyPressed(KEY_R) || IsKeyPressedRepeat(KEY_R);
+    bool continueKey = IsKeyDown(KEY_C);
+
+    // The stream server resets, its fade is mirrored
+    if (StreamViewerRunning())
+    {
+        if (resetKey)
+        {
+            RequestStreamReset();
+        }
+        if (resets != streamView.resets)
         {
-            initiatedReset = GetTime() + settings.resetFadeTime;
+            metrics.resets.fetch_add(1, std::memory_order_relaxed);
         }
+        resets = streamView.resets;
+        resetAlpha = streamView.alpha;
+        return;
     }
 
-    camera.Update();
-    if (!paused)
+    if (resetting || continueKey)
     {
-        UpdateMusicStream(music);
-        UpdatePendulums();
+        return;
     }
 
-    return true;
+    // Everything at once, segments do not line up with shard or node slices
+    bool diverged = divergence.Statistic(settings.resetQuantile) > settings.resetThreshold;
+    bool wholeOnly = settings.resetSegments <= 1 || ShardsRunning() || ClusterRunning();
+    if (resetKey)
+    {
+        ResetLayers();
+    }
+    if (resetKey || (wholeOnly && diverged))
+    {
+        pipeline.Spawn(ResetSequence());
+        return;
+    }
+
+    // Only diverged segments, the rest keeps animating
+    if (!wholeOnly)
+    {
+        for (std::size_t s = 0; s < std::min(divergence.segments.size(), segmentAlpha.size()); s++)
+        {
+            if (!segmentResetting[s] && divergence.segments[s].mean > settings.resetThreshold)
+            {
+                pipeline.Spawn(SegmentResetSequence(s));
+            }
+        }
+    }
+}
+
+// Step simulation, capturing trajectories
+// Shards, nodes and stream servers step on their own, the last slices or
+// frames they sent are drawn
+static void StepStage()
+{
+    if (ShardsRunning())
+    {
+        if (!paused)
+        {
+            RequestShardStep();
+            metrics.steps.fetch_add(1, std::memory_order_relaxed);
+        }
+        shardDivergence = CompositeShards();
+    }
+    else if (ClusterRunning())
+    {
+        if (!paused)
+        {
+            RequestClusterStep();
+            metrics.steps.fetch_add(1, std::memory_order_relaxed);
+        }
+        shardDivergence = CompositeCluster();
+    }
+    else if (StreamViewerRunning())
+    {
+        streamView = ReceiveStream(showPendulums, !paused);
+    }
+    else if (!paused)
+    {
+        mainBudget.seconds = settings.frameBudget;
+        if (mainBudget.StartStep())
+        {
+            double started = GetTime();
+            UpdatePendulums();
+            double stepped = GetTime() - started;
+            RecordStepTime(stepped);
+            mainBudget.Stepped(stepped);
+            metrics.steps.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Swapped in one by one, nothing else reads the ensemble until divergence
+        StepLayers(!IsKeyDown(KEY_C));
+    }
+}
+
+// Reduce divergence partials for the next reset check, overlaps drawing
+static void DivergenceStage()
+{
+    if (StreamViewerRunning())
+    {
+        latestDivergence = streamView.divergence;
+    }
+    else
+    {
+        latestDivergence = ShardsRunning() || ClusterRunning() ? shardDivergence : GetDivergence();
+    }
+}
+
+// Publish the last step for other processes, overlaps drawing
+static void PublishStage()
+{
+    PublishSharedState(latestDivergence);
 }
 
 // Draw everything
@@ -196,14 +664,23 @@ static void GameDraw()
 
     camera.BeginMode2D();
 
-    // Fade animation
-    float alpha = initiatedReset == 0.0 ? 1.0f : (initiatedReset - GetTime()) / settings.resetFadeTime;
-    DrawPendulumTrajectories(alpha, showPendulums);
+    // Fade animation, as many pendulums as fit in the frame budget
+    const std::size_t stride = mainBudget.DrawStride(pendulums.size());
+    double drawStarted = GetTime();
+    DrawPendulumTrajectories(resetAlpha, showPendulums, segmentAlpha, stride);
+    mainBudget.Drawn(GetTime() - drawStarted, (pendulums.size() + stride - 1) / stride);
+    DrawLayers(showPendulums);
 
     camera.EndMode2D();
 
     if (showInfo)
     {
+        std::string budgetInfo = FormatBudgetInfo();
+        std::string integratorInfo = settings.integrator;
+        if (settings.integrator == "implicit")
+        {
+            integratorInfo += " (" + std::to_string(GetImplicitSplits()) + " steps halved to converge last step)";
+        }
         DrawText(
             "Press SPACE to resume/pause simulation\n"
             "Press F1 to toggle this info\n"
@@ -217,24 +694,35 @@ static void GameDraw()
                 "\n\n\n"
                 "\n"
                 "FPS: %d\n"
+                "Kernels: %s%s (CPU supports %s)\n"
+                "%s"
+                "Workers: %zu threads on %zu NUMA nodes, chunk %zu\n"
+                "%s"
+                "%s"
+                "%s"
                 "Resets count: %d\n"
+                "Reset segments: %zu (%zu resetting)\n"
                 "Divergence / Threshold to reset: %f / %f\n"
+                "Neighbor distance mean %.3f, sd %.3f, median %.3f, p99 %.3f, max %.3f\n"
                 "Press R to manually reset, or hold C to not auto reset\n"
                 "\n"
                 "Settings:\n"
-                "  Gravity: %f\n"
+                "  Gravity: %f (spread %f)\n"
                 "  Fixed delta time: %f\n"
                 "  Trajectory alpha power: %f\n"
+                "  Integrator: %s\n"
                 "  Pendulums joined = %zu\n"
+                "  Pendulums joined mix = %s\n"
                 "  Joined pendulums count = %zu\n"
                 "  Trajectory points = %zu\n"
-                "  Pendulum length = %f\n"
-                "  Pendulum mass = %f\n"
+                "  Pendulum length = %f (spread %f)\n"
+                "  Pendulum mass = %f (spread %f)\n"
                 "  Pendulum color saturation = %f\n"
                 "  Pendulum color value = %f\n"
                 "  Reset threshold = %f\n"
-                "  Reset samples = %zu\n"
+                "  Reset quantile = %f\n"
                 "  Reset fade time = %f\n"
+                "  Reset segments = %zu\n"
                 "\n"
                 "Edit configuration from " SETTINGS_FILENAME "\n"
                 "Press CTRL+O to open settings file\n"
@@ -245,28 +733,48 @@ static void GameDraw()
                 "Press M to toggle mute\n"
                 "\n",
                 GetFPS(),
+                activeKernels->strict ? "strict " : "", CpuFeatureLevelName(activeKernels->level), CpuFeatureLevelName(detectedCpuFeatureLevel),
+                !GetKernelPlugin() ? "" : TextFormat("Kernel plugin: %s (%s, F10 to switch), %.1f ns per pendulum step, built in %.1f ns\n",
+                    GetKernelPlugin()->name ? GetKernelPlugin()->name : GetKernelPluginPath().c_str(), KernelPluginEnabled() ? "stepping" : "off",
+                    pluginStepNanoseconds, builtinStepNanoseconds),
+                workers.Size(), workers.nodes, settings.workChunkSize,
+                budgetInfo.c_str(),
+                settings.deterministic ? TextFormat("Deterministic, state hash %016llx at step %llu\n",
+                    (unsigned long long)GetStateHash(), (unsigned long long)simulationStep) : "",
+                !StreamViewerRunning() ? "" : streamView.connected ?
+                    TextFormat("Stream: %s, step %llu, %llu frames (%llu dropped by server)\n", streamViewer.c_str(),
+                        (unsigned long long)streamView.step, (unsigned long long)streamView.frames, (unsigned long long)streamView.dropped) :
+                    TextFormat("Stream: connecting to %s\n", streamViewer.c_str()),
                 resets,
-                divergence, settings.resetThreshold,
+                segmentAlpha.size(), (std::size_t)std::count(segmentResetting.begin(), segmentResetting.end(), true),
+                divergence.Statistic(settings.resetQuantile), settings.resetThreshold,
+                divergence.mean, divergence.StandardDeviation(), divergence.sketch.Quantile(0.5), divergence.sketch.Quantile(0.99), divergence.max,
 
                 settings.gravity,
+                settings.gravitySpread,
                 settings.fixedDeltaTime,
                 settings.trajectoryAlphaPower,
+                integratorInfo.c_str(),
                 settings.pendulumsJoined,
+                settings.pendulumsJoinedMix.c_str(),
                 settings.joinedPendulumsCount,
                 settings.trajectoryPoints,
                 settings.pendulumLength,
+                settings.pendulumLengthSpread,
                 settings.pendulumMass,
+                settings.pendulumMassSpread,
                 settings.pendulumColorSaturation,
                 settings.pendulumColorValue,
                 settings.resetThreshold,
-                settings.resetSamples,
-                settings.resetFadeTime
+                settings.resetQuantile,
+                settings.resetFadeTime,
+                settings.resetSegments
             ),
             20, 20, 20, GRAY
         );
     }
 
-    if (toastMessageTimer >= GetTime())
+    if (!toastMessage.empty())
     {
         int width = MeasureText(toastMessage.c_str(), 20);
         DrawText(toastMessage.c_str(), GetScreenWidth() - width - 20, GetScreenHeight() - 40, 20, WHITE);
@@ -275,17 +783,453 @@ static void GameDraw()
     EndDrawing();
 }
 
+// Stages of a frame, each after the ones it reads results of
+static void BuildPipeline()
+{
+    pipeline.clock = GetTime;
+    pipeline.AddStage("input", StageThread::Main, {}, InputStage);
+    pipeline.AddStage("audio", StageThread::Main, { "input" }, AudioStage);
+    pipeline.AddStage("settings", StageThread::Workers, { "input" }, SettingsStage);
+    pipeline.AddStage("reset", StageThread::Main, { "input", "settings" }, ResetStage);
+    pipeline.AddStage("step", StageThread::Main, { "reset" }, StepStage);
+    pipeline.AddStage("divergence", StageThread::Workers, { "step" }, DivergenceStage);
+    pipeline.AddStage("publish", StageThread::Workers, { "divergence" }, PublishStage);
+    pipeline.AddStage("draw", StageThread::Main, { "step" }, GameDraw);
+}
+
+// Record the frame that just ran for the overlay and the metrics endpoint,
+// between frames so nothing else touches pendulums
+static void RecordMetrics()
+{
+    memoryUsage = MeasureMemoryUsage(GetScreenWidth(), GetScreenHeight(), music);
+    if (!MetricsRunning())
+    {
+        return;
+    }
+
+    metrics.frame.Observe(pipeline.frameSeconds);
+    for (std::size_t s = 0; s < std::min(pipeline.stages.size(), metricsMaxPhases); s++)
+    {
+        metrics.phases[s].Observe(pipeline.stages[s].seconds);
+    }
+
+    double now = GetTime();
+    std::uint64_t steps = metrics.steps.load(std::memory_order_relaxed);
+    if (now - metricsSecond >= 1.0)
+    {
+        metrics.stepsPerSecond.store((steps - metricsSecondSteps) / (now - metricsSecond), std::memory_order_relaxed);
+        metricsSecond = now;
+        metricsSecondSteps = steps;
+    }
+
+    metrics.pendulums.store(pendulums.size(), std::memory_order_relaxed);
+    metrics.divergence.store(divergence.Statistic(settings.resetQuantile), std::memory_order_relaxed);
+    metrics.divergenceMean.store(divergence.mean, std::memory_order_relaxed);
+    metrics.resetThreshold.store(settings.resetThreshold, std::memory_order_relaxed);
+    metrics.trailBytes.store(memoryUsage.trails, std::memory_order_relaxed);
+    metrics.ensembleBytes.store(memoryUsage.ensemble, std::memory_order_relaxed);
+    metrics.layerBytes.store(memoryUsage.layers, std::memory_order_relaxed);
+    metrics.renderBytes.store(memoryUsage.render, std::memory_order_relaxed);
+    metrics.audioBytes.store(memoryUsage.audio, std::memory_order_relaxed);
+    metrics.memoryBudgetBytes.store(settings.memoryBudget << 20, std::memory_order_relaxed);
+}
+
+// Step the simulation without a window and print kernel timings
+static int RunBenchmark()
+{
+    using Clock = std::chrono::steady_clock;
+
+    if (FileExists(SETTINGS_FILENAME))
+    {
+        settings.LoadSettings(SETTINGS_FILENAME);
+    }
+    ApplyPerformanceSettings();
+    InitializePendulums();
+    if (profileFrequency > 0)
+    {
+        StartProfiler(profileFrequency);
+    }
+
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < benchmarkSteps; i++)
+    {
+        UpdatePendulums();
+    }
+    double stepSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Render kernel, without the draw calls that need a window
+    std::size_t points = 0;
+    std::vector<float> unrolled;
+    start = Clock::now();
+    for (std::size_t r = 0; r < 100; r++)
+    {
+        for (auto& p : pendulums)
+        {
+            unrolled.resize(p.trajectories.size() * 2);
+            activeKernels->unrollTrajectory((const double*)p.trajectories.data(), p.trajectories.size(), p.trajectoryIndex, unrolled.data());
+            points += p.trajectories.size();
+        }
+    }
+    double unrollSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    double pendulumSteps = (double)benchmarkSteps * pendulums.size();
+    std::printf("CPU: %s\n", GetCpuModelName().c_str());
+    std::printf("Kernels: %s%s (CPU supports %s, %zu lanes)\n",
+        activeKernels->strict ? "strict " : "", CpuFeatureLevelName(activeKernels->level), CpuFeatureLevelName(detectedCpuFeatureLevel), activeKernels->lanes);
+    std::printf("Workers: %zu threads on %zu NUMA nodes, chunk %zu\n", workers.Size(), workers.nodes, settings.workChunkSize);
+    std::printf("Pendulums: %zu x %s joined, %zu trajectory points\n",
+        settings.joinedPendulumsCount,
+        settings.pendulumsJoinedMix == "none" ? std::to_string(settings.pendulumsJoined).c_str() : settings.pendulumsJoinedMix.c_str(),
+        settings.trajectoryPoints);
+    std::printf("Step: %zu steps in %.3f s, %.2f ns per pendulum step\n",
+        benchmarkSteps, stepSeconds, pendulumSteps > 0 ? stepSeconds * 1e9 / pendulumSteps : 0.0);
+    std::printf("Trajectory unroll: %.2f ns per point\n", points > 0 ? unrollSeconds * 1e9 / points : 0.0);
+    auto stats = GetDivergence();
+    std::printf("Divergence: mean %f, sd %f, median %f, p99 %f, max %f over %zu pairs\n",
+        stats.mean, stats.StandardDeviation(), stats.sketch.Quantile(0.5), stats.sketch.Quantile(0.99), stats.max, stats.count);
+    if (ProfilerRunning())
+    {
+        StopProfiler();
+        std::size_t dropped = 0;
+        std::size_t samples = WriteProfile("profile_benchmark.folded", dropped);
+        std::printf("Profile: %zu samples (%zu dropped) written to profile_benchmark.folded\n", samples, dropped);
+    }
+    std::printf("State hash: %016llx at step %llu%s\n",
+        (unsigned long long)GetStateHash(), (unsigned long long)simulationStep, settings.deterministic ? " (deterministic)" : "");
+    return 0;
+}
+
+// Measure the roofs of this machine and place the step kernels of each
+// integrator and the trajectory unroll kernel under them
+static int RunRoofline()
+{
+    if (FileExists(SETTINGS_FILENAME))
+    {
+        settings.LoadSettings(SETTINGS_FILENAME);
+    }
+    ApplyPerformanceSettings();
+    InitializePendulums();
+
+    std::printf("CPU: %s\n", GetCpuModelName().c_str());
+    std::printf("Kernels: %s%s (CPU supports %s, %zu lanes)\n",
+        activeKernels->strict ? "strict " : "", CpuFeatureLevelName(activeKernels->level), CpuFeatureLevelName(detectedCpuFeatureLevel), activeKernels->lanes);
+    std::printf("Pendulums: %zu x %s joined, %zu trajectory points\n",
+        settings.joinedPendulumsCount,
+        settings.pendulumsJoinedMix == "none" ? std::to_string(settings.pendulumsJoined).c_str() : settings.pendulumsJoinedMix.c_str(),
+        settings.trajectoryPoints);
+
+    // Memory roofs, kernels get bandwidth roofs of their own footprint
+    const RooflinePeaks peaks[] = {
+        { workers.Size(), MeasurePeakFlops(true), MeasureBandwidth(true, rooflineMemoryBytes) },
+        { 1, MeasurePeakFlops(false), MeasureBandwidth(false, rooflineMemoryBytes) }
+    };
+    for (std::size_t i = 0; i < (workers.Size() > 1 ? 2 : 1); i++)
+    {
+        const auto& peak = peaks[i];
+        std::printf("Roofs on %zu thread%s: %.2f GFLOP/s, %.2f GB/s from memory, ridge at %.2f FLOP/byte\n",
+            peak.threads, peak.threads == 1 ? "" : "s", peak.flopsPerSecond * 1e-9, peak.bytesPerSecond * 1e-9, peak.RidgePoint());
+    }
+
+    std::printf("\n%-10s %10s %10s %10s %10s %10s %10s %8s  %s\n",
+        "Kernel", "FLOP/unit", "Bytes/unit", "FLOP/byte", "GFLOP/s", "GB/s", "Roof GB/s", "Of roof", "Bound");
+    for (const auto& point : MeasureRooflinePoints(rooflineSteps))
+    {
+        // Unrolling is done by the main thread while drawing
+        RooflinePeaks peak = peaks[point.mainThread ? 1 : 0];
+        peak.bytesPerSecond = MeasureBandwidth(!point.mainThread, (std::size_t)point.footprint);
+
+        double intensity = point.cost.Intensity();
+        double flops = point.cost.flops * point.unitsPerSecond;
+        double bytes = point.cost.bytes * point.unitsPerSecond;
+        bool memoryBound = intensity < peak.RidgePoint();
+
+        // Against the roof that applies, bandwidth for kernels without flops
+        double ofRoof = memoryBound ? bytes / peak.bytesPerSecond : flops / peak.Roof(intensity);
+        std::printf("%-10s %10.1f %10.1f %10.3f %10.2f %10.2f %10.2f %7.1f%%  %s%s\n",
+            point.name.c_str(), point.cost.flops, point.cost.bytes, intensity, flops * 1e-9, bytes * 1e-9, peak.bytesPerSecond * 1e-9, ofRoof * 100.0,
+            memoryBound ? "memory, layout pays" : "compute, SIMD and fewer flops pay", point.active ? " (active)" : "");
+    }
+    std::printf("\nUnits are pendulum steps, trajectory points for unroll, which is measured against the roofs of one thread\n");
+    std::printf("Bandwidth roofs of kernels are measured over the bytes they move in a pass, from cache if they fit\n");
+    std::printf("Implicit counts assume %d Newton iterations per step\n", rooflineImplicitIterations);
+    return 0;
+}
+
+// Compare generated chain kernels with the generic solver on every level the
+// CPU supports, return nonzero if any differs beyond rounding
+static int RunChainCheck()
+{
+    constexpr double tolerance = 1e-9;
+
+    const CpuFeatureLevel detected = DetectCpuFeatureLevel();
+    bool passed = true;
+    for (int level = 0; level <= (int)detected; level++)
+    {
+        for (bool strict : { false, true })
+        {
+            const Kernels* kernels = GetCompiledKernels((CpuFeatureLevel)level, strict);
+            if (!kernels)
+            {
+                continue;
+            }
+
+            std::printf("%s%s:", strict ? "strict " : "", CpuFeatureLevelName(kernels->level));
+            for (std::size_t links = chainKernelMinLinks; links <= chainKernelMaxLinks; links++)
+            {
+                double error = CheckChainKernels(*kernels, links);
+                passed = passed && error <= tolerance;
+                std::printf(" %zu links %.1e%s", links, error, error <= tolerance ? "" : " (FAILED)");
+            }
+            std::printf("\n");
+        }
+    }
+
+    std::printf("Chain kernels %s (tolerance %.0e relative)\n", passed ? "match" : "DIFFER", tolerance);
+    return passed ? 0 : 1;
+}
+
+// Parse command line, return false on invalid usage
+static bool ParseArguments(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        try
+        {
+            if (arg.starts_with("--kernel="))
+            {
+                kernelOverride = arg.substr(9);
+            }
+            else if (arg == "--benchmark")
+            {
+                benchmarkSteps = 1000;
+            }
+            else if (arg.starts_with("--benchmark="))
+            {
+                benchmarkSteps = std::stoul(std::string(arg.substr(12)));
+            }
+            else if (arg == "--roofline")
+            {
+                rooflineSteps = 200;
+            }
+            else if (arg.starts_with("--roofline="))
+            {
+                rooflineSteps = std::stoul(std::string(arg.substr(11)));
+            }
+            else if (arg == "--tune")
+            {
+                recalibrate = true;
+            }
+            else if (arg == "--check-chain")
+            {
+                checkChain = true;
+            }
+            else if (arg.starts_with("--shards="))
+            {
+                shardCount = std::stoul(std::string(arg.substr(9)));
+            }
+            else if (arg.starts_with("--shard-reserved="))
+            {
+                shardReserved = std::stoul(std::string(arg.substr(17)));
+            }
+            else if (arg.starts_with("--shard="))
+            {
+                auto slice = std::string(arg.substr(8));
+                auto separator = slice.find('/');
+                if (separator == std::string::npos)
+                {
+                    throw std::invalid_argument("Expected INDEX/COUNT");
+                }
+                shardIndex = std::stoul(slice.substr(0, separator));
+                shardOf = std::stoul(slice.substr(separator + 1));
+            }
+            else if (arg.starts_with("--cluster-listen="))
+            {
+                clusterListen = arg.substr(17);
+            }
+            else if (arg.starts_with("--cluster-nodes="))
+            {
+                clusterNodes = std::stoul(std::string(arg.substr(16)));
+            }
+            else if (arg.starts_with("--cluster-worker="))
+            {
+                clusterWorker = arg.substr(17);
+            }
+            else if (arg.starts_with("--sweep="))
+            {
+                sweepFilename = arg.substr(8);
+            }
+            else if (arg.starts_with("--sweep-listen="))
+            {
+                sweepListen = arg.substr(15);
+            }
+            else if (arg.starts_with("--sweep-worker="))
+            {
+                sweepWorker = arg.substr(15);
+            }
+            else if (arg.starts_with("--sweep-workers="))
+            {
+                sweepWorkers = std::stoul(std::string(arg.substr(16)));
+            }
+            else if (arg.starts_with("--sweep-steps="))
+            {
+                sweepSteps = std::stoul(std::string(arg.substr(14)));
+            }
+            else if (arg.starts_with("--service="))
+            {
+                serviceAddress = arg.substr(10);
+            }
+            else if (arg.starts_with("--stream-server="))
+            {
+                streamServer = arg.substr(16);
+            }
+            else if (arg.starts_with("--stream-viewer="))
+            {
+                streamViewer = arg.substr(16);
+            }
+            else if (arg == "--profile")
+            {
+                profileFrequency = profilerDefaultFrequency;
+            }
+            else if (arg.starts_with("--profile="))
+            {
+                profileFrequency = std::stoi(std::string(arg.substr(10)));
+            }
+            else if (arg.starts_with("--metrics="))
+            {
+                metricsAddress = arg.substr(10);
+            }
+            else
+            {
+                std::printf("Unknown option: %s\n", argv[i]);
+                return false;
+            }
+        }
+
+        // Probably std::invalid_argument
+        catch (const std::exception& e)
+        {
+            std::printf("Invalid option %s: %s\n", argv[i], e.what());
+            return false;
+        }
+    }
+
+    return true;
+}
+
 // Do everything
-int main()
+int main(int argc, char** argv)
 {
+    executable = argv[0];
+    if (!ParseArguments(argc, argv))
+    {
+        std::printf(
+            "Usage: %s [options]\n"
+            "  --kernel=LEVEL    Force kernel level (auto, scalar, sse4.2, avx2, avx512)\n"
+            "  --benchmark[=N]   Run N simulation steps without window and print timings\n"
+            "  --roofline[=N]    Measure peak FLOP rate and bandwidth, place kernels on the roofline over N steps\n"
+            "  --tune            Calibrate threads, chunk size and kernel level, ignoring " TUNING_FILENAME "\n"
+            "  --check-chain     Check generated chain kernels against the generic solver\n"
+            "  --shards=N        Simulate in N shard processes, composited here\n"
+            "  --cluster-listen=[HOST]:PORT\n"
+            "                    Render the ensemble simulated by worker nodes connecting here\n"
+            "  --cluster-nodes=N Worker nodes to wait for before starting (default 1)\n"
+            "  --cluster-worker=HOST:PORT\n"
+            "                    Simulate slices for the render node at HOST:PORT, without window\n"
+            "  --sweep=FILE      Run the parameter sweep of FILE on worker processes, without window\n"
+            "  --sweep-workers=N Sweep worker processes on this machine (default one per core, 1 for --sweep-worker)\n"
+            "  --sweep-steps=N   Step limit of a sweep job (default 2000)\n"
+            "  --sweep-listen=[HOST]:PORT\n"
+            "                    Also hand sweep jobs to workers connecting here\n"
+            "  --sweep-worker=HOST:PORT\n"
+            "                    Run sweep jobs for the coordinator at HOST:PORT\n"
+            "  --service=ADDRESS Serve simulation requests on ADDRESS (such as unix:/tmp/hdp.sock), without window\n"
+            "  --stream-server=[HOST]:PORT\n"
+            "                    Simulate without window, streaming every step to viewers connecting here\n"
+            "  --stream-viewer=HOST:PORT\n"
+            "                    Show the stream of the server at HOST:PORT instead of simulating here\n"
+            "  --profile[=HZ]    Sample stacks of every thread, F9 writes them to profile_N.folded\n"
+            "  --metrics=[HOST]:PORT\n"
+            "                    Serve Prometheus metrics on http://HOST:PORT/metrics (localhost without HOST)\n",
+            argv[0]
+        );
+        return 1;
+    }
+
+    if (checkChain)
+    {
+        return RunChainCheck();
+    }
+
+    if (shardOf > 0)
+    {
+        return RunShard(shardIndex, shardOf, SETTINGS_FILENAME, shardReserved);
+    }
+
+    if (!clusterWorker.empty())
+    {
+        return RunClusterWorker(clusterWorker, SETTINGS_FILENAME);
+    }
+
+    if (!sweepWorker.empty())
+    {
+        return RunSweepWorker(sweepWorker, SETTINGS_FILENAME, std::max<std::size_t>(sweepWorkers, 1), executable);
+    }
+
+    if (!serviceAddress.empty())
+    {
+        return RunService(serviceAddress, SETTINGS_FILENAME);
+    }
+
+    if (!streamServer.empty())
+    {
+        return RunStreamServer(streamServer, SETTINGS_FILENAME);
+    }
+
+    if (!sweepFilename.empty())
+    {
+        std::size_t local = sweepWorkers > 0 ? sweepWorkers : std::max(std::thread::hardware_concurrency(), 1u);
+        return RunSweep(sweepFilename.c_str(), SETTINGS_FILENAME, SWEEP_RESULTS_FILENAME, SWEEP_CSV_FILENAME, local, sweepListen, sweepSteps, executable);
+    }
+
+    if (benchmarkSteps > 0)
+    {
+        return RunBenchmark();
+    }
+
+    if (rooflineSteps > 0)
+    {
+        return RunRoofline();
+    }
+
     GameInit();
+    BuildPipeline();
+    if (memoryFit.adjusted)
+    {
+        ShowToast(memoryFit.message);
+    }
 
-    while (!WindowShouldClose())
+    if (!metricsAddress.empty())
+    {
+        std::vector<std::string> phases;
+        for (const auto& stage : pipeline.stages)
+        {
+            phases.push_back(stage.name);
+        }
+        StartMetrics(metricsAddress, std::move(phases));
+    }
+    if (profileFrequency > 0)
     {
-        if (!GameUpdate())
-            break;
+        StartProfiler(profileFrequency);
+    }
+    StartWatchdog(pipeline, settings.hitchDeadline, HITCH_LOG_FILENAME);
 
-        GameDraw();
+    while (!WindowShouldClose())
+    {
+        WatchdogFrame();
+        pipeline.RunFrame();
+        RecordMetrics();
+        CollectProfile();
     }
     GameCleanup();
 
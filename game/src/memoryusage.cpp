@@ -0,0 +1,152 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Memory accounting source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "memoryusage.hpp"
+#include "layers.hpp"
+
+#include <algorithm>
+
+constexpr std::size_t megabyte = 1 << 20;
+
+// Trails are unrolled into floats before drawing (see DrawTrajectory)
+static std::size_t EstimateRenderMemory(int width, int height, std::size_t trajectoryPoints)
+{
+    return renderBatchBytes + (std::size_t)std::max(width, 0) * std::max(height, 0) * framebufferPixelBytes
+        + trajectoryPoints * 2 * sizeof(float);
+}
+
+// Two sub-buffers of raylib's default 1/30 s each
+static std::size_t EstimateAudioMemory(const Music& music)
+{
+    return 2 * (music.stream.sampleRate / 30) * music.stream.channels * (music.stream.sampleSize / 8);
+}
+
+std::size_t EstimateFixedMemory(int width, int height, std::size_t trajectoryPoints, const Music& music)
+{
+    return EstimateRenderMemory(width, height, trajectoryPoints) + EstimateAudioMemory(music);
+}
+
+MemoryUsage MeasureMemoryUsage(int width, int height, const Music& music)
+{
+    MemoryUsage usage;
+    EnsembleMemory ensemble = GetEnsembleMemory();
+    usage.ensemble = ensemble.state;
+    usage.trails = ensemble.trails;
+    for (const auto& layer : layers)
+    {
+        EnsembleMemory memory = GetEnsembleMemory(layer.ensemble);
+        usage.layers += memory.state + memory.trails;
+    }
+
+    usage.render = EstimateRenderMemory(width, height, settings.trajectoryPoints);
+    usage.audio = EstimateAudioMemory(music);
+    return usage;
+}
+
+MemoryFit FitMemoryBudget(SimulationSettings& fitted, std::size_t reserved)
+{
+    MemoryFit fit;
+    fit.trajectoryPoints = fitted.trajectoryPoints;
+    fit.joinedPendulumsCount = fitted.joinedPendulumsCount;
+    if (fitted.memoryBudget == 0)
+    {
+        return fit;
+    }
+
+    const std::size_t budget = fitted.memoryBudget * megabyte;
+    const std::size_t available = budget > reserved ? budget - reserved : 0;
+    SimulationSettings candidate = fitted;
+    auto fits = [&]() {
+        EnsembleMemory memory = EstimateEnsembleMemory(candidate);
+        return memory.state + memory.trails <= available;
+    };
+    if (fits())
+    {
+        return fit;
+    }
+
+    // Largest value in [low, high] that fits, low if none does, estimates
+    // only grow with either value
+    auto largest = [&](std::size_t& value, std::size_t low, std::size_t high) {
+        while (low < high)
+        {
+            value = low + (high - low + 1) / 2;
+            if (fits())
+            {
+                low = value;
+            }
+            else
+            {
+                high = value - 1;
+            }
+        }
+        value = low;
+    };
+
+    // Shorter trails first, fewer pendulums only if that is not enough
+    largest(candidate.trajectoryPoints, std::min(fitted.trajectoryPoints, memoryMinTrajectoryPoints), fitted.trajectoryPoints);
+    if (!fits())
+    {
+        largest(candidate.joinedPendulumsCount, 1, fitted.joinedPendulumsCount);
+    }
+    if (candidate.trajectoryPoints == fitted.trajectoryPoints && candidate.joinedPendulumsCount == fitted.joinedPendulumsCount)
+    {
+        return fit;
+    }
+
+    auto lowered = [](const char* name, std::size_t from, std::size_t to) {
+        return std::string(name) + " from " + std::to_string(from) + " to " + std::to_string(to);
+    };
+    fit.adjusted = true;
+    fit.message = "Lowered ";
+    if (candidate.trajectoryPoints != fitted.trajectoryPoints)
+    {
+        fit.message += lowered("trajectoryPoints", fitted.trajectoryPoints, candidate.trajectoryPoints);
+        fit.message += candidate.joinedPendulumsCount != fitted.joinedPendulumsCount ? " and " : "";
+    }
+    if (candidate.joinedPendulumsCount != fitted.joinedPendulumsCount)
+    {
+        fit.message += lowered("joinedPendulumsCount", fitted.joinedPendulumsCount, candidate.joinedPendulumsCount);
+    }
+    fit.message += " to fit memoryBudget " + std::to_string(fitted.memoryBudget) + " MiB";
+
+    fitted.trajectoryPoints = candidate.trajectoryPoints;
+    fitted.joinedPendulumsCount = candidate.joinedPendulumsCount;
+    return fit;
+}
+
+void UndoMemoryFit(SimulationSettings& fitted, const MemoryFit& fit)
+{
+    if (fit.adjusted)
+    {
+        fitted.trajectoryPoints = fit.trajectoryPoints;
+        fitted.joinedPendulumsCount = fit.joinedPendulumsCount;
+    }
+}
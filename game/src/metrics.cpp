@@ -0,0 +1,257 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Metrics endpoint source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "metrics.hpp"
+#include "format.hpp"
+#include "net.hpp"
+
+#include "raylib.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <utility>
+
+// Seconds a scraper gets to send its request
+constexpr double metricsRequestTimeout = 1.0;
+
+Metrics metrics;
+
+static std::atomic<std::uint64_t> allocations = 0;
+static std::thread metricsThread;
+static std::atomic<bool> metricsStopping = false;
+static int metricsListener = -1;
+
+// Every allocation of the process passes here, one relaxed increment each
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+std::uint64_t GetAllocationCount()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+// Append a metric family header
+static void AppendHeader(std::string& out, const char* name, const char* type, const char* help)
+{
+    AppendFormat(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Append one histogram of a family, labels empty or like phase="step"
+static void AppendHistogram(std::string& out, const char* name, const std::string& labels, const MetricsHistogram& histogram)
+{
+    const char* separator = labels.empty() ? "" : ",";
+    std::uint64_t cumulative = 0;
+    for (std::size_t b = 0; b < histogram.counts.size(); b++)
+    {
+        cumulative += histogram.counts[b].load(std::memory_order_relaxed);
+        if (b < metricsTimeBuckets.size())
+        {
+            AppendFormat(out, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels.c_str(), separator, metricsTimeBuckets[b], (unsigned long long)cumulative);
+        }
+        else
+        {
+            AppendFormat(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels.c_str(), separator, (unsigned long long)cumulative);
+        }
+    }
+
+    // Count is the +Inf bucket, so both agree while the main thread observes
+    std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    AppendFormat(out, "%s_sum%s %.9g\n", name, braces.c_str(), histogram.sum.load(std::memory_order_relaxed));
+    AppendFormat(out, "%s_count%s %llu\n", name, braces.c_str(), (unsigned long long)cumulative);
+}
+
+std::string FormatMetrics()
+{
+    std::string out;
+    AppendHeader(out, "hdp_frame_seconds", "histogram", "Wall time of a frame");
+    AppendHistogram(out, "hdp_frame_seconds", "", metrics.frame);
+
+    AppendHeader(out, "hdp_phase_seconds", "histogram", "Wall time of a frame pipeline stage");
+    for (std::size_t p = 0; p < std::min(metrics.phaseNames.size(), metricsMaxPhases); p++)
+    {
+        AppendHistogram(out, "hdp_phase_seconds", "phase=\"" + metrics.phaseNames[p] + "\"", metrics.phases[p]);
+    }
+
+    auto counter = [&](const char* name, const char* help, std::uint64_t value) {
+        AppendHeader(out, name, "counter", help);
+        AppendFormat(out, "%s %llu\n", name, (unsigned long long)value);
+    };
+    auto gauge = [&](const char* name, const char* help, double value) {
+        AppendHeader(out, name, "gauge", help);
+        AppendFormat(out, "%s %.9g\n", name, value);
+    };
+    counter("hdp_steps_total", "Simulation steps", metrics.steps.load(std::memory_order_relaxed));
+    gauge("hdp_steps_per_second", "Simulation steps over the last second", metrics.stepsPerSecond.load(std::memory_order_relaxed));
+    gauge("hdp_pendulums", "Joined pendulums drawn", (double)metrics.pendulums.load(std::memory_order_relaxed));
+    gauge("hdp_divergence", "Divergence compared with the reset threshold", metrics.divergence.load(std::memory_order_relaxed));
+    gauge("hdp_divergence_mean", "Mean distance between end points of neighboring pendulums", metrics.divergenceMean.load(std::memory_order_relaxed));
+    gauge("hdp_reset_threshold", "Divergence that resets the simulation", metrics.resetThreshold.load(std::memory_order_relaxed));
+    counter("hdp_resets_total", "Resets of the whole ensemble or of a segment", metrics.resets.load(std::memory_order_relaxed));
+    gauge("hdp_trail_bytes", "Memory of the trajectory points of every pendulum", (double)metrics.trailBytes.load(std::memory_order_relaxed));
+    AppendHeader(out, "hdp_memory_bytes", "gauge", "Memory by subsystem, render and audio are estimated");
+    const std::pair<const char*, std::uint64_t> subsystems[] = {
+        { "ensemble", metrics.ensembleBytes.load(std::memory_order_relaxed) },
+        { "trails", metrics.trailBytes.load(std::memory_order_relaxed) },
+        { "layers", metrics.layerBytes.load(std::memory_order_relaxed) },
+        { "render", metrics.renderBytes.load(std::memory_order_relaxed) },
+        { "audio", metrics.audioBytes.load(std::memory_order_relaxed) },
+    };
+    for (const auto& [subsystem, bytes] : subsystems)
+    {
+        AppendFormat(out, "hdp_memory_bytes{subsystem=\"%s\"} %llu\n", subsystem, (unsigned long long)bytes);
+    }
+    gauge("hdp_memory_budget_bytes", "Memory budget settings are fitted into, 0 for none", (double)metrics.memoryBudgetBytes.load(std::memory_order_relaxed));
+    counter("hdp_allocations_total", "Allocations by operator new", GetAllocationCount());
+    counter("hdp_audio_underruns_total", "Music stream updates later than its buffer lasts", metrics.audioUnderruns.load(std::memory_order_relaxed));
+    return out;
+}
+
+// Answer one scrape, or anything else with 404
+static void ServeMetricsRequest(int socket)
+{
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192)
+    {
+        long received = ReadSocket(socket, buffer, sizeof(buffer), metricsRequestTimeout);
+        if (received <= 0)
+        {
+            return;
+        }
+        request.append(buffer, (std::size_t)received);
+    }
+
+    const bool found = request.starts_with("GET /metrics ") || request.starts_with("GET / ");
+    const std::string body = found ? FormatMetrics() : "Not found\n";
+    std::string response;
+    AppendFormat(response,
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        found ? "200 OK" : "404 Not Found", body.size());
+    response += body;
+    WriteSocket(socket, response.data(), response.size());
+}
+
+bool StartMetrics(std::string_view address, std::vector<std::string> phaseNames)
+{
+    StopMetrics();
+
+    // Kiosk metrics are for the local scraper unless a host is given
+    std::string local = address.starts_with(":") ? "127.0.0.1" + std::string(address) : std::string(address);
+    metricsListener = ListenSocket(local);
+    if (metricsListener < 0)
+    {
+        return false;
+    }
+    metrics.phaseNames = std::move(phaseNames);
+    metricsStopping = false;
+    metricsThread = std::thread([] {
+        std::vector<int> sockets = { metricsListener };
+        while (!metricsStopping)
+        {
+            if (!WaitForInput(sockets, 0.25))
+            {
+                continue;
+            }
+            for (int s = AcceptSocket(metricsListener); s >= 0; s = AcceptSocket(metricsListener))
+            {
+                ServeMetricsRequest(s);
+                CloseSocket(s);
+            }
+        }
+    });
+    TraceLog(LOG_INFO, TextFormat("METRICS: Serving on http://%s/metrics", local.c_str()));
+    return true;
+}
+
+void StopMetrics()
+{
+    if (metricsThread.joinable())
+    {
+        metricsStopping = true;
+        metricsThread.join();
+    }
+    CloseSocket(metricsListener);
+    metricsListener = -1;
+}
+
+bool MetricsRunning()
+{
+    return metricsListener >= 0;
+}
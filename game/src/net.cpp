@@ -0,0 +1,528 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Stream sockets and message framing source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "net.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <string>
+
+#include "raylib.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define NET_SUPPORTED 1
+#else
+#define NET_SUPPORTED 0
+#endif
+
+#if NET_SUPPORTED
+
+#ifdef MSG_NOSIGNAL
+constexpr int sendFlags = MSG_NOSIGNAL; // A closed peer is noticed by errors instead
+#else
+constexpr int sendFlags = 0;
+#endif
+
+// Unix domain path of address, empty for TCP
+static std::string_view GetUnixPath(std::string_view address)
+{
+    return address.starts_with("unix:") ? address.substr(5) : std::string_view();
+}
+
+// Unix domain socket address of path, false if it is too long
+static bool MakeUnixAddress(std::string_view path, sockaddr_un& out)
+{
+    out = {};
+    out.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(out.sun_path))
+    {
+        TraceLog(LOG_ERROR, TextFormat("NET: Invalid Unix socket path \"%s\"", std::string(path).c_str()));
+        return false;
+    }
+    std::memcpy(out.sun_path, path.data(), path.size());
+    return true;
+}
+
+// TCP addresses of "host:port", nullptr on failure
+static addrinfo* ResolveTcp(std::string_view address, bool passive)
+{
+    auto separator = address.rfind(':');
+    if (separator == std::string_view::npos)
+    {
+        TraceLog(LOG_ERROR, TextFormat("NET: Expected host:port, got \"%s\"", std::string(address).c_str()));
+        return nullptr;
+    }
+    std::string host(address.substr(0, separator));
+    std::string port(address.substr(separator + 1));
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+    addrinfo* result = nullptr;
+    int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+    if (error != 0)
+    {
+        TraceLog(LOG_ERROR, TextFormat("NET: Failed to resolve \"%s\": %s", std::string(address).c_str(), gai_strerror(error)));
+        return nullptr;
+    }
+    return result;
+}
+
+static void SetNonBlocking(int socket)
+{
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Small messages go out right away instead of waiting to be coalesced
+static void SetNoDelay(int socket)
+{
+    int one = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int ListenSocket(std::string_view address)
+{
+    if (auto path = GetUnixPath(address); !path.empty())
+    {
+        sockaddr_un local;
+        if (!MakeUnixAddress(path, local))
+        {
+            return -1;
+        }
+
+        int s = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(local.sun_path); // Left over from an earlier run
+        if (s < 0 || bind(s, (sockaddr*)&local, sizeof(local)) != 0 || listen(s, 64) != 0)
+        {
+            TraceLog(LOG_ERROR, TextFormat("NET: Failed to listen on %s: %s", std::string(address).c_str(), std::strerror(errno)));
+            if (s >= 0) close(s);
+            return -1;
+        }
+        SetNonBlocking(s);
+        return s;
+    }
+
+    addrinfo* addresses = ResolveTcp(address, true);
+    int s = -1;
+    for (auto a = addresses; a && s < 0; a = a->ai_next)
+    {
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s < 0)
+        {
+            continue;
+        }
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(s, a->ai_addr, a->ai_addrlen) != 0 || listen(s, 64) != 0)
+        {
+            close(s);
+            s = -1;
+        }
+    }
+    if (addresses)
+    {
+        freeaddrinfo(addresses);
+    }
+    if (s < 0)
+    {
+        TraceLog(LOG_ERROR, TextFormat("NET: Failed to listen on %s: %s", std::string(address).c_str(), std::strerror(errno)));
+        return -1;
+    }
+    SetNonBlocking(s);
+    return s;
+}
+
+int ConnectSocket(std::string_view address)
+{
+    if (auto path = GetUnixPath(address); !path.empty())
+    {
+        sockaddr_un remote;
+        if (!MakeUnixAddress(path, remote))
+        {
+            return -1;
+        }
+
+        int s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0 || connect(s, (sockaddr*)&remote, sizeof(remote)) != 0)
+        {
+            TraceLog(LOG_ERROR, TextFormat("NET: Failed to connect to %s: %s", std::string(address).c_str(), std::strerror(errno)));
+            if (s >= 0) close(s);
+            return -1;
+        }
+        return s;
+    }
+
+    addrinfo* addresses = ResolveTcp(address, false);
+    int s = -1;
+    for (auto a = addresses; a && s < 0; a = a->ai_next)
+    {
+        s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s >= 0 && connect(s, a->ai_addr, a->ai_addrlen) != 0)
+        {
+            close(s);
+            s = -1;
+        }
+    }
+    if (addresses)
+    {
+        freeaddrinfo(addresses);
+    }
+    if (s < 0)
+    {
+        TraceLog(LOG_ERROR, TextFormat("NET: Failed to connect to %s: %s", std::string(address).c_str(), std::strerror(errno)));
+        return -1;
+    }
+    SetNoDelay(s);
+    return s;
+}
+
+int AcceptSocket(int listener)
+{
+    int s = accept(listener, nullptr, nullptr);
+    if (s >= 0)
+    {
+        SetNoDelay(s); // Fails harmlessly on Unix domain sockets
+    }
+    return s;
+}
+
+void CloseSocket(int socket)
+{
+    if (socket >= 0)
+    {
+        close(socket);
+    }
+}
+
+bool WaitForInput(const std::vector<int>& sockets, double timeout)
+{
+    std::vector<pollfd> descriptors;
+    for (int s : sockets)
+    {
+        descriptors.push_back({ s, POLLIN, 0 });
+    }
+    return poll(descriptors.data(), descriptors.size(), timeout < 0.0 ? -1 : (int)(timeout * 1000.0)) > 0;
+}
+
+long ReadSocket(int socket, void* buffer, std::size_t size, double timeout)
+{
+    std::vector<int> sockets = { socket };
+    if (!WaitForInput(sockets, timeout))
+    {
+        return -1;
+    }
+    return (long)recv(socket, buffer, size, 0);
+}
+
+bool WriteSocket(int socket, const void* data, std::size_t size)
+{
+    auto bytes = (const unsigned char*)data;
+    while (size > 0)
+    {
+        ssize_t sent = send(socket, bytes, size, sendFlags);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        bytes += sent;
+        size -= (std::size_t)sent;
+    }
+    return true;
+}
+
+void Connection::Open(int connected)
+{
+    Close();
+    socket = connected;
+    closed = socket < 0;
+    if (!closed)
+    {
+        SetNonBlocking(socket);
+    }
+}
+
+void Connection::Close()
+{
+    CloseSocket(socket);
+    socket = -1;
+    closed = true;
+    input.clear();
+    output.clear();
+    outputSent = 0;
+}
+
+void Connection::Send(std::uint32_t type, const MessageWriter& payload)
+{
+    Send(type, payload.data.data(), payload.data.size());
+}
+
+void Connection::Send(std::uint32_t type, const void* payload, std::size_t size)
+{
+    if (closed)
+    {
+        return;
+    }
+
+    MessageHeader header = { type, (std::uint32_t)size };
+    auto bytes = (const unsigned char*)&header;
+    output.insert(output.end(), bytes, bytes + sizeof(header));
+    output.insert(output.end(), (const unsigned char*)payload, (const unsigned char*)payload + size);
+    Flush();
+}
+
+void Connection::Flush()
+{
+    while (!closed && outputSent < output.size())
+    {
+        ssize_t sent = send(socket, output.data() + outputSent, output.size() - outputSent, sendFlags);
+        if (sent < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                closed = true;
+            }
+            break;
+        }
+        outputSent += (std::size_t)sent;
+    }
+
+    // Compact once the sent part dominates
+    if (outputSent == output.size())
+    {
+        output.clear();
+        outputSent = 0;
+    }
+    else if (outputSent > output.size() / 2)
+    {
+        output.erase(output.begin(), output.begin() + outputSent);
+        outputSent = 0;
+    }
+}
+
+bool Connection::Receive(MessageHeader& header, std::vector<unsigned char>& payload)
+{
+    Flush();
+
+    auto complete = [&]() {
+        if (input.size() < sizeof(MessageHeader))
+        {
+            return false;
+        }
+        std::memcpy(&header, input.data(), sizeof(header));
+        return input.size() - sizeof(header) >= header.size;
+    };
+
+    unsigned char buffer[65536];
+    while (!closed && !complete())
+    {
+        ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            break;
+        }
+        if (received <= 0)
+        {
+            closed = true;
+            break;
+        }
+        input.insert(input.end(), buffer, buffer + received);
+    }
+
+    if (!complete())
+    {
+        if (input.size() >= sizeof(MessageHeader) && header.size > maxMessageSize)
+        {
+            TraceLog(LOG_WARNING, TextFormat("NET: Message of %u bytes is too large, closing connection", header.size));
+            closed = true;
+        }
+        return false;
+    }
+
+    payload.assign(input.begin() + sizeof(header), input.begin() + sizeof(header) + header.size);
+    input.erase(input.begin(), input.begin() + sizeof(header) + header.size);
+    return true;
+}
+
+bool Connection::Wait(MessageHeader& header, std::vector<unsigned char>& payload, double timeout)
+{
+    while (!closed)
+    {
+        if (Receive(header, payload))
+        {
+            return true;
+        }
+        if (closed)
+        {
+            break;
+        }
+
+        // Wait for input, or for room to send what is queued
+        pollfd descriptor = { socket, (short)(POLLIN | (Pending() > 0 ? POLLOUT : 0)), 0 };
+        int milliseconds = timeout < 0.0 ? -1 : (int)(timeout * 1000.0);
+        int ready = poll(&descriptor, 1, milliseconds);
+        if (ready == 0)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+#else
+
+int ListenSocket(std::string_view)
+{
+    TraceLog(LOG_ERROR, "NET: Sockets are not supported on this platform");
+    return -1;
+}
+
+int ConnectSocket(std::string_view)
+{
+    TraceLog(LOG_ERROR, "NET: Sockets are not supported on this platform");
+    return -1;
+}
+
+int AcceptSocket(int)
+{
+    return -1;
+}
+
+void CloseSocket(int)
+{
+}
+
+bool WaitForInput(const std::vector<int>&, double)
+{
+    return false;
+}
+
+long ReadSocket(int, void*, std::size_t, double)
+{
+    return -1;
+}
+
+bool WriteSocket(int, const void*, std::size_t)
+{
+    return false;
+}
+
+void Connection::Open(int)
+{
+    closed = true;
+}
+
+void Connection::Close()
+{
+    closed = true;
+}
+
+void Connection::Send(std::uint32_t, const MessageWriter&)
+{
+}
+
+void Connection::Send(std::uint32_t, const void*, std::size_t)
+{
+}
+
+void Connection::Flush()
+{
+}
+
+bool Connection::Receive(MessageHeader&, std::vector<unsigned char>&)
+{
+    return false;
+}
+
+bool Connection::Wait(MessageHeader&, std::vector<unsigned char>&, double)
+{
+    return false;
+}
+
+#endif
+
+void WriteDivergence(MessageWriter& message, const DistanceMoments& moments, const QuantileSketch& sketch)
+{
+    message.Put<std::uint64_t>(moments.count);
+    message.Put(moments.mean);
+    message.Put(moments.m2);
+    message.Put(moments.max);
+
+    // Buckets as deltas from the previous one
+    std::size_t buckets = std::count_if(sketch.counts.begin(), sketch.counts.end(), [](auto count) { return count != 0; });
+    message.PutVarint(buckets);
+    std::size_t previous = 0;
+    for (std::size_t b = 0; b < QuantileSketch::bucketCount; b++)
+    {
+        if (sketch.counts[b] != 0)
+        {
+            message.PutVarint(b - previous);
+            message.PutVarint(sketch.counts[b]);
+            previous = b;
+        }
+    }
+}
+
+bool ReadDivergence(MessageReader& reader, DistanceMoments& moments, QuantileSketch& sketch)
+{
+    moments = DistanceMoments();
+    moments.count = reader.Get<std::uint64_t>();
+    moments.mean = reader.Get<double>();
+    moments.m2 = reader.Get<double>();
+    moments.max = reader.Get<double>();
+
+    sketch.Clear();
+    std::size_t bucket = 0;
+    for (std::uint64_t b = reader.GetVarint(); b > 0 && reader.ok; b--)
+    {
+        bucket += reader.GetVarint();
+        std::uint32_t count = (std::uint32_t)reader.GetVarint();
+        if (bucket >= QuantileSketch::bucketCount)
+        {
+            return false;
+        }
+        sketch.counts[bucket] = count;
+        sketch.total += count;
+    }
+    return reader.ok;
+}
@@ -29,13 +29,110 @@
  */
 
 #include "pendulum.hpp"
+#include "kernels.hpp"
+#include "plugins.hpp"
+#include "stats.hpp"
+#include "workers.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <ranges>
 #include <string>
 #include <regex>
 
 SimulationSettings settings;
 std::vector<JoinedPendulum> pendulums;
+std::uint64_t simulationStep = 0;
+
+// BlockDivergence, neighbor distances within a kernel block of the last step,
+// and the end points to measure the pairs across block boundaries
+struct BlockDivergence {
+    BlockDistances distances = {};
+    std::size_t pairs = 0;
+    bool measured = false; // Stepped since (re)initialized
+    Vector2Double first;
+    Vector2Double last;
+    std::size_t implicitSplits = 0; // Steps halved in the last step
+};
+
+static std::vector<BlockDivergence> blockDivergence; // Per kernel block
+static std::vector<QuantileSketch> threadSketches;   // Per worker thread
+
+// KernelSpan, kernel block over memberOrder[begin, end), all with links links
+struct KernelSpan {
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    std::size_t links = 0;
+    std::size_t parameters = 0; // Offset of its cached parameters
+
+    // Gravity and spread its gravity row was cached for, NaN until cached so
+    // any settings differ
+    double gravity = std::numeric_limits<double>::quiet_NaN();
+    double gravitySpread = std::numeric_limits<double>::quiet_NaN();
+};
+
+static std::vector<std::size_t> linkCounts;  // Link count mix, cycled over members
+static std::vector<std::size_t> memberOrder; // Members bucketed by link count
+static std::vector<std::size_t> memberBlock; // Kernel block of each member
+static std::vector<KernelSpan> kernelSpans;  // Kernel blocks in step order
+static bool sliced = false;                  // Only some pendulums of the ensemble simulated here
+static std::size_t sliceFirst = 0;
+static std::size_t sliceCount = 0;
+
+// Per member parameters as kernel rows, block by block (see CacheParameters)
+// Left uninitialized, so each block is first touched by its stepping worker
+static std::unique_ptr<double[]> memberParameters;
+
+// Bytes of pendulums' own links and trails, measured when they are made
+// rather than walked for every overlay frame
+static EnsembleMemory pendulumMemory = {};
+
+// Statics above of an ensemble that is not current
+struct EnsembleInternals {
+    std::vector<BlockDivergence> blockDivergence;
+    std::vector<QuantileSketch> threadSketches;
+    std::vector<std::size_t> linkCounts;
+    std::vector<std::size_t> memberOrder;
+    std::vector<std::size_t> memberBlock;
+    std::vector<KernelSpan> kernelSpans;
+    bool sliced = false;
+    std::size_t sliceFirst = 0;
+    std::size_t sliceCount = 0;
+    std::unique_ptr<double[]> memberParameters;
+    EnsembleMemory pendulumMemory = {};
+};
+
+Ensemble::Ensemble() : internals(new EnsembleInternals())
+{
+}
+
+Ensemble::Ensemble(Ensemble&& other) noexcept = default;
+Ensemble& Ensemble::operator=(Ensemble&& other) noexcept = default;
+Ensemble::~Ensemble() = default;
+
+void SwapEnsemble(Ensemble& ensemble)
+{
+    std::swap(settings, ensemble.settings);
+    std::swap(pendulums, ensemble.pendulums);
+    std::swap(simulationStep, ensemble.simulationStep);
+
+    auto& other = *ensemble.internals;
+    std::swap(blockDivergence, other.blockDivergence);
+    std::swap(threadSketches, other.threadSketches);
+    std::swap(linkCounts, other.linkCounts);
+    std::swap(memberOrder, other.memberOrder);
+    std::swap(memberBlock, other.memberBlock);
+    std::swap(kernelSpans, other.kernelSpans);
+    std::swap(sliced, other.sliced);
+    std::swap(sliceFirst, other.sliceFirst);
+    std::swap(sliceCount, other.sliceCount);
+    std::swap(memberParameters, other.memberParameters);
+    std::swap(pendulumMemory, other.pendulumMemory);
+}
 
 namespace stdr
 {
@@ -56,6 +153,11 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
     auto text = std::string(tmp);
     UnloadFileText(tmp);
 
+    return LoadSettingsText(text);
+}
+
+bool SimulationSettings::LoadSettingsText(std::string_view text)
+{
     bool needsReset = false;
 
     // Very basic parser
@@ -102,6 +204,14 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
                     gravity = newGravity;
                 }
             }
+            else if (tokens[0] == "gravitySpread")
+            {
+                auto newGravitySpread = std::stod(tokens[1]);
+                if (gravitySpread != newGravitySpread)
+                {
+                    gravitySpread = newGravitySpread;
+                }
+            }
             else if (tokens[0] == "fixedDeltaTime")
             {
                 auto newFixedDeltaTime = std::stod(tokens[1]);
@@ -110,6 +220,18 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
                     fixedDeltaTime = newFixedDeltaTime;
                 }
             }
+            else if (tokens[0] == "integrator")
+            {
+                auto newIntegrator = tokens[1];
+                if (newIntegrator != "explicit" && newIntegrator != "implicit" && newIntegrator != "chain")
+                {
+                    throw std::invalid_argument("Integrator must be explicit, implicit or chain");
+                }
+                if (integrator != newIntegrator)
+                {
+                    integrator = newIntegrator;
+                }
+            }
             else if (tokens[0] == "trajectoryAlphaPower")
             {
                 auto newTrajectoryAlphaPower = std::stod(tokens[1]);
@@ -127,6 +249,16 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
                     needsReset = true;
                 }
             }
+            else if (tokens[0] == "pendulumsJoinedMix")
+            {
+                auto newPendulumsJoinedMix = tokens[1];
+                ParseLinkCounts(newPendulumsJoinedMix);
+                if (pendulumsJoinedMix != newPendulumsJoinedMix)
+                {
+                    pendulumsJoinedMix = newPendulumsJoinedMix;
+                    needsReset = true;
+                }
+            }
             else if (tokens[0] == "joinedPendulumsCount")
             {
                 auto newJoinedPendulumsCount = std::stoul(tokens[1]);
@@ -163,6 +295,33 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
                     needsReset = true;
                 }
             }
+            else if (tokens[0] == "pendulumLengthSpread")
+            {
+                auto newPendulumLengthSpread = std::stod(tokens[1]);
+                if (pendulumLengthSpread != newPendulumLengthSpread)
+                {
+                    pendulumLengthSpread = newPendulumLengthSpread;
+                    needsReset = true;
+                }
+            }
+            else if (tokens[0] == "pendulumMassSpread")
+            {
+                auto newPendulumMassSpread = std::stod(tokens[1]);
+                if (pendulumMassSpread != newPendulumMassSpread)
+                {
+                    pendulumMassSpread = newPendulumMassSpread;
+                    needsReset = true;
+                }
+            }
+            else if (tokens[0] == "initialAngleSpread")
+            {
+                auto newInitialAngleSpread = std::stod(tokens[1]);
+                if (initialAngleSpread != newInitialAngleSpread)
+                {
+                    initialAngleSpread = newInitialAngleSpread;
+                    needsReset = true;
+                }
+            }
             else if (tokens[0] == "resetThreshold")
             {
                 auto newResetThreshold = std::stod(tokens[1]);
@@ -171,12 +330,20 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
                     resetThreshold = newResetThreshold;
                 }
             }
-            else if (tokens[0] == "resetSamples")
+            else if (tokens[0] == "resetQuantile")
             {
-                auto newResetSamples = std::stod(tokens[1]);
-                if (resetSamples != newResetSamples)
+                auto newResetQuantile = std::stod(tokens[1]);
+                if (resetQuantile != newResetQuantile)
                 {
-                    resetSamples = newResetSamples;
+                    resetQuantile = newResetQuantile;
+                }
+            }
+            else if (tokens[0] == "resetSegments")
+            {
+                auto newResetSegments = std::stoul(tokens[1]);
+                if (resetSegments != newResetSegments)
+                {
+                    resetSegments = newResetSegments;
                 }
             }
             else if (tokens[0] == "resetFadeTime")
@@ -187,6 +354,119 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
                     resetFadeTime = newResetFadeTime;
                 }
             }
+            else if (tokens[0] == "layers")
+            {
+                auto newLayers = tokens[1];
+                if (newLayers != "none" && std::ranges::any_of(newLayers | stdr::split(',') | stdr::to_vs(), [](const std::string& file) { return file.empty(); }))
+                {
+                    throw std::invalid_argument("Layers must be none or settings files separated by commas");
+                }
+                if (layers != newLayers)
+                {
+                    layers = newLayers;
+                }
+            }
+            else if (tokens[0] == "frameBudget")
+            {
+                auto newFrameBudget = std::stod(tokens[1]);
+                if (newFrameBudget < 0.0)
+                {
+                    throw std::invalid_argument("Frame budget must not be negative");
+                }
+                if (frameBudget != newFrameBudget)
+                {
+                    frameBudget = newFrameBudget;
+                }
+            }
+            else if (tokens[0] == "memoryBudget")
+            {
+                auto newMemoryBudget = std::stoul(tokens[1]);
+                if (memoryBudget != newMemoryBudget)
+                {
+                    memoryBudget = newMemoryBudget;
+                }
+            }
+            else if (tokens[0] == "kernelLevel")
+            {
+                auto newKernelLevel = tokens[1];
+                if (kernelLevel != newKernelLevel)
+                {
+                    kernelLevel = newKernelLevel;
+                }
+            }
+            else if (tokens[0] == "kernelPlugin")
+            {
+                auto newKernelPlugin = tokens[1];
+                if (kernelPlugin != newKernelPlugin)
+                {
+                    kernelPlugin = newKernelPlugin;
+                }
+            }
+            else if (tokens[0] == "workerThreads")
+            {
+                auto newWorkerThreads = std::stoul(tokens[1]);
+                if (workerThreads != newWorkerThreads)
+                {
+                    workerThreads = newWorkerThreads;
+                }
+            }
+            else if (tokens[0] == "workChunkSize")
+            {
+                auto newWorkChunkSize = std::stoul(tokens[1]);
+                if (workChunkSize != newWorkChunkSize)
+                {
+                    workChunkSize = newWorkChunkSize;
+                }
+            }
+            else if (tokens[0] == "numaAware")
+            {
+                auto newNumaAware = std::stoul(tokens[1]) != 0;
+                if (numaAware != newNumaAware)
+                {
+                    numaAware = newNumaAware;
+                }
+            }
+            else if (tokens[0] == "deterministic")
+            {
+                auto newDeterministic = std::stoul(tokens[1]) != 0;
+                if (deterministic != newDeterministic)
+                {
+                    deterministic = newDeterministic;
+                }
+            }
+            else if (tokens[0] == "autoTune")
+            {
+                auto newAutoTune = std::stoul(tokens[1]) != 0;
+                if (autoTune != newAutoTune)
+                {
+                    autoTune = newAutoTune;
+                }
+            }
+            else if (tokens[0] == "sharedMemoryName")
+            {
+                auto newSharedMemoryName = tokens[1];
+                if (newSharedMemoryName != "none" && (newSharedMemoryName.size() < 2 || newSharedMemoryName[0] != '/'
+                    || newSharedMemoryName.find('/', 1) != std::string::npos))
+                {
+                    throw std::invalid_argument("Shared memory name must be none or /name");
+                }
+                if (sharedMemoryName != newSharedMemoryName)
+                {
+                    sharedMemoryName = newSharedMemoryName;
+                }
+            }
+            else if (tokens[0] == "hitchDeadline")
+            {
+                auto newHitchDeadline = std::stod(tokens[1]);
+                if (newHitchDeadline < 0.0)
+                {
+                    throw std::invalid_argument("Hitch deadline must not be negative");
+                }
+                if (hitchDeadline != newHitchDeadline)
+                {
+                    hitchDeadline = newHitchDeadline;
+                }
+            }
         }
 
         // Probably std::invalid_argument
@@ -200,7 +480,7 @@ bool SimulationSettings::LoadSettings(std::string_view filename)
 }
 
 
-inline JoinedPendulum::JoinedPendulum(std::size_t size, std::vector<double> lengths, std::vector<double> masses, std::vector<double> initialAngles, std::size_t trajectoriesSize) : trajectories(), trajectoryIndex(0)
+JoinedPendulum::JoinedPendulum(std::size_t size, std::vector<double> lengths, std::vector<double> masses, std::vector<double> initialAngles, std::size_t trajectoriesSize) : trajectories(), trajectoryIndex(0)
 {
     // Check invalid sizes
     if (lengths.size() != size)
@@ -239,214 +519,700 @@ inline JoinedPendulum::JoinedPendulum(std::size_t size, std::vector<double> leng
     trajectories.resize(trajectoriesSize);
 }
 
-void JoinedPendulum::Update()
+void JoinedPendulum::CaptureTrajectory()
 {
-    const auto n = pendulums.size();
-
-    if (n == 0)
+    if (trajectories.empty() || pendulums.empty())
     {
         return;
     }
 
-    // Single pendulum case
-    if (n == 1)
-    {
-        auto& p = pendulums[0];
-
-        // Update angle
-        p.angularAcceleration = -settings.gravity / p.length * sin(p.angle);
-        p.angularVelocity = p.angularAcceleration * settings.fixedDeltaTime;
-        p.angle += p.angularVelocity * settings.fixedDeltaTime;
+    trajectories[trajectoryIndex] = pendulums.back().position;
+    trajectoryIndex = (trajectoryIndex + 1) % trajectories.size();
+}
 
-        // Update position
-        p.position = Vector2Double(
-            p.length * sin(p.angle),
-            p.length * cos(p.angle)
-        );
+void JoinedPendulum::DrawTrajectory(Color color, const float* fade) const
+{
+    static_assert(sizeof(Vector2Double) == 2 * sizeof(double), "Trajectory unroll kernel expects packed (x, y) doubles");
 
+    if (trajectories.empty())
+    {
         return;
     }
 
-    // Update angular acceleration
-    for (std::size_t i = 0; i < n - 1; i++)
+    // Oldest point first, converted to float once instead of per line
+    thread_local std::vector<float> points;
+    points.resize(trajectories.size() * 2);
+    activeKernels->unrollTrajectory((const double*)trajectories.data(), trajectories.size(), trajectoryIndex, points.data());
+
+    for (std::size_t i = 0; i < trajectories.size() - 1; i++)
     {
-        auto& p1 = pendulums[i];
-        auto& p2 = pendulums[i + 1];
+        Vector2 current = { points[i * 2], points[i * 2 + 1] };
+        Vector2 next = { points[i * 2 + 2], points[i * 2 + 3] };
 
-        // Who said not to use single to three letter names?
-        double a1 = p1.angle;
-        double a2 = p2.angle;
-        double m1 = p1.mass;
-        double m2 = p2.mass;
-        double l1 = p1.length;
-        double l2 = p2.length;
+        if (current.x == 0.0f || current.y == 0.0f ||
+            next.x == 0.0f || next.y == 0.0f)
+        {
+            continue;
+        }
 
-        // Sin and cos of angles
-        double sa1 = sin(a1);
-        double ca1 = cos(a1);
-        double sa2 = sin(a2);
-        double ca2 = cos(a2);
+        Color fadedColor = color;
+        fadedColor.a *= fade[i];
+        DrawLineV(current, next, fadedColor);
+    }
+}
+
+void JoinedPendulum::DrawPendulums(Color color) const
+{
+    for (std::size_t i = 0; i < pendulums.size(); i++)
+    {
+        Vector2Double prev = Vector2Double();
+        if (i != 0)
+        {
+            prev = pendulums[i - 1].position;
+        }
+
+        DrawLineV(prev, pendulums[i].position, color);
+    }
+}
 
-        // Gravity
-        double g = settings.gravity;
+// Pendulums per parallel chunk, whole kernel blocks so no block is split
+// between threads
+static std::size_t GetWorkChunkSize()
+{
+    std::size_t blocks = (settings.workChunkSize + kernelBlockSize - 1) / kernelBlockSize;
+    return std::max<std::size_t>(blocks, 1) * kernelBlockSize;
+}
 
-        // What the fuck?
-        double n1 = -g * (2.0 * m1 + m2) * sin(a1);
-        double n2 = -m2 * g * sin(a1 - 2.0 * a2);
-        double n3 = -2.0 * sin(a1 - a2) * m2;
-        double n4 = p2.angularVelocity * p2.angularVelocity * l2
-            + p1.angularVelocity * p1.angularVelocity * l1 * cos(a1 - a2);
-        double d = l1 * (2.0 * m1 + m2 - m2 * cos(2.0 * a1 - 2.0 * a2));
-        p1.angularAcceleration = (n1 + n2 + n3 * n4) / d;
+std::vector<std::size_t> ParseLinkCounts(std::string_view text)
+{
+    if (text == "none")
+    {
+        return { settings.pendulumsJoined };
+    }
 
-        // Again?
-        n1 = 2.0 * sin(a1 - a2);
-        n2 = p1.angularVelocity * p1.angularVelocity * l1 * (m1 + m2);
-        n3 = g * (m1 + m2) * cos(a1);
-        n4 = p2.angularVelocity * p2.angularVelocity * l2 * m2 * cos(a1 - a2);
-        d = l2 * (2.0 * m1 + m2 - m2 * cos(2.0 * a1 - 2.0 * a2));
-        p2.angularAcceleration = (n1 * (n2 + n3 + n4)) / d;
+    std::vector<std::size_t> counts;
+    for (auto part : text | stdr::split(',') | stdr::to_vs())
+    {
+        auto count = std::stoul(part);
+        if (count == 0)
+        {
+            throw std::invalid_argument("Pendulums joined must be at least 1");
+        }
+        counts.push_back(count);
     }
 
-    // Update angle and position
-    for (std::size_t i = 0; i < n; i++)
+    if (counts.empty())
     {
-        auto& p = pendulums[i];
+        throw std::invalid_argument("No pendulums joined counts");
+    }
+    return counts;
+}
+
+// Links of pendulum i of the ensemble, cycling through the mix so every
+// count spans all colors
+static std::size_t GetLinkCount(std::size_t i)
+{
+    return linkCounts[i % linkCounts.size()];
+}
+
+// Pendulums simulated here, the whole ensemble unless sliced
+static std::size_t GetSliceCount()
+{
+    const std::size_t count = settings.joinedPendulumsCount;
+    return sliced ? std::min(sliceCount, count - std::min(sliceFirst, count)) : count;
+}
+
+void SetEnsembleSlice(std::size_t first, std::size_t count)
+{
+    sliced = true;
+    sliceFirst = first;
+    sliceCount = count;
+}
+
+std::size_t GetEnsembleSliceFirst()
+{
+    return sliceFirst;
+}
 
-        p.angularVelocity += p.angularAcceleration * settings.fixedDeltaTime;
-        p.angle += p.angularVelocity * settings.fixedDeltaTime;
+// Bucket count members by their links(member) link count, in display order
+// within a bucket, and split each bucket into kernel blocks, so no block
+// mixes link counts
+template<typename LinkCount>
+static void BuildSchedule(std::size_t count, LinkCount links)
+{
+    memberOrder.resize(count);
+    std::iota(memberOrder.begin(), memberOrder.end(), 0);
+    std::stable_sort(memberOrder.begin(), memberOrder.end(), [&](std::size_t a, std::size_t b) {
+        return links(a) < links(b);
+    });
 
-        // First pendulum anchored at center
-        if (i == 0)
+    kernelSpans.clear();
+    memberBlock.resize(count);
+    std::size_t parameters = 0;
+    for (std::size_t k = 0; k < count; k++)
+    {
+        std::size_t memberLinks = links(memberOrder[k]);
+        if (kernelSpans.empty() || kernelSpans.back().links != memberLinks || kernelSpans.back().end - kernelSpans.back().begin == kernelBlockSize)
         {
-            p.position = Vector2Double(
-                p.length * sin(p.angle),
-                p.length * cos(p.angle)
-            );
+            kernelSpans.push_back({ k, k, memberLinks, parameters });
+            parameters += (memberLinks * 4 + 1) * kernelBlockSize;
         }
-        else
+        kernelSpans.back().end = k + 1;
+        memberBlock[memberOrder[k]] = kernelSpans.size() - 1;
+    }
+    memberParameters.reset(new double[parameters]);
+}
+
+// Value of pendulum i fanned out over display order, base at the middle one
+static double SpreadValue(double base, double spread, std::size_t i)
+{
+    const std::size_t count = settings.joinedPendulumsCount;
+    double t = count > 1 ? (double)i / (count - 1) - 0.5 : 0.0;
+    return base * (1.0 + spread * t);
+}
+
+// Cache gravity row of a kernel block for current settings
+static void CacheGravity(std::size_t index)
+{
+    constexpr std::size_t w = kernelBlockSize;
+    auto& span = kernelSpans[index];
+    const std::size_t members = span.end - span.begin;
+    double* gravity = memberParameters.get() + span.parameters + span.links * w * 4;
+
+    for (std::size_t m = 0; m < w; m++)
+    {
+        gravity[m] = SpreadValue(settings.gravity, settings.gravitySpread, sliceFirst + memberOrder[span.begin + std::min(m, members - 1)]);
+    }
+    span.gravity = settings.gravity;
+    span.gravitySpread = settings.gravitySpread;
+}
+
+// Cache kernel rows of a kernel block's parameters, so stepping loads them
+// contiguously instead of gathering and dividing them every step
+// Rows are length, 1 / length, mass and mass plus next link's mass for each
+// link, then gravity, a partial block is padded with its last pendulum
+static void CacheParameters(std::size_t index)
+{
+    constexpr std::size_t w = kernelBlockSize;
+    const auto& span = kernelSpans[index];
+    const std::size_t links = span.links;
+    const std::size_t members = span.end - span.begin;
+    double* length = memberParameters.get() + span.parameters;
+    double* inverseLength = length + links * w;
+    double* mass = inverseLength + links * w;
+    double* massSum = mass + links * w;
+
+    for (std::size_t m = 0; m < w; m++)
+    {
+        const auto& jp = pendulums[memberOrder[span.begin + std::min(m, members - 1)]];
+        for (std::size_t k = 0; k < links; k++)
         {
-            // Previous pendulum
-            auto& pp = pendulums[i - 1];
-            p.position = Vector2Double(
-                pp.position.x + p.length * sin(p.angle),
-                pp.position.y + p.length * cos(p.angle)
-            );
+            const auto& p = jp.pendulums[k];
+            length[k * w + m] = p.length;
+            inverseLength[k * w + m] = 1.0 / p.length;
+            mass[k * w + m] = p.mass;
+            massSum[k * w + m] = p.mass + (k + 1 < links ? jp.pendulums[k + 1].mass : 0.0);
         }
     }
+    CacheGravity(index);
+}
 
-    // Capture last pendulum position as trajectory
-    trajectories[trajectoryIndex] = pendulums[n - 1].position;
-    trajectoryIndex = (trajectoryIndex + 1) % trajectories.size();
+// Initial state of pendulum i simulated here, spread by its index in the
+// ensemble and varied by reset count
+static JoinedPendulum MakePendulum(std::size_t local, int resets)
+{
+    const std::size_t i = sliceFirst + local;
+    const std::size_t links = GetLinkCount(i);
+    std::vector lengths(links, SpreadValue(settings.pendulumLength, settings.pendulumLengthSpread, i));
+    std::vector masses(links, SpreadValue(settings.pendulumMass, settings.pendulumMassSpread, i));
+    std::vector initialAngles(links, (double)PI);
+    initialAngles[0] = PI + 0.125 + (double)i / settings.joinedPendulumsCount * settings.initialAngleSpread;
+    initialAngles[0] += std::fmod(resets * 0.5 + PI / 8.0, (double)PI / 4) - PI / 8.0;
+    return JoinedPendulum(links, lengths, masses, initialAngles, settings.trajectoryPoints);
 }
 
-void JoinedPendulum::DrawTrajectory(Color color) const
+// Walk pendulums for the memory of their links and trails
+static void MeasurePendulumMemory()
 {
-    if (trajectories.empty())
+    pendulumMemory = {};
+    for (const auto& jp : pendulums)
     {
-        return;
+        pendulumMemory.state += jp.pendulums.capacity() * sizeof(Pendulum);
+        pendulumMemory.trails += jp.trajectories.capacity() * sizeof(Vector2Double);
     }
+}
 
-    for (std::size_t i = 0; i < trajectories.size() - 1; i++)
+void InitializePendulums(int resets)
+{
+    pendulums.clear();
+    simulationStep = 0;
+    blockDivergence.clear();
+    threadSketches.clear();
+    linkCounts = ParseLinkCounts(settings.pendulumsJoinedMix);
+    BuildSchedule(GetSliceCount(), [](std::size_t local) { return GetLinkCount(sliceFirst + local); });
+
+    // Each pendulum is constructed by the worker that steps it later, so its
+    // memory is first touched (and placed) on that worker's NUMA node
+    pendulums.resize(GetSliceCount());
+    workers.ParallelFor(kernelSpans.size(), GetWorkChunkSize() / kernelBlockSize, [resets](std::size_t first, std::size_t last) {
+        for (std::size_t b = first; b < last; b++)
+        {
+            for (std::size_t k = kernelSpans[b].begin; k < kernelSpans[b].end; k++)
+            {
+                pendulums[memberOrder[k]] = MakePendulum(memberOrder[k], resets);
+            }
+            CacheParameters(b);
+        }
+    });
+    MeasurePendulumMemory();
+}
+
+void LoadPendulums(std::vector<JoinedPendulum> loaded)
+{
+    pendulums = std::move(loaded);
+    simulationStep = 0;
+    blockDivergence.clear();
+    threadSketches.clear();
+    BuildSchedule(pendulums.size(), [](std::size_t i) { return pendulums[i].pendulums.size(); });
+
+    workers.ParallelFor(kernelSpans.size(), GetWorkChunkSize() / kernelBlockSize, [](std::size_t first, std::size_t last) {
+        for (std::size_t b = first; b < last; b++)
+        {
+            CacheParameters(b);
+        }
+    });
+    MeasurePendulumMemory();
+}
+
+// Kernel blocks per reset segment
+static std::size_t GetSegmentBlocks()
+{
+    std::size_t blocks = kernelSpans.size();
+    std::size_t segments = std::clamp<std::size_t>(settings.resetSegments, 1, std::max<std::size_t>(blocks, 1));
+    return std::max<std::size_t>((blocks + segments - 1) / segments, 1);
+}
+
+std::size_t GetSegmentCount()
+{
+    return (kernelSpans.size() + GetSegmentBlocks() - 1) / GetSegmentBlocks();
+}
+
+void InitializeSegment(std::size_t segment, int resets)
+{
+    const std::size_t size = GetSegmentBlocks();
+    const std::size_t first = segment * size;
+    const std::size_t last = std::min(first + size, kernelSpans.size());
+
+    // Overwrite in place, so memory stays where the stepping worker placed it
+    for (std::size_t b = first; b < last; b++)
     {
-        auto& current = trajectories[(trajectoryIndex + i) % trajectories.size()];
-        auto& next = trajectories[(trajectoryIndex + i + 1) % trajectories.size()];
+        for (std::size_t k = kernelSpans[b].begin; k < kernelSpans[b].end; k++)
+        {
+            auto fresh = MakePendulum(memberOrder[k], resets);
+            auto& jp = pendulums[memberOrder[k]];
+            std::copy(fresh.pendulums.begin(), fresh.pendulums.end(), jp.pendulums.begin());
+            std::fill(jp.trajectories.begin(), jp.trajectories.end(), Vector2Double());
+            jp.trajectoryIndex = 0;
+        }
 
-        if (current.x == 0.0 || current.y == 0.0 ||
-            next.x == 0.0 || next.y == 0.0)
+        // Old distances no longer apply
+        if (b < blockDivergence.size())
         {
-            continue;
+            blockDivergence[b] = BlockDivergence();
         }
+    }
+}
 
-        double alpha = std::pow((double)(i + 1) / trajectories.size(), settings.trajectoryAlphaPower);
-        if (alpha > 1.0) alpha = 1.0;
-        if (alpha < 0.0) alpha = 0.0;
-        Color fadedColor = color;
-        fadedColor.a *= alpha;
-        DrawLineV(current, next, fadedColor);
+// Step a block with a kernel plugin, then measure the distances the built in
+// kernels measure while stepping, summed in the same order
+static void StepPluginBlock(const HdpKernelPlugin& plugin, const KernelBlock& block)
+{
+    constexpr std::size_t w = kernelBlockSize;
+    const HdpPluginBlock view = {
+        block.links, block.members, w,
+        block.angle, block.angularVelocity, block.angularAcceleration,
+        block.length, block.mass, block.gravity,
+        block.positionX, block.positionY
+    };
+    plugin.step(&view, 1, block.deltaTime);
+    plugin.positions(&view);
+
+    const double* x = block.positionX + (block.links - 1) * w;
+    const double* y = block.positionY + (block.links - 1) * w;
+    const std::size_t pairs = block.members > 1 ? block.members - 1 : 0;
+    double sum = 0.0;
+    double max = 0.0;
+    for (std::size_t m = 0; m < pairs; m++)
+    {
+        double dx = x[m + 1] - x[m];
+        double dy = y[m + 1] - y[m];
+        block.distance[m] = std::sqrt(dx * dx + dy * dy);
+        sum += block.distance[m];
+        max = std::max(max, block.distance[m]);
     }
+
+    double mean = pairs > 0 ? sum / pairs : 0.0;
+    double m2 = 0.0;
+    for (std::size_t m = 0; m < pairs; m++)
+    {
+        m2 += (block.distance[m] - mean) * (block.distance[m] - mean);
+    }
+    *block.distances = { sum, m2, max };
 }
 
-void JoinedPendulum::DrawPendulums(Color color) const
+// Step a kernel block with the active kernels, or the kernel plugin
+static void UpdatePendulumBlock(std::size_t index)
 {
-    for (std::size_t i = 0; i < pendulums.size(); i++)
+    constexpr std::size_t w = kernelBlockSize;
+    auto& span = kernelSpans[index];
+    const std::size_t links = span.links;
+    const std::size_t members = span.end - span.begin;
+    const std::size_t* order = memberOrder.data() + span.begin;
+
+    // Structure of arrays scratch, reused across frames
+    const bool implicit = settings.integrator == "implicit";
+    const bool chain = settings.integrator == "chain";
+    thread_local std::vector<double> scratch;
+    scratch.resize(links * w * 5 + w + (implicit || chain ? GetWorkspaceSize(links) : 0));
+
+    auto& divergence = blockDivergence[index];
+
+    // Gravity may change live, lengths and masses only with a reset
+    if (span.gravity != settings.gravity || span.gravitySpread != settings.gravitySpread)
     {
-        Vector2Double prev = Vector2Double();
-        if (i != 0)
+        CacheGravity(index);
+    }
+    const double* parameters = memberParameters.get() + span.parameters;
+
+    KernelBlock block = {};
+    block.links = links;
+    block.members = members;
+    block.angle = scratch.data();
+    block.angularVelocity = block.angle + links * w;
+    block.angularAcceleration = block.angularVelocity + links * w;
+    block.positionX = block.angularAcceleration + links * w;
+    block.positionY = block.positionX + links * w;
+    block.distance = block.positionY + links * w;
+    block.distances = &divergence.distances;
+    block.workspace = block.distance + w;
+    divergence.implicitSplits = 0;
+    block.implicitSplits = &divergence.implicitSplits;
+    block.length = parameters;
+    block.inverseLength = block.length + links * w;
+    block.mass = block.inverseLength + links * w;
+    block.massSum = block.mass + links * w;
+    block.gravity = block.massSum + links * w;
+    block.deltaTime = settings.fixedDeltaTime;
+
+    // Gather, a partial block is padded with copies of its last pendulum
+    for (std::size_t m = 0; m < w; m++)
+    {
+        auto& jp = pendulums[order[std::min(m, members - 1)]];
+        for (std::size_t k = 0; k < links; k++)
         {
-            prev = pendulums[i - 1].position;
+            auto& p = jp.pendulums[k];
+            block.angle[k * w + m] = p.angle;
+            block.angularVelocity[k * w + m] = p.angularVelocity;
+            block.angularAcceleration[k * w + m] = p.angularAcceleration;
         }
+    }
 
-        DrawLineV(prev, pendulums[i].position, color);
+    // Plugins are loaded and unloaded between frames only
+    if (activeKernelPlugin)
+    {
+        StepPluginBlock(*activeKernelPlugin, block);
+    }
+    else if (implicit)
+    {
+        activeKernels->stepBlockImplicit(block);
+    }
+    else if (chain)
+    {
+        activeKernels->stepBlockChain(block);
+    }
+    else
+    {
+        activeKernels->stepBlock(block);
+    }
+
+    // Scatter
+    for (std::size_t m = 0; m < members; m++)
+    {
+        auto& jp = pendulums[order[m]];
+        for (std::size_t k = 0; k < links; k++)
+        {
+            auto& p = jp.pendulums[k];
+            p.angle = block.angle[k * w + m];
+            p.angularVelocity = block.angularVelocity[k * w + m];
+            p.angularAcceleration = block.angularAcceleration[k * w + m];
+            p.position = Vector2Double(block.positionX[k * w + m], block.positionY[k * w + m]);
+        }
+        jp.CaptureTrajectory();
+    }
+
+    // Distances are still in cache, bin them into this thread's sketch
+    const std::size_t last = (links - 1) * w;
+    divergence.pairs = members - 1;
+    divergence.measured = true;
+    divergence.first = Vector2Double(block.positionX[last], block.positionY[last]);
+    divergence.last = Vector2Double(block.positionX[last + members - 1], block.positionY[last + members - 1]);
+
+    auto& sketch = threadSketches[WorkerPool::ThreadIndex()];
+    for (std::size_t m = 0; m < divergence.pairs; m++)
+    {
+        sketch.Add(block.distance[m]);
     }
 }
 
-void InitializePendulums(int resets)
+// Step kernel blocks [first, last)
+static void UpdatePendulumRange(std::size_t first, std::size_t last)
 {
-    pendulums.clear();
-
-    pendulums.resize(settings.joinedPendulumsCount);
-    for (std::size_t i = 0; i < pendulums.size(); i++)
+    for (std::size_t b = first; b < last; b++)
     {
-        std::vector lengths(settings.pendulumsJoined, settings.pendulumLength);
-        std::vector masses(settings.pendulumsJoined, settings.pendulumMass);
-        std::vector initialAngles(settings.pendulumsJoined, (double)PI);
-        initialAngles[0] = PI + 0.125 + (double)i / pendulums.size() * 0.0001;
-        initialAngles[0] += std::fmod(resets * 0.5 + PI / 8.0, (double)PI / 4) - PI / 8.0;
-        pendulums[i] = JoinedPendulum(settings.pendulumsJoined, lengths, masses, initialAngles, settings.trajectoryPoints);
+        UpdatePendulumBlock(b);
     }
 }
 
 void UpdatePendulums()
 {
-    for (auto& p : pendulums)
+    blockDivergence.resize(kernelSpans.size());
+    threadSketches.resize(workers.Size());
+    for (auto& sketch : threadSketches)
     {
-        p.Update();
+        sketch.Clear();
     }
+
+    // Same chunks as InitializePendulums, each thread steps what it allocated
+    workers.ParallelFor(kernelSpans.size(), GetWorkChunkSize() / kernelBlockSize, UpdatePendulumRange);
+    simulationStep++;
 }
 
-void DrawPendulumTrajectories(float alpha, bool debug)
+// Draw every stride-th pendulum of drawn with the settings it was made with,
+// each faded by alphaOf(pendulum)
+template<typename AlphaOf>
+static void DrawTrajectories(const std::vector<JoinedPendulum>& drawn, const SimulationSettings& drawnSettings, bool debug, std::size_t stride, AlphaOf alphaOf)
 {
+    stride = std::max<std::size_t>(stride, 1);
+
+    // Fade along the trajectory is the same for every pendulum
+    static std::vector<float> fade;
+    fade.resize(drawn.empty() ? 0 : drawn.front().trajectories.size());
+    for (std::size_t i = 0; i < fade.size(); i++)
+    {
+        double a = std::pow((double)(i + 1) / fade.size(), drawnSettings.trajectoryAlphaPower);
+        if (a > 1.0) a = 1.0;
+        if (a < 0.0) a = 0.0;
+        fade[i] = (float)a;
+    }
+
     if (debug)
     {
-        for (std::size_t i = 0; i < pendulums.size(); i++)
+        for (std::size_t i = 0; i < drawn.size(); i += stride)
         {
-            Color color = ColorFromHSV(i * 360.0f / pendulums.size() + GetTime() * 5.0f, settings.pendulumColorSaturation, settings.pendulumColorValue);
-            if (alpha > 1.0) alpha = 1.0;
-            if (alpha < 0.0) alpha = 0.0;
-            color.a = (unsigned char)(alpha * 255);
+            Color color = ColorFromHSV(i * 360.0f / drawn.size() + GetTime() * 5.0f, drawnSettings.pendulumColorSaturation, drawnSettings.pendulumColorValue);
+            color.a = (unsigned char)(alphaOf(i) * 255);
             Color debugColor = color;
             debugColor.r *= 0.75f;
             debugColor.g *= 0.75f;
             debugColor.b *= 0.75f;
-            pendulums[i].DrawPendulums(debugColor);
+            drawn[i].DrawPendulums(debugColor);
         }
     }
-    for (std::size_t i = 0; i < pendulums.size(); i++)
+    for (std::size_t i = 0; i < drawn.size(); i += stride)
     {
-        Color color = ColorFromHSV(i * 360.0f / pendulums.size() + GetTime() * 5.0f, settings.pendulumColorSaturation, settings.pendulumColorValue);
-        if (alpha > 1.0) alpha = 1.0;
-        if (alpha < 0.0) alpha = 0.0;
-        color.a = (unsigned char)(alpha * 255);
-        pendulums[i].DrawTrajectory(color);
+        Color color = ColorFromHSV(i * 360.0f / drawn.size() + GetTime() * 5.0f, drawnSettings.pendulumColorSaturation, drawnSettings.pendulumColorValue);
+        color.a = (unsigned char)(alphaOf(i) * 255);
+        drawn[i].DrawTrajectory(color, fade.data());
     }
 }
 
-double GetDivergence()
+void DrawPendulumTrajectories(float alpha, bool debug, const std::vector<float>& segmentAlpha, std::size_t stride)
 {
-    if (pendulums.empty()) return 0.0;
+    // Alpha of pendulum i, faded along with its segment
+    const std::size_t segmentBlocks = GetSegmentBlocks();
+    DrawTrajectories(pendulums, settings, debug, stride, [&](std::size_t i) {
+        std::size_t segment = i < memberBlock.size() ? memberBlock[i] / segmentBlocks : 0;
+        float a = alpha * (segment < segmentAlpha.size() ? segmentAlpha[segment] : 1.0f);
+        return std::clamp(a, 0.0f, 1.0f);
+    });
+}
 
-    double divergence = 0.0;
-    for (std::size_t s = 0; s < settings.resetSamples; s++)
+void DrawEnsembleTrajectories(const Ensemble& ensemble, float alpha, bool debug, std::size_t stride)
+{
+    DrawTrajectories(ensemble.pendulums, ensemble.settings, debug, stride, [alpha](std::size_t) {
+        return std::clamp(alpha, 0.0f, 1.0f);
+    });
+}
+
+DivergenceStats GetDivergence()
+{
+    DivergenceStats stats;
+    const std::size_t blocksPerSegment = GetSegmentBlocks();
+    stats.segments.resize(GetSegmentCount());
+
+    // Blocks in order, each after the pair across its boundary, so moments
+    // are the same for any thread count and chunk size
+    for (std::size_t b = 0; b < blockDivergence.size(); b++)
     {
-        std::size_t i = std::floor((float)s * pendulums.size() / (settings.resetSamples + 1));
+        auto& block = blockDivergence[b];
+        if (!block.measured)
+        {
+            continue;
+        }
+
+        auto& segment = stats.segments[b / blocksPerSegment];
+        // Neighbors only within a bucket, other link counts never line up
+        if (b != 0 && blockDivergence[b - 1].measured && kernelSpans[b - 1].links == kernelSpans[b].links)
+        {
+            auto& previous = blockDivergence[b - 1];
+            Vector2Double l = Vector2Double(block.first.x - previous.last.x, block.first.y - previous.last.y);
+            double distance = std::sqrt(l.x * l.x + l.y * l.y);
+            stats.Add(distance);
+            if (b % blocksPerSegment != 0)
+            {
+                segment.Add(distance);
+            }
+        }
 
-        auto p1 = pendulums[i].pendulums.back().position;
-        auto p2 = pendulums[i + 1].pendulums.back().position;
+        double mean = block.pairs > 0 ? block.distances.sum / block.pairs : 0.0;
+        stats.Merge(block.pairs, mean, block.distances.m2, block.distances.max);
+        segment.Merge(block.pairs, mean, block.distances.m2, block.distances.max);
+    }
+
+    // Counts add up the same in any order
+    for (auto& sketch : threadSketches)
+    {
+        stats.sketch.Merge(sketch);
+    }
+    return stats;
+}
 
-        Vector2Double l = Vector2Double(p1.x - p2.x, p1.y - p2.y);
-        divergence += std::sqrt(l.x * l.x + l.y * l.y);
+std::size_t GetImplicitSplits()
+{
+    std::size_t splits = 0;
+    for (const auto& block : blockDivergence)
+    {
+        splits += block.implicitSplits;
     }
+    return splits;
+}
+
+// Mix bits of a 64 bit word into a FNV-1a hash
+static std::uint64_t HashWord(std::uint64_t hash, std::uint64_t word)
+{
+    constexpr std::uint64_t prime = 0x100000001B3ull;
+    for (int i = 0; i < 8; i++)
+    {
+        hash ^= (word >> (i * 8)) & 0xFF;
+        hash *= prime;
+    }
+    return hash;
+}
+
+static std::uint64_t HashDouble(std::uint64_t hash, double value)
+{
+    std::uint64_t word;
+    std::memcpy(&word, &value, sizeof(word));
+    return HashWord(hash, word);
+}
+
+std::uint64_t GetStateHash()
+{
+    constexpr std::uint64_t basis = 0xCBF29CE484222325ull;
+
+    auto hashRange = [](std::size_t begin, std::size_t end) {
+        std::uint64_t hash = basis;
+        for (std::size_t i = begin; i < end; i++)
+        {
+            for (auto& p : pendulums[i].pendulums)
+            {
+                hash = HashDouble(hash, p.angle);
+                hash = HashDouble(hash, p.angularVelocity);
+            }
+            hash = HashWord(hash, pendulums[i].trajectoryIndex);
+        }
+        return hash;
+    };
+
+    // Always the deterministic tree, the hash must not depend on threads
+    return workers.ParallelReduce(pendulums.size(), GetWorkChunkSize(), true, basis, hashRange, HashWord);
+}
+
+// Memory of an ensemble's pendulums and of its schedule, parameters and
+// divergence partials, counted by capacity
+static EnsembleMemory MeasureEnsembleMemory(
+    const std::vector<JoinedPendulum>& measured, const EnsembleMemory& measuredMemory, const std::vector<KernelSpan>& spans,
+    std::size_t indexBytes, std::size_t divergenceBytes)
+{
+    EnsembleMemory memory = { measured.capacity() * sizeof(JoinedPendulum) + measuredMemory.state, measuredMemory.trails };
+
+    // Parameters end with the last block's
+    std::size_t parameters = spans.empty() ? 0 : spans.back().parameters + (spans.back().links * 4 + 1) * kernelBlockSize;
+    memory.state += parameters * sizeof(double) + spans.capacity() * sizeof(KernelSpan) + indexBytes + divergenceBytes;
+    return memory;
+}
+
+EnsembleMemory GetEnsembleMemory()
+{
+    return MeasureEnsembleMemory(pendulums, pendulumMemory, kernelSpans,
+        (linkCounts.capacity() + memberOrder.capacity() + memberBlock.capacity()) * sizeof(std::size_t),
+        blockDivergence.capacity() * sizeof(BlockDivergence) + threadSketches.capacity() * sizeof(QuantileSketch));
+}
+
+EnsembleMemory GetEnsembleMemory(const Ensemble& ensemble)
+{
+    const auto& other = *ensemble.internals;
+    return MeasureEnsembleMemory(ensemble.pendulums, other.pendulumMemory, other.kernelSpans,
+        (other.linkCounts.capacity() + other.memberOrder.capacity() + other.memberBlock.capacity()) * sizeof(std::size_t),
+        other.blockDivergence.capacity() * sizeof(BlockDivergence) + other.threadSketches.capacity() * sizeof(QuantileSketch));
+}
+
+EnsembleMemory EstimateEnsembleMemory(const SimulationSettings& estimated)
+{
+    // Links per pendulum on average over the mix
+    std::vector<std::size_t> counts = { estimated.pendulumsJoined };
+    if (estimated.pendulumsJoinedMix != "none")
+    {
+        counts = ParseLinkCounts(estimated.pendulumsJoinedMix);
+    }
+    const double links = (double)std::accumulate(counts.begin(), counts.end(), (std::size_t)0) / counts.size();
+
+    // Same parts as MeasureEnsembleMemory, per pendulum
+    const double pendulum = sizeof(JoinedPendulum) + links * sizeof(Pendulum)
+        + (links * 4 + 1) * sizeof(double) + 2 * sizeof(std::size_t)
+        + (double)(sizeof(KernelSpan) + sizeof(BlockDivergence)) / kernelBlockSize;
+    const std::size_t count = estimated.joinedPendulumsCount;
+    return {
+        (std::size_t)(pendulum * count) + workers.Size() * sizeof(QuantileSketch),
+        count * estimated.trajectoryPoints * sizeof(Vector2Double)
+    };
+}
+
+EnergyTotals GetEnergy()
+{
+    auto energyRange = [](std::size_t begin, std::size_t end) {
+        EnergyTotals totals = { 0.0, 0.0 };
+        for (std::size_t i = begin; i < end; i++)
+        {
+            const double g = SpreadValue(settings.gravity, settings.gravitySpread, sliceFirst + i);
+
+            // Velocity and height of each link end, y grows downwards
+            double vx = 0.0, vy = 0.0, y = 0.0, depth = 0.0;
+            for (auto& p : pendulums[i].pendulums)
+            {
+                vx += p.length * p.angularVelocity * cos(p.angle);
+                vy -= p.length * p.angularVelocity * sin(p.angle);
+                y += p.length * cos(p.angle);
+                depth += p.length;
+                totals.energy += 0.5 * p.mass * (vx * vx + vy * vy) - p.mass * g * y;
+                totals.scale += p.mass * std::abs(g) * depth;
+            }
+        }
+        return totals;
+    };
+    auto combine = [](EnergyTotals a, EnergyTotals b) {
+        return EnergyTotals { a.energy + b.energy, a.scale + b.scale };
+    };
 
-    return divergence / settings.resetSamples;
+    return workers.ParallelReduce(pendulums.size(), GetWorkChunkSize(), settings.deterministic, EnergyTotals { 0.0, 0.0 }, energyRange, combine);
 }
@@ -0,0 +1,262 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Frame pipeline source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "pipeline.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+void FramePipeline::AddStage(const std::string& name, StageThread thread, const std::vector<std::string>& after, StageFunction function)
+{
+    Stage stage;
+    stage.name = name;
+    stage.thread = thread;
+    stage.dependencies = after.size();
+    stage.function = std::move(function);
+
+    for (auto& dependency : after)
+    {
+        stages[FindStage(dependency)].dependents.push_back(stages.size());
+    }
+    stages.push_back(std::move(stage));
+}
+
+Task FramePipeline::RunFunction(std::function<void()> function)
+{
+    function();
+    co_return;
+}
+
+std::size_t FramePipeline::FindStage(const std::string& name) const
+{
+    for (std::size_t i = 0; i < stages.size(); i++)
+    {
+        if (stages[i].name == name)
+        {
+            return i;
+        }
+    }
+    throw std::invalid_argument("Unknown stage " + name);
+}
+
+// Stage the calling thread runs work of
+static thread_local std::size_t runningStage = FramePipeline::noStage;
+
+// Run work on the calling thread as part of stage
+template<typename Work>
+static void RunAsStage(std::size_t stage, Work&& work)
+{
+    std::size_t previous = std::exchange(runningStage, stage);
+    work();
+    runningStage = previous;
+}
+
+double FramePipeline::Now() const
+{
+    if (clock)
+    {
+        return clock();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FramePipeline::Spawn(Task job)
+{
+    auto handle = job.handle;
+    handle.promise().completion = [this, handle] {
+        std::lock_guard lock(mutex);
+        if (handle.promise().exception && !exception)
+        {
+            exception = handle.promise().exception;
+        }
+        jobsDone.push_back(handle);
+    };
+
+    {
+        std::lock_guard lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    handle.resume();
+}
+
+void FramePipeline::RunFrame()
+{
+    const double frameStarted = Now();
+    {
+        std::lock_guard lock(mutex);
+        finished = 0;
+        for (auto& stage : stages)
+        {
+            stage.waitingOn = stage.dependencies;
+        }
+    }
+
+    for (std::size_t i = 0; i < stages.size(); i++)
+    {
+        if (stages[i].dependencies == 0)
+        {
+            StartStage(i);
+        }
+    }
+
+    // Run main thread work until every stage is done
+    while (true)
+    {
+        std::pair<std::size_t, std::function<void()>> work;
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [this] { return finished == stages.size() || !mainQueue.empty(); });
+            if (mainQueue.empty())
+            {
+                break;
+            }
+            work = std::move(mainQueue.front());
+            mainQueue.pop_front();
+        }
+        mainStage.store(work.first, std::memory_order_relaxed);
+        RunAsStage(work.first, work.second);
+        mainStage.store(noStage, std::memory_order_relaxed);
+    }
+
+    for (auto& stage : stages)
+    {
+        stage.task.Reset();
+    }
+
+    std::exception_ptr thrown;
+    {
+        std::lock_guard lock(mutex);
+        frameSeconds = Now() - frameStarted;
+        for (auto handle : jobsDone)
+        {
+            std::erase_if(jobs, [&](const Task& job) { return job.handle == handle; });
+        }
+        jobsDone.clear();
+        thrown = std::exchange(exception, nullptr);
+    }
+
+    if (thrown)
+    {
+        std::rethrow_exception(thrown);
+    }
+}
+
+void FramePipeline::Resume(std::coroutine_handle<> handle, StageThread thread)
+{
+    // Still part of the stage it was switched from
+    const std::size_t stage = runningStage;
+    if (thread == StageThread::Workers)
+    {
+        workers.Submit([stage, handle] { RunAsStage(stage, [handle] { handle.resume(); }); });
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        mainQueue.push_back({ stage, [handle] { handle.resume(); } });
+    }
+    wake.notify_all();
+}
+
+void FramePipeline::StartStage(std::size_t index)
+{
+    if (stages[index].thread == StageThread::Workers)
+    {
+        workers.Submit([this, index] { RunStage(index); });
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        mainQueue.push_back({ index, [this, index] { RunStage(index); } });
+    }
+    wake.notify_all();
+}
+
+void FramePipeline::RunStage(std::size_t index)
+{
+    std::size_t previous = std::exchange(runningStage, index);
+    auto& stage = stages[index];
+
+    // Jobs waiting on this stage go first, each runs until it suspends again
+    std::vector<Parked> due;
+    {
+        std::lock_guard lock(mutex);
+        double now = Now();
+        stage.started = now;
+        auto notDue = std::partition(stage.parked.begin(), stage.parked.end(), [&](const Parked& parked) {
+            return parked.time > now;
+        });
+        due.assign(notDue, stage.parked.end());
+        stage.parked.erase(notDue, stage.parked.end());
+    }
+
+    for (auto& parked : due)
+    {
+        parked.handle.resume();
+    }
+
+    stage.task = stage.function();
+    stage.task.handle.promise().completion = [this, index] { FinishStage(index); };
+    stage.task.handle.resume();
+    runningStage = previous;
+}
+
+void FramePipeline::FinishStage(std::size_t index)
+{
+    std::vector<std::size_t> ready;
+    {
+        std::lock_guard lock(mutex);
+        auto& stage = stages[index];
+        stage.seconds = Now() - stage.started;
+        if (stage.task.handle.promise().exception && !exception)
+        {
+            exception = stage.task.handle.promise().exception;
+        }
+
+        finished++;
+        for (auto dependent : stage.dependents)
+        {
+            if (--stages[dependent].waitingOn == 0)
+            {
+                ready.push_back(dependent);
+            }
+        }
+    }
+
+    for (auto dependent : ready)
+    {
+        StartStage(dependent);
+    }
+    wake.notify_all();
+}
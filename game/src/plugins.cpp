@@ -0,0 +1,200 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Kernel plugin loader source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "plugins.hpp"
+#include "raylib.h"
+
+#include <ctime>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <unistd.h>
+#define KERNEL_PLUGINS_SUPPORTED 1
+#else
+#define KERNEL_PLUGINS_SUPPORTED 0
+#endif
+
+const HdpKernelPlugin* activeKernelPlugin = nullptr;
+
+static std::string pluginPath = "none";     // Path it was loaded from
+static const HdpKernelPlugin* plugin = nullptr; // Loaded plugin, nullptr if none
+static bool pluginEnabled = true;           // Step with the plugin if loaded
+
+#if KERNEL_PLUGINS_SUPPORTED
+
+static long pluginModTime = 0;              // Of the file at pluginPath when loaded
+static void* pluginLibrary = nullptr;       // Handle of the loaded copy
+static long failedModTime = 0;              // Of a file that failed to load, not retried
+static int pluginCopies = 0;                // Numbers temporary copies
+
+// Close a library and what was loaded from it
+static void ClosePlugin(void* library, const HdpKernelPlugin* loaded)
+{
+    if (loaded && loaded->shutdown)
+    {
+        loaded->shutdown();
+    }
+    if (library)
+    {
+        dlclose(library);
+    }
+}
+
+bool LoadKernelPlugin(std::string_view path)
+{
+    if (path == "none")
+    {
+        UnloadKernelPlugin();
+        return true;
+    }
+
+    const std::string source(path);
+    if (!FileExists(source.c_str()))
+    {
+        TraceLog(LOG_ERROR, TextFormat("PLUGIN: File %s does not exist", source.c_str()));
+        return false;
+    }
+    const long modTime = GetFileModTime(source.c_str());
+    failedModTime = modTime;
+
+    // Loading the same path again would return the library already loaded
+    std::error_code error;
+    auto copy = std::filesystem::temp_directory_path(error) / TextFormat("hdp_kernel_%d_%d.so", (int)getpid(), ++pluginCopies);
+    if (error || !std::filesystem::copy_file(source, copy, std::filesystem::copy_options::overwrite_existing, error))
+    {
+        TraceLog(LOG_ERROR, TextFormat("PLUGIN: Failed to copy %s: %s", source.c_str(), error.message().c_str()));
+        return false;
+    }
+
+    // Mapped by now, the copy is not needed on disk
+    void* library = dlopen(copy.c_str(), RTLD_NOW | RTLD_LOCAL);
+    std::filesystem::remove(copy, error);
+    if (!library)
+    {
+        TraceLog(LOG_ERROR, TextFormat("PLUGIN: Failed to load %s: %s", source.c_str(), dlerror()));
+        return false;
+    }
+
+    auto entry = (HdpKernelPluginEntry)dlsym(library, HDP_KERNEL_PLUGIN_ENTRY);
+    const HdpKernelPlugin* loaded = entry ? entry() : nullptr;
+    const char* problem = !entry ? "no " HDP_KERNEL_PLUGIN_ENTRY " entry point"
+        : !loaded ? "entry point returned nothing"
+        : loaded->abi != HDP_KERNEL_PLUGIN_ABI ? TextFormat("ABI version %u, expected %d", (unsigned)loaded->abi, HDP_KERNEL_PLUGIN_ABI)
+        : !loaded->step || !loaded->positions ? "step or positions missing"
+        : loaded->init && loaded->init() != 0 ? "init failed"
+        : nullptr;
+    if (problem)
+    {
+        TraceLog(LOG_ERROR, TextFormat("PLUGIN: Not loading %s, %s", source.c_str(), problem));
+        dlclose(library);
+        return false;
+    }
+
+    // Swap, the ensemble stays as it is
+    ClosePlugin(pluginLibrary, plugin);
+    pluginLibrary = library;
+    plugin = loaded;
+    pluginPath = source;
+    pluginModTime = modTime;
+    failedModTime = 0;
+    activeKernelPlugin = pluginEnabled ? plugin : nullptr;
+    TraceLog(LOG_INFO, TextFormat("PLUGIN: Loaded kernel plugin %s from %s", plugin->name ? plugin->name : "(unnamed)", source.c_str()));
+    return true;
+}
+
+void UnloadKernelPlugin()
+{
+    ClosePlugin(pluginLibrary, plugin);
+    pluginLibrary = nullptr;
+    plugin = nullptr;
+    activeKernelPlugin = nullptr;
+    pluginPath = "none";
+    pluginModTime = 0;
+}
+
+bool KernelPluginChanged()
+{
+    if (!plugin || !FileExists(pluginPath.c_str()))
+    {
+        return false;
+    }
+
+    // Not written for a second, so a plugin being linked is not loaded half
+    // written, and not the version that failed
+    long modTime = GetFileModTime(pluginPath.c_str());
+    return modTime != pluginModTime && modTime != failedModTime && (long)std::time(nullptr) > modTime;
+}
+
+#else
+
+bool LoadKernelPlugin(std::string_view path)
+{
+    if (path != "none")
+    {
+        TraceLog(LOG_WARNING, "PLUGIN: Kernel plugins are not supported on this platform");
+        return false;
+    }
+    return true;
+}
+
+void UnloadKernelPlugin()
+{
+}
+
+bool KernelPluginChanged()
+{
+    return false;
+}
+
+#endif
+
+const std::string& GetKernelPluginPath()
+{
+    return pluginPath;
+}
+
+const HdpKernelPlugin* GetKernelPlugin()
+{
+    return plugin;
+}
+
+void EnableKernelPlugin(bool enable)
+{
+    pluginEnabled = enable;
+    activeKernelPlugin = pluginEnabled ? plugin : nullptr;
+}
+
+bool KernelPluginEnabled()
+{
+    return pluginEnabled;
+}
@@ -0,0 +1,399 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Sampling profiler source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "profiler.hpp"
+
+#include "raylib.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstdlib>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <execinfo.h>
+#include <fstream>
+#include <iterator>
+#include <link.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// ProfileSample, one stack, written by the signal handler
+struct ProfileSample {
+    std::atomic<bool> ready = false; // Written completely, not collected yet
+    pid_t thread = 0;
+    char name[16] = {};              // Of the thread
+    std::uint32_t depth = 0;
+    void* frames[profilerMaxDepth] = {}; // Innermost first
+};
+
+// Ring of samples, the handler claims [read, write) slots past write, the
+// main thread collects from read
+static ProfileSample* ring = nullptr;
+static std::atomic<std::uint64_t> ringWrite = 0;
+static std::atomic<std::uint64_t> ringRead = 0;
+static std::atomic<std::uint64_t> ringDropped = 0;
+static bool profiling = false;
+
+// Collected stacks of each thread, raw addresses until written
+static std::map<std::pair<std::string, std::vector<void*>>, std::size_t> collected;
+static std::size_t collectedDropped = 0;
+
+// Take a sample of the interrupted thread, only async-signal-safe calls
+// besides backtrace, which StartProfiler warmed up
+static void ProfileSignal(int, siginfo_t*, void*)
+{
+    int savedErrno = errno;
+    std::uint64_t slot = ringWrite.load(std::memory_order_relaxed);
+    do
+    {
+        if (slot - ringRead.load(std::memory_order_acquire) >= profilerRingSize)
+        {
+            ringDropped.fetch_add(1, std::memory_order_relaxed);
+            errno = savedErrno;
+            return;
+        }
+    } while (!ringWrite.compare_exchange_weak(slot, slot + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    auto& sample = ring[slot % profilerRingSize];
+    void* frames[profilerMaxDepth + 2];
+    int depth = backtrace(frames, (int)std::size(frames));
+
+    // This handler and the signal trampoline
+    int skip = std::min(depth, 2);
+    sample.depth = (std::uint32_t)(depth - skip);
+    std::memcpy(sample.frames, frames + skip, sample.depth * sizeof(void*));
+    sample.thread = (pid_t)syscall(SYS_gettid);
+    prctl(PR_GET_NAME, sample.name);
+    sample.ready.store(true, std::memory_order_release);
+    errno = savedErrno;
+}
+
+bool StartProfiler(int frequency)
+{
+    StopProfiler();
+    if (!ring)
+    {
+        ring = new ProfileSample[profilerRingSize];
+    }
+
+    // Loads the unwinder now instead of in the first signal
+    void* warmUp[4];
+    backtrace(warmUp, 4);
+
+    struct sigaction action = {};
+    action.sa_sigaction = ProfileSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    frequency = std::max(frequency, 1);
+    itimerval timer = {};
+    timer.it_interval.tv_sec = frequency == 1 ? 1 : 0;
+    timer.it_interval.tv_usec = frequency == 1 ? 0 : 1000000 / frequency;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0)
+    {
+        TraceLog(LOG_ERROR, TextFormat("PROFILER: Failed to start the timer: %s", std::strerror(errno)));
+        return false;
+    }
+    profiling = true;
+    TraceLog(LOG_INFO, TextFormat("PROFILER: Sampling every thread at %d Hz of CPU time", frequency));
+    return true;
+}
+
+void StopProfiler()
+{
+    if (!profiling)
+    {
+        return;
+    }
+    itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+    profiling = false;
+    CollectProfile();
+}
+
+bool ProfilerRunning()
+{
+    return profiling;
+}
+
+void CollectProfile()
+{
+    if (!ring)
+    {
+        return;
+    }
+
+    const pid_t mainThread = getpid();
+    std::uint64_t read = ringRead.load(std::memory_order_relaxed);
+    const std::uint64_t write = ringWrite.load(std::memory_order_acquire);
+    for (; read < write; read++)
+    {
+        // Claimed but still being written, the rest waits for next time
+        auto& sample = ring[read % profilerRingSize];
+        if (!sample.ready.load(std::memory_order_acquire))
+        {
+            break;
+        }
+
+        std::string thread = sample.thread == mainThread ? "main" : std::string(sample.name, strnlen(sample.name, sizeof(sample.name)));
+        collected[{ std::move(thread), std::vector<void*>(sample.frames, sample.frames + sample.depth) }]++;
+        sample.ready.store(false, std::memory_order_relaxed);
+    }
+    ringRead.store(read, std::memory_order_release);
+    collectedDropped += ringDropped.exchange(0, std::memory_order_relaxed);
+}
+
+// ProfileSymbol, a function of the executable
+struct ProfileSymbol {
+    std::uintptr_t address;
+    std::size_t size;
+    std::string name;
+};
+
+// Functions of the executable's symbol table (or dynamic symbols if
+// stripped), sorted by address, at their loaded addresses
+static std::vector<ProfileSymbol> ReadExecutableSymbols()
+{
+    std::vector<ProfileSymbol> symbols;
+    std::ifstream file("/proc/self/exe", std::ios::binary);
+    std::vector<char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (image.size() < sizeof(Elf64_Ehdr) || std::memcmp(image.data(), ELFMAG, SELFMAG) != 0 || image[EI_CLASS] != ELFCLASS64)
+    {
+        return symbols;
+    }
+
+    // Load bias of a position independent executable, the first object listed
+    std::uintptr_t bias = 0;
+    dl_iterate_phdr([](dl_phdr_info* info, std::size_t, void* data) {
+        *(std::uintptr_t*)data = info->dlpi_addr;
+        return 1;
+    }, &bias);
+
+    Elf64_Ehdr header;
+    std::memcpy(&header, image.data(), sizeof(header));
+    auto section = [&](std::size_t index) {
+        Elf64_Shdr s = {};
+        std::size_t offset = header.e_shoff + index * sizeof(Elf64_Shdr);
+        if (offset + sizeof(Elf64_Shdr) <= image.size())
+        {
+            std::memcpy(&s, image.data() + offset, sizeof(s));
+        }
+        return s;
+    };
+
+    for (std::uint32_t type : { (std::uint32_t)SHT_SYMTAB, (std::uint32_t)SHT_DYNSYM })
+    {
+        for (std::size_t i = 0; i < header.e_shnum && symbols.empty(); i++)
+        {
+            Elf64_Shdr table = section(i);
+            if (table.sh_type != type || table.sh_link >= header.e_shnum)
+            {
+                continue;
+            }
+            Elf64_Shdr strings = section(table.sh_link);
+            if (table.sh_offset + table.sh_size > image.size() || strings.sh_offset + strings.sh_size > image.size())
+            {
+                continue;
+            }
+
+            for (std::size_t offset = 0; offset + sizeof(Elf64_Sym) <= table.sh_size; offset += sizeof(Elf64_Sym))
+            {
+                Elf64_Sym symbol;
+                std::memcpy(&symbol, image.data() + table.sh_offset + offset, sizeof(symbol));
+                if (ELF64_ST_TYPE(symbol.st_info) != STT_FUNC || symbol.st_value == 0 || symbol.st_name >= strings.sh_size)
+                {
+                    continue;
+                }
+                const char* name = image.data() + strings.sh_offset + symbol.st_name;
+                symbols.push_back({ bias + symbol.st_value, symbol.st_size, std::string(name, strnlen(name, strings.sh_size - symbol.st_name)) });
+            }
+        }
+    }
+
+    std::sort(symbols.begin(), symbols.end(), [](const auto& a, const auto& b) { return a.address < b.address; });
+    return symbols;
+}
+
+// Symbols of the executable, read once by whichever thread asks first
+static const std::vector<ProfileSymbol>& GetExecutableSymbols()
+{
+    static const std::vector<ProfileSymbol> symbols = ReadExecutableSymbols();
+    return symbols;
+}
+
+// Readable name of a mangled symbol, without the separators of the format
+static std::string Demangle(const char* mangled)
+{
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+    std::string name = status == 0 && demangled ? demangled : mangled;
+    std::free(demangled);
+    std::replace(name.begin(), name.end(), ';', ':');
+    std::replace(name.begin(), name.end(), '\n', ' ');
+    return name;
+}
+
+// Name of the function at address, else of its shared library
+static std::string Symbolize(void* address, const std::vector<ProfileSymbol>& symbols)
+{
+    auto value = (std::uintptr_t)address;
+    auto next = std::upper_bound(symbols.begin(), symbols.end(), value, [](std::uintptr_t a, const auto& symbol) { return a < symbol.address; });
+    if (next != symbols.begin())
+    {
+        auto& symbol = *std::prev(next);
+        if (value < symbol.address + std::max<std::size_t>(symbol.size, 1))
+        {
+            return Demangle(symbol.name.c_str());
+        }
+    }
+
+    Dl_info info;
+    if (dladdr(address, &info))
+    {
+        if (info.dli_sname)
+        {
+            return Demangle(info.dli_sname);
+        }
+        if (info.dli_fname)
+        {
+            std::string library = info.dli_fname;
+            return "[" + library.substr(library.find_last_of('/') + 1) + "]";
+        }
+    }
+    char hex[32];
+    std::snprintf(hex, sizeof(hex), "0x%llx", (unsigned long long)value);
+    return hex;
+}
+
+std::vector<std::string> SymbolizeStack(void* const* frames, std::size_t depth)
+{
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < depth; i++)
+    {
+        names.push_back(Symbolize((char*)frames[i] - (i > 0 ? 1 : 0), GetExecutableSymbols()));
+    }
+    return names;
+}
+
+std::size_t WriteProfile(const char* filename, std::size_t& dropped)
+{
+    CollectProfile();
+
+    const auto& symbols = GetExecutableSymbols();
+    std::unordered_map<void*, std::string> names;
+    std::map<std::string, std::size_t> lines; // Stacks at other addresses of the same functions merged
+    std::size_t samples = 0;
+    for (const auto& [stack, count] : collected)
+    {
+        std::string line = stack.first;
+
+        // Outermost first, return addresses looked up within their call
+        for (std::size_t i = stack.second.size(); i-- > 0;)
+        {
+            void* address = (char*)stack.second[i] - (i > 0 ? 1 : 0);
+            auto found = names.find(address);
+            if (found == names.end())
+            {
+                found = names.emplace(address, Symbolize(address, symbols)).first;
+            }
+            line += ";" + found->second;
+        }
+        lines[line] += count;
+        samples += count;
+    }
+
+    std::string text;
+    for (const auto& [line, count] : lines)
+    {
+        text += line + " " + std::to_string(count) + "\n";
+    }
+
+    dropped = collectedDropped;
+    collected.clear();
+    collectedDropped = 0;
+    if (!SaveFileText(filename, text.data()))
+    {
+        return 0;
+    }
+    return samples;
+}
+
+#else
+
+bool StartProfiler(int)
+{
+    TraceLog(LOG_WARNING, "PROFILER: Sampling is not supported on this platform");
+    return false;
+}
+
+void StopProfiler()
+{
+}
+
+bool ProfilerRunning()
+{
+    return false;
+}
+
+void CollectProfile()
+{
+}
+
+std::size_t WriteProfile(const char*, std::size_t& dropped)
+{
+    dropped = 0;
+    return 0;
+}
+
+std::vector<std::string> SymbolizeStack(void* const*, std::size_t depth)
+{
+    return std::vector<std::string>(depth, "?");
+}
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Roofline analysis source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "roofline.hpp"
+#include "kernels.hpp"
+#include "pendulum.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+
+using RooflineClock = std::chrono::steady_clock;
+
+// Seconds since start
+static double SecondsSince(RooflineClock::time_point start)
+{
+    return std::chrono::duration<double>(RooflineClock::now() - start).count();
+}
+
+// Run function on every worker at once (or on the caller alone), best
+// seconds of tries
+template<typename Function>
+static double TimeOnThreads(bool allWorkers, int tries, Function function)
+{
+    double best = 0.0;
+    for (int t = 0; t < tries; t++)
+    {
+        auto start = RooflineClock::now();
+        if (allWorkers)
+        {
+            workers.ParallelFor(workers.Size(), 1, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++)
+                {
+                    function(i, workers.Size());
+                }
+            });
+        }
+        else
+        {
+            function(0, 1);
+        }
+        double seconds = SecondsSince(start);
+        best = t == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+double MeasurePeakFlops(bool allWorkers)
+{
+    constexpr double minimumSeconds = 0.05;
+
+    // Long enough on one thread to not measure waking up the others
+    std::size_t repeats = 1 << 12;
+    while (TimeOnThreads(false, 1, [&](std::size_t, std::size_t) { activeKernels->probeFlops(repeats); }) < minimumSeconds)
+    {
+        repeats *= 2;
+    }
+    double seconds = TimeOnThreads(allWorkers, 3, [&](std::size_t, std::size_t) { activeKernels->probeFlops(repeats); });
+    return 128.0 * activeKernels->lanes * repeats * (allWorkers ? workers.Size() : 1) / seconds;
+}
+
+double MeasureBandwidth(bool allWorkers, std::size_t bytes)
+{
+    constexpr double minimumSeconds = 0.02;
+    const std::size_t size = std::max<std::size_t>(bytes / (3 * sizeof(double)), 1024);
+
+    // Each thread touches its own part first so it is placed on its node
+    // Unlike STREAM, reading the written line before the write is counted,
+    // it is traffic all the same
+    std::unique_ptr<double[]> a(new double[size]);
+    std::unique_ptr<double[]> b(new double[size]);
+    std::unique_ptr<double[]> c(new double[size]);
+    auto part = [size](std::size_t i, std::size_t parts) {
+        return std::pair(size * i / parts, size * (i + 1) / parts);
+    };
+    TimeOnThreads(allWorkers, 1, [&](std::size_t i, std::size_t parts) {
+        auto [begin, end] = part(i, parts);
+        std::fill(a.get() + begin, a.get() + end, 0.0);
+        std::fill(b.get() + begin, b.get() + end, 1.0);
+        std::fill(c.get() + begin, c.get() + end, 2.0);
+    });
+
+    // Small buffers are passed over several times, to be timed at all
+    std::size_t passes = 1;
+    auto triad = [&](std::size_t i, std::size_t parts) {
+        auto [begin, end] = part(i, parts);
+        double* __restrict x = a.get();
+        const double* __restrict y = b.get();
+        const double* __restrict z = c.get();
+        for (std::size_t p = 0; p < passes; p++)
+        {
+            for (std::size_t k = begin; k < end; k++)
+            {
+                x[k] = y[k] + 3.0 * z[k];
+            }
+        }
+    };
+    while (TimeOnThreads(allWorkers, 1, triad) < minimumSeconds)
+    {
+        passes *= 2;
+    }
+    double seconds = TimeOnThreads(allWorkers, 5, triad);
+    return 4.0 * sizeof(double) * size * passes / seconds;
+}
+
+// Flops of SinCos in kernels_impl.hpp
+constexpr double sinCosFlops = 44.0;
+
+// Flops of Solve over links
+static double CountSolveFlops(std::size_t n)
+{
+    double flops = 0.0;
+    for (std::size_t k = 0; k < n; k++)
+    {
+        double below = (double)(n - k - 1);
+        flops += 1.0 + below * (1.0 + 2.0 * below + 2.0); // Inverse pivot, elimination
+        flops += 2.0 * below + 1.0;                       // Back substitution
+    }
+    return flops;
+}
+
+// Flops of ChainAccelerationRow over N links
+static double CountChainRowFlops(std::size_t n)
+{
+    double flops = (sinCosFlops + 1.0) * n // Own sin, cos and w^2
+        + (n - 1.0)                        // Mass below
+        + 5.0 * n                          // Diagonal and gravity
+        + 14.0 * n * (n - 1.0) / 2.0;      // Lower triangle and forcing terms
+    for (std::size_t k = 0; k < n; k++)
+    {
+        flops += 4.0 * k + 1.0 + (n - k - 1.0) * (3.0 * k + 1.0); // LDL^T
+    }
+    flops += 2.0 * n * (n - 1.0) + n; // Forward and back substitution
+    return flops;
+}
+
+KernelCost CountStepCost(std::string_view integrator, std::size_t links)
+{
+    const double n = (double)links;
+
+    // Gather and scatter of each link's state, its cached parameters, gravity
+    // and the trajectory point
+    double bytes = n * (2.0 * sizeof(Pendulum) + 4.0 * sizeof(double)) + sizeof(double) + 2.0 * sizeof(double);
+
+    const double integrateRow = 4.0 + sinCosFlops + 4.0;
+    const double distanceRow = 10.0;
+    double flops = 0.0;
+    if (integrator == "implicit")
+    {
+        double iteration = (sinCosFlops + 15.0) * n // MidpointRow
+            + 26.0 * n * (n - 1.0)                  // CouplingRow
+            + CountSolveFlops(links)
+            + n;                                    // NewtonRow
+        flops = n + 6.0 * n + rooflineImplicitIterations * iteration
+            + 8.0 * n                     // ExtrapolateRow
+            + (sinCosFlops + 4.0) * n     // PlaceRow
+            + distanceRow;
+    }
+    else if (integrator == "chain")
+    {
+        if (links >= chainKernelMinLinks && links <= chainKernelMaxLinks)
+        {
+            flops = CountChainRowFlops(links);
+        }
+        else
+        {
+            flops = n + (sinCosFlops + 5.0) * n + 12.0 * n * (n - 1.0) + CountSolveFlops(links);
+        }
+        flops += integrateRow * n + distanceRow;
+    }
+    else if (links == 1)
+    {
+        flops = 2.0 * sinCosFlops + 7.0 + distanceRow; // SingleRow
+    }
+    else
+    {
+        flops = (2.0 * sinCosFlops + 45.0) * (n - 1.0) // AccelerationRow
+            + integrateRow * n + distanceRow;
+    }
+    return { flops, bytes };
+}
+
+KernelCost CountUnrollCost()
+{
+    // Conversions are not counted as flops, the output is reused for every
+    // trajectory and stays in cache
+    return { 0.0, 2.0 * sizeof(double) };
+}
+
+KernelCost CountEnsembleStepCost(std::string_view integrator)
+{
+    std::map<std::size_t, std::size_t> counts; // Pendulums by links
+    for (const auto& jp : pendulums)
+    {
+        counts[jp.pendulums.size()]++;
+    }
+
+    KernelCost total = { 0.0, 0.0 };
+    for (auto [links, count] : counts)
+    {
+        auto cost = CountStepCost(integrator, links);
+        double padded = (double)((count + kernelBlockSize - 1) / kernelBlockSize * kernelBlockSize);
+        total.flops += cost.flops * padded;
+        total.bytes += cost.bytes * count;
+    }
+    double size = std::max<double>((double)pendulums.size(), 1.0);
+    return { total.flops / size, total.bytes / size };
+}
+
+std::vector<RooflinePoint> MeasureRooflinePoints(std::size_t steps)
+{
+    std::vector<RooflinePoint> points;
+    const std::string integrator = settings.integrator;
+    for (const char* name : { "explicit", "chain", "implicit" })
+    {
+        settings.integrator = name;
+        InitializePendulums();
+        UpdatePendulums();
+
+        auto start = RooflineClock::now();
+        for (std::size_t i = 0; i < steps; i++)
+        {
+            UpdatePendulums();
+        }
+        double seconds = SecondsSince(start);
+        auto cost = CountEnsembleStepCost(name);
+        points.push_back({ name, cost, steps * pendulums.size() / seconds, cost.bytes * pendulums.size(), integrator == name, false });
+    }
+    settings.integrator = integrator;
+    InitializePendulums();
+
+    // Render kernel, without the draw calls that need a window
+    std::size_t unrolled = 0;
+    std::vector<float> out;
+    auto start = RooflineClock::now();
+    for (int r = 0; r < 20; r++)
+    {
+        for (auto& p : pendulums)
+        {
+            out.resize(p.trajectories.size() * 2);
+            activeKernels->unrollTrajectory((const double*)p.trajectories.data(), p.trajectories.size(), p.trajectoryIndex, out.data());
+            unrolled += p.trajectories.size();
+        }
+    }
+    double seconds = SecondsSince(start);
+    points.push_back({ "unroll", CountUnrollCost(), unrolled / seconds, CountUnrollCost().bytes * unrolled / 20, true, true });
+    return points;
+}
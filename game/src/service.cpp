@@ -0,0 +1,327 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Simulation service source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "service.hpp"
+#include "kernels.hpp"
+#include "net.hpp"
+#include "pendulum.hpp"
+#include "stats.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+using ServiceClock = std::chrono::steady_clock;
+
+// Seconds between statistics in the log, while there are requests
+constexpr double serviceLogInterval = 10.0;
+
+// Set by SIGINT and SIGTERM to stop serving
+static volatile std::sig_atomic_t serviceStopping = 0;
+
+// ServiceClient, a connected client
+struct ServiceClient {
+    Connection connection;
+};
+
+// ServiceRequest, a simulate request waiting for its batch
+struct ServiceRequest {
+    std::shared_ptr<ServiceClient> client; // Kept until answered, even if it disconnected
+    std::uint64_t id = 0;
+    std::uint64_t steps = 0;
+    std::vector<JoinedPendulum> pendulums;
+    ServiceClock::time_point received;
+    std::size_t first = 0; // Of its pendulums in the batch
+};
+
+// Totals for ServiceStats
+static ServiceStats totals = {};
+static QuantileSketch latencies;
+static ServiceClock::time_point serviceStart;
+
+// Parse a simulate request, false if it is invalid
+static bool ParseServiceRequest(MessageReader& reader, ServiceRequest& request)
+{
+    request.id = reader.Get<std::uint64_t>();
+    const double seconds = reader.Get<double>();
+    const std::uint32_t count = reader.Get<std::uint32_t>();
+    const double steps = std::round(seconds / settings.fixedDeltaTime);
+    if (!reader.ok || !(steps >= 0.0) || steps > (double)serviceMaxSteps || count > reader.size / sizeof(ServiceLink))
+    {
+        return false;
+    }
+    request.steps = (std::uint64_t)steps;
+
+    request.pendulums.reserve(count);
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+        const std::uint32_t links = reader.Get<std::uint32_t>();
+        if (!reader.ok || links == 0 || links > serviceMaxLinks)
+        {
+            return false;
+        }
+
+        std::vector<double> lengths(links), masses(links), angles(links), velocities(links);
+        for (std::uint32_t k = 0; k < links; k++)
+        {
+            const auto link = reader.Get<ServiceLink>();
+            if (!(link.length > 0.0) || !(link.mass > 0.0) || !std::isfinite(link.angle) || !std::isfinite(link.angularVelocity))
+            {
+                return false;
+            }
+            lengths[k] = link.length;
+            masses[k] = link.mass;
+            angles[k] = link.angle;
+            velocities[k] = link.angularVelocity;
+        }
+
+        auto& jp = request.pendulums.emplace_back(links, lengths, masses, angles, 0);
+        for (std::uint32_t k = 0; k < links; k++)
+        {
+            jp.pendulums[k].angularVelocity = velocities[k];
+        }
+    }
+    return reader.ok && reader.offset == reader.size;
+}
+
+// End position of a pendulum from its angles
+static Vector2Double GetEndPosition(const JoinedPendulum& jp)
+{
+    Vector2Double end(0.0, 0.0);
+    for (auto& p : jp.pendulums)
+    {
+        end.x += p.length * std::sin(p.angle);
+        end.y += p.length * std::cos(p.angle);
+    }
+    return end;
+}
+
+// Answer a request, status 0 with the end positions of pendulums from first
+static void AnswerServiceRequest(const ServiceRequest& request, std::uint32_t status, std::uint32_t count, std::size_t first, std::uint64_t batchPendulums)
+{
+    const double latency = std::chrono::duration<double>(ServiceClock::now() - request.received).count();
+
+    MessageWriter message;
+    ServiceResultHeader header = { request.id, status, count, request.steps, batchPendulums, latency };
+    message.Put(header);
+    for (std::size_t i = first; i < first + count && status == 0; i++)
+    {
+        message.Put(GetEndPosition(pendulums[i]));
+    }
+    request.client->connection.Send(ServiceResult, message);
+
+    totals.requests++;
+    latencies.Add(latency);
+    totals.latencyMax = std::max(totals.latencyMax, latency);
+}
+
+// Step every pending request together, shortest first, answering each once
+// its duration is reached
+static void RunServiceBatch(std::vector<ServiceRequest>& requests)
+{
+    auto start = ServiceClock::now();
+
+    // Requests that finish first lead, so finished pendulums are a prefix
+    std::stable_sort(requests.begin(), requests.end(), [](const auto& a, const auto& b) { return a.steps < b.steps; });
+    std::vector<JoinedPendulum> batch;
+    for (auto& request : requests)
+    {
+        request.first = batch.size();
+        std::move(request.pendulums.begin(), request.pendulums.end(), std::back_inserter(batch));
+        request.pendulums.clear();
+    }
+    const std::uint64_t batchPendulums = batch.size();
+    LoadPendulums(std::move(batch));
+
+    std::size_t next = 0;    // Next request to answer
+    std::size_t dropped = 0; // Pendulums of answered requests removed from the front
+    for (std::uint64_t step = 0; next < requests.size(); step++)
+    {
+        while (next < requests.size() && requests[next].steps == step)
+        {
+            auto& request = requests[next];
+            const std::size_t count = (next + 1 < requests.size() ? requests[next + 1].first : batchPendulums) - request.first;
+            AnswerServiceRequest(request, 0, (std::uint32_t)count, request.first - dropped, batchPendulums);
+            next++;
+        }
+        if (next == requests.size())
+        {
+            break;
+        }
+
+        // Stop stepping answered pendulums once they are a quarter of the batch
+        const std::size_t answered = requests[next].first - dropped;
+        if (answered > 0 && answered * 4 >= pendulums.size())
+        {
+            LoadPendulums(std::vector<JoinedPendulum>(std::make_move_iterator(pendulums.begin() + answered), std::make_move_iterator(pendulums.end())));
+            dropped += answered;
+        }
+
+        UpdatePendulums();
+        totals.pendulumSteps += pendulums.size();
+    }
+
+    totals.batches++;
+    totals.pendulums += batchPendulums;
+    totals.busy += std::chrono::duration<double>(ServiceClock::now() - start).count();
+    requests.clear();
+}
+
+// Totals as sent to clients
+static ServiceStats GetServiceStats()
+{
+    ServiceStats stats = totals;
+    stats.uptime = std::chrono::duration<double>(ServiceClock::now() - serviceStart).count();
+    stats.latencyMedian = latencies.total > 0 ? latencies.Quantile(0.5) : 0.0;
+    stats.latencyP99 = latencies.total > 0 ? latencies.Quantile(0.99) : 0.0;
+    stats.pendulumStepsPerSecond = stats.busy > 0.0 ? stats.pendulumSteps / stats.busy : 0.0;
+    return stats;
+}
+
+int RunService(std::string_view address, const char* settingsFilename)
+{
+    if (FileExists(settingsFilename))
+    {
+        settings.LoadSettings(settingsFilename);
+    }
+
+    // Spread is over an ensemble, a batch is not one
+    settings.gravitySpread = 0.0;
+    SelectKernels(settings.kernelLevel, settings.deterministic);
+    workers.Start(settings.workerThreads, settings.numaAware);
+
+    const int listener = ListenSocket(address);
+    if (listener < 0)
+    {
+        workers.Stop();
+        return 1;
+    }
+    std::signal(SIGINT, [](int) { serviceStopping = 1; });
+    std::signal(SIGTERM, [](int) { serviceStopping = 1; });
+    TraceLog(LOG_INFO, TextFormat("SERVICE: Serving on %s with %s integrator, step %f s", std::string(address).c_str(), settings.integrator.c_str(), settings.fixedDeltaTime));
+
+    serviceStart = ServiceClock::now();
+    auto logged = serviceStart;
+    std::uint64_t loggedRequests = 0;
+    std::vector<std::shared_ptr<ServiceClient>> clients;
+    std::vector<ServiceRequest> pending;
+    std::uint64_t pendingPendulums = 0;
+    MessageHeader header;
+    std::vector<unsigned char> payload;
+    while (!serviceStopping)
+    {
+        // Wake up for new requests, the end of the batch window, or to
+        // send replies slow clients did not take yet
+        double timeout = 0.5;
+        if (!pending.empty())
+        {
+            timeout = std::max(serviceBatchWindow - std::chrono::duration<double>(ServiceClock::now() - pending.front().received).count(), 0.0);
+        }
+        std::vector<int> sockets = { listener };
+        for (auto& client : clients)
+        {
+            sockets.push_back(client->connection.socket);
+            if (client->connection.Pending() > 0)
+            {
+                timeout = std::min(timeout, 0.001);
+            }
+        }
+        WaitForInput(sockets, timeout);
+
+        for (int s = AcceptSocket(listener); s >= 0; s = AcceptSocket(listener))
+        {
+            clients.push_back(std::make_shared<ServiceClient>());
+            clients.back()->connection.Open(s);
+        }
+
+        for (auto& client : clients)
+        {
+            while (client->connection.Receive(header, payload))
+            {
+                MessageReader reader(payload);
+                if (header.type == ServiceStatsRequest)
+                {
+                    auto stats = GetServiceStats();
+                    client->connection.Send(ServiceStatsReply, &stats, sizeof(stats));
+                    continue;
+                }
+
+                ServiceRequest request;
+                request.client = client;
+                request.received = ServiceClock::now();
+                if (header.type != ServiceSimulate || !ParseServiceRequest(reader, request))
+                {
+                    AnswerServiceRequest(request, 1, 0, 0, 0);
+                    continue;
+                }
+                pendingPendulums += request.pendulums.size();
+                pending.push_back(std::move(request));
+            }
+        }
+        std::erase_if(clients, [](const auto& client) { return client->connection.closed; });
+
+        if (!pending.empty())
+        {
+            const double waited = std::chrono::duration<double>(ServiceClock::now() - pending.front().received).count();
+            if (waited >= serviceBatchWindow || pendingPendulums >= serviceBatchPendulums)
+            {
+                RunServiceBatch(pending);
+                pendingPendulums = 0;
+            }
+        }
+
+        auto now = ServiceClock::now();
+        if (std::chrono::duration<double>(now - logged).count() >= serviceLogInterval && totals.requests > loggedRequests)
+        {
+            auto stats = GetServiceStats();
+            TraceLog(LOG_INFO, TextFormat("SERVICE: %llu requests in %llu batches, latency median %.2f ms, p99 %.2f ms, %.1f M pendulum steps/s",
+                (unsigned long long)stats.requests, (unsigned long long)stats.batches, stats.latencyMedian * 1e3, stats.latencyP99 * 1e3, stats.pendulumStepsPerSecond * 1e-6));
+            logged = now;
+            loggedRequests = totals.requests;
+        }
+    }
+
+    clients.clear();
+    CloseSocket(listener);
+    if (address.starts_with("unix:"))
+    {
+        std::remove(std::string(address.substr(5)).c_str());
+    }
+    workers.Stop();
+    TraceLog(LOG_INFO, "SERVICE: Stopped");
+    return 0;
+}
@@ -0,0 +1,541 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Ensemble shard processes source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "shards.hpp"
+#include "kernels.hpp"
+#include "memoryusage.hpp"
+#include "pendulum.hpp"
+#include "sharedstate.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#define SHARDS_SUPPORTED 1
+#else
+#define SHARDS_SUPPORTED 0
+#endif
+
+// Times a slot is read again when the shard wrote it meanwhile, before
+// leaving the slice as it is for this frame
+constexpr int shardReadAttempts = 4;
+
+// Sleep of an idle shard between checks for requests
+constexpr auto shardIdleSleep = std::chrono::microseconds(500);
+
+// First pendulum and pendulums of slice index of count
+static void GetShardSlice(std::size_t index, std::size_t count, std::size_t ensemble, std::size_t& first, std::size_t& size)
+{
+    first = ensemble * index / count;
+    size = ensemble * (index + 1) / count - first;
+}
+
+// Region a shard of the render process parent publishes into
+static std::string GetShardRegionName(long parent, std::size_t index)
+{
+    return "/hdp_" + std::to_string(parent) + "_shard" + std::to_string(index);
+}
+
+#if SHARDS_SUPPORTED
+
+// Shard, a shard process as seen by the render process
+struct Shard {
+    pid_t pid = -1;
+    std::string name;
+    int descriptor = -1;
+    unsigned char* region = nullptr; // Mapped once the shard created it
+    std::size_t regionSize = 0;
+    std::uint64_t steps = 0;         // Requested so far
+    std::uint64_t resets = 0;        // Requested resets
+    bool lost = false;               // Exited, slice not updated anymore
+};
+
+static std::vector<Shard> shards;
+static std::string shardExecutable;
+static std::size_t shardMemoryReserved = 0; // Passed on to every shard
+
+// Start the process of shard index
+static bool SpawnShard(std::size_t index)
+{
+    auto& shard = shards[index];
+    std::string argument = "--shard=" + std::to_string(index) + "/" + std::to_string(shards.size());
+    std::string reserved = "--shard-reserved=" + std::to_string(shardMemoryReserved);
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        TraceLog(LOG_ERROR, TextFormat("SHARDS: Failed to start shard %zu: %s", index, std::strerror(errno)));
+        return false;
+    }
+    if (pid == 0)
+    {
+        execl(shardExecutable.c_str(), shardExecutable.c_str(), argument.c_str(), reserved.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+
+    shard.pid = pid;
+    shard.lost = false;
+    return true;
+}
+
+// Unmap and remove the region of a shard
+static void UnmapShard(Shard& shard)
+{
+    if (shard.region)
+    {
+        munmap(shard.region, shard.regionSize);
+    }
+    if (shard.descriptor >= 0)
+    {
+        close(shard.descriptor);
+        shm_unlink(shard.name.c_str());
+    }
+    shard.region = nullptr;
+    shard.regionSize = 0;
+    shard.descriptor = -1;
+}
+
+// Map the region of a shard once it exists, again when it grew, and pass
+// on the requests made so far, false if it is not there yet
+static bool MapShard(Shard& shard)
+{
+    if (shard.descriptor < 0)
+    {
+        shard.descriptor = shm_open(shard.name.c_str(), O_RDWR, 0);
+        if (shard.descriptor < 0)
+        {
+            return false;
+        }
+    }
+
+    struct stat status = {};
+    if (fstat(shard.descriptor, &status) != 0 || (std::size_t)status.st_size < sizeof(SharedStateHeader))
+    {
+        return false;
+    }
+    if (shard.region)
+    {
+        munmap(shard.region, shard.regionSize);
+        shard.region = nullptr;
+    }
+
+    void* mapped = mmap(nullptr, (std::size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shard.descriptor, 0);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    shard.region = (unsigned char*)mapped;
+    shard.regionSize = (std::size_t)status.st_size;
+
+    auto header = (SharedStateHeader*)shard.region;
+    if (std::memcmp(header->magic, sharedStateMagic, sizeof(sharedStateMagic)) != 0 || header->version != sharedStateVersion)
+    {
+        munmap(shard.region, shard.regionSize);
+        shard.region = nullptr;
+        return false;
+    }
+    header->requestedResets.store(shard.resets, std::memory_order_release);
+    header->requestedSteps.store(shard.steps, std::memory_order_release);
+    return true;
+}
+
+// Notice shards that exited, their slices fade out of the composite
+static void CheckShards()
+{
+    for (std::size_t s = 0; s < shards.size(); s++)
+    {
+        auto& shard = shards[s];
+        int status = 0;
+        if (shard.lost || waitpid(shard.pid, &status, WNOHANG) != shard.pid)
+        {
+            continue;
+        }
+
+        TraceLog(LOG_WARNING, TextFormat("SHARDS: Shard %zu exited (status %d), its slice is lost until the next reset", s, status));
+        shard.lost = true;
+        shard.pid = -1;
+        UnmapShard(shard);
+
+        std::size_t first, size;
+        GetShardSlice(s, shards.size(), pendulums.size(), first, size);
+        for (std::size_t i = first; i < first + size; i++)
+        {
+            std::fill(pendulums[i].trajectories.begin(), pendulums[i].trajectories.end(), Vector2Double());
+        }
+    }
+}
+
+// Copy the latest slot of a shard into pendulums and merge its divergence,
+// false if it is not there yet, still from before the last reset, or kept
+// being written while read
+static bool ReadShard(Shard& shard, DivergenceStats& divergence)
+{
+    for (int attempt = 0; attempt < shardReadAttempts; attempt++)
+    {
+        auto header = (SharedStateHeader*)shard.region;
+        const std::uint64_t layout = header->layout.load(std::memory_order_acquire);
+        if (layout % 2 != 0)
+        {
+            continue;
+        }
+        if (header->regionSize > shard.regionSize)
+        {
+            if (!MapShard(shard))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        const std::size_t slotOffset = header->slotOffset[header->latest.load(std::memory_order_acquire) & 1];
+        auto slotStart = shard.region + slotOffset;
+        auto slot = (const SharedStateSlot*)slotStart;
+        const std::uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0)
+        {
+            continue;
+        }
+
+        const std::size_t count = slot->pendulums;
+        const std::size_t points = slot->trajectoryPoints;
+        if (slot->resets != shard.resets || slot->ensemble != pendulums.size() || slot->first + count > pendulums.size() || points == 0
+            || slotOffset + slot->trajectoryIndexOffset + count * sizeof(std::uint32_t) > shard.regionSize)
+        {
+            return false;
+        }
+
+        auto linkCount = (const std::uint32_t*)(slotStart + slot->linkCountOffset);
+        auto angle = (const double*)(slotStart + slot->angleOffset);
+        auto position = (const double*)(slotStart + slot->positionOffset);
+        auto trajectory = (const double*)(slotStart + slot->trajectoryOffset);
+        auto trajectoryIndex = (const std::uint32_t*)(slotStart + slot->trajectoryIndexOffset);
+        for (std::size_t i = 0; i < count; i++)
+        {
+            auto& jp = pendulums[slot->first + i];
+            const std::size_t links = linkCount[i];
+            if (links == jp.pendulums.size() && points == jp.trajectories.size())
+            {
+                for (std::size_t k = 0; k < links; k++)
+                {
+                    auto& p = jp.pendulums[k];
+                    p.angle = angle[k];
+                    p.position = Vector2Double(position[k * 2], position[k * 2 + 1]);
+                }
+                std::memcpy((void*)jp.trajectories.data(), trajectory + i * points * 2, points * sizeof(Vector2Double));
+                jp.trajectoryIndex = std::min<std::size_t>(trajectoryIndex[i], points - 1);
+            }
+            angle += links;
+            position += links * 2;
+        }
+
+        DistanceMoments moments;
+        const double deviation = slot->divergenceStandardDeviation;
+        moments.Merge(slot->divergenceCount, slot->divergenceMean, slot->divergenceCount > 1 ? deviation * deviation * (slot->divergenceCount - 1) : 0.0, slot->divergenceMax);
+        QuantileSketch sketch;
+        std::memcpy(sketch.counts.data(), slotStart + slot->sketchOffset, sizeof(sketch.counts));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) != sequence || header->layout.load(std::memory_order_relaxed) != layout)
+        {
+            continue;
+        }
+
+        divergence.Merge(moments.count, moments.mean, moments.m2, moments.max);
+        for (auto bucket : sketch.counts)
+        {
+            sketch.total += bucket;
+        }
+        divergence.sketch.Merge(sketch);
+        return true;
+    }
+    return false;
+}
+
+bool StartShards(std::size_t count, [[maybe_unused]] const char* executable, std::size_t memoryReserved)
+{
+    StopShards();
+    shardMemoryReserved = memoryReserved;
+
+    // Linux runs this very binary, whatever argv[0] says
+#ifdef __linux__
+    shardExecutable = "/proc/self/exe";
+#else
+    shardExecutable = executable;
+#endif
+
+    shards.resize(count);
+    for (std::size_t s = 0; s < count; s++)
+    {
+        shards[s].name = GetShardRegionName((long)getpid(), s);
+        shm_unlink(shards[s].name.c_str()); // Left over from a crashed run with the same pid
+        if (!SpawnShard(s))
+        {
+            StopShards();
+            return false;
+        }
+    }
+
+    TraceLog(LOG_INFO, TextFormat("SHARDS: Started %zu shard processes", count));
+    return true;
+}
+
+void StopShards()
+{
+    for (auto& shard : shards)
+    {
+        if (shard.pid > 0)
+        {
+            kill(shard.pid, SIGTERM);
+            waitpid(shard.pid, nullptr, 0);
+        }
+        UnmapShard(shard);
+    }
+    shards.clear();
+}
+
+void RequestShardStep()
+{
+    for (auto& shard : shards)
+    {
+        shard.steps++;
+        if (shard.region)
+        {
+            ((SharedStateHeader*)shard.region)->requestedSteps.store(shard.steps, std::memory_order_release);
+        }
+    }
+}
+
+void RequestShardReset(int resets)
+{
+    for (std::size_t s = 0; s < shards.size(); s++)
+    {
+        auto& shard = shards[s];
+        shard.resets = (std::uint64_t)resets;
+        if (shard.lost)
+        {
+            SpawnShard(s);
+        }
+        if (shard.region)
+        {
+            ((SharedStateHeader*)shard.region)->requestedResets.store(shard.resets, std::memory_order_release);
+        }
+    }
+}
+
+DivergenceStats CompositeShards()
+{
+    CheckShards();
+
+    DivergenceStats divergence;
+    for (auto& shard : shards)
+    {
+        if (!shard.lost && (shard.region || MapShard(shard)))
+        {
+            ReadShard(shard, divergence);
+        }
+    }
+    return divergence;
+}
+
+int RunShard(std::size_t index, std::size_t count, const char* settingsFilename, std::size_t memoryReserved)
+{
+    const pid_t parent = getppid();
+    if (count == 0 || index >= count)
+    {
+        TraceLog(LOG_ERROR, TextFormat("SHARDS: Invalid shard %zu of %zu", index, count));
+        return 1;
+    }
+
+    // Stay on one NUMA node, next to the memory of the slice
+    auto nodes = GetNumaNodes();
+    const auto& cpus = nodes[index % nodes.size()];
+#ifdef __linux__
+    if (!cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+        {
+            CPU_SET(cpu, &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+
+    // Settings file with the overrides of a shard
+    // Fitted into memoryBudget the same as in the render process, compared
+    // with the values requested before it lowered them
+    int modTime = 0;
+    MemoryFit memoryFit;
+    auto loadSettings = [&]() {
+        bool needsReset = false;
+        if (FileExists(settingsFilename))
+        {
+            const std::size_t fittedPoints = settings.trajectoryPoints;
+            const std::size_t fittedPendulums = settings.joinedPendulumsCount;
+            UndoMemoryFit(settings, memoryFit);
+            needsReset = settings.LoadSettings(settingsFilename);
+            memoryFit = FitMemoryBudget(settings, memoryReserved);
+            needsReset |= settings.trajectoryPoints != fittedPoints || settings.joinedPendulumsCount != fittedPendulums;
+            modTime = GetFileModTime(settingsFilename);
+        }
+
+        // Threads of the node shared with the other shards on it
+        if (settings.workerThreads == 0)
+        {
+            std::size_t available = cpus.empty() ? std::thread::hardware_concurrency() : cpus.size();
+            std::size_t sharing = (count - index % nodes.size() + nodes.size() - 1) / nodes.size();
+            settings.workerThreads = std::max<std::size_t>(available / std::max<std::size_t>(sharing, 1), 1);
+        }
+        settings.numaAware = false;
+        settings.autoTune = false;
+        settings.sharedMemoryName = GetShardRegionName((long)parent, index);
+        return needsReset;
+    };
+
+    std::uint64_t resets = 0;
+    std::uint64_t steps = 0;
+    auto initialize = [&]() {
+        std::size_t first, size;
+        GetShardSlice(index, count, settings.joinedPendulumsCount, first, size);
+        SetEnsembleSlice(first, size);
+        InitializePendulums((int)resets);
+        PublishSharedState(GetDivergence(), true, resets);
+    };
+
+    loadSettings();
+    SelectKernels(settings.kernelLevel, settings.deterministic);
+    workers.Start(settings.workerThreads, false);
+    initialize();
+
+    while (getppid() == parent)
+    {
+        if (FileExists(settingsFilename) && GetFileModTime(settingsFilename) != modTime)
+        {
+            std::size_t threads = settings.workerThreads;
+            if (loadSettings())
+            {
+                initialize();
+            }
+            SelectKernels(settings.kernelLevel, settings.deterministic);
+            if (settings.workerThreads != threads)
+            {
+                workers.Start(settings.workerThreads, false);
+            }
+        }
+
+        auto header = GetSharedStateHeader();
+        if (!header)
+        {
+            break;
+        }
+
+        // A reset drops steps requested before it
+        const std::uint64_t requestedResets = header->requestedResets.load(std::memory_order_acquire);
+        if (requestedResets != resets)
+        {
+            resets = requestedResets;
+            steps = header->requestedSteps.load(std::memory_order_acquire);
+            initialize();
+            continue;
+        }
+
+        if (header->requestedSteps.load(std::memory_order_acquire) > steps)
+        {
+            UpdatePendulums();
+            steps++;
+            PublishSharedState(GetDivergence(), true, resets);
+        }
+        else
+        {
+            std::this_thread::sleep_for(shardIdleSleep);
+        }
+    }
+
+    CloseSharedState();
+    workers.Stop();
+    return 0;
+}
+
+#else
+
+bool StartShards(std::size_t, const char*, std::size_t)
+{
+    TraceLog(LOG_WARNING, "SHARDS: Shard processes are not supported on this platform");
+    return false;
+}
+
+void StopShards()
+{
+}
+
+void RequestShardStep()
+{
+}
+
+void RequestShardReset(int)
+{
+}
+
+DivergenceStats CompositeShards()
+{
+    return DivergenceStats();
+}
+
+int RunShard(std::size_t, std::size_t, const char*, std::size_t)
+{
+    TraceLog(LOG_ERROR, "SHARDS: Shard processes are not supported on this platform");
+    return 1;
+}
+
+#endif
+
+bool ShardsRunning()
+{
+#if SHARDS_SUPPORTED
+    return !shards.empty();
+#else
+    return false;
+#endif
+}
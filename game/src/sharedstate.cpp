@@ -0,0 +1,307 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Shared memory state export source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "sharedstate.hpp"
+#include "pendulum.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SHARED_STATE_SUPPORTED 1
+#else
+#define SHARED_STATE_SUPPORTED 0
+#endif
+
+static std::string requestedName;       // Name the region was last opened for
+static bool openFailed = false;         // Not retried until the name changes
+static int descriptor = -1;
+static unsigned char* region = nullptr; // Mapped region, nullptr if closed
+static std::size_t regionSize = 0;
+
+// SlotLayout, offsets of a slot's arrays for an ensemble
+struct SlotLayout {
+    std::size_t pendulums = 0;
+    std::size_t links = 0;
+    std::size_t trajectoryPoints = 0;
+
+    std::size_t endPosition = 0;
+    std::size_t angle = 0;
+    std::size_t linkCount = 0;
+    std::size_t position = 0;
+    std::size_t sketch = 0;
+    std::size_t trajectory = 0;
+    std::size_t trajectoryIndex = 0;
+    std::size_t size = 0;
+
+    bool operator==(const SlotLayout& other) const
+    {
+        return pendulums == other.pendulums && links == other.links && trajectoryPoints == other.trajectoryPoints;
+    }
+};
+
+static SlotLayout layout; // Slots of the mapped region
+
+// Round up to a cache line, so slots and arrays do not share lines
+static std::size_t AlignUp(std::size_t size)
+{
+    return (size + 63) & ~(std::size_t)63;
+}
+
+// Lay out a slot's arrays one after another
+static SlotLayout GetSlotLayout(std::size_t pendulumCount, std::size_t links, std::size_t trajectoryPoints)
+{
+    SlotLayout l;
+    l.pendulums = pendulumCount;
+    l.links = links;
+    l.trajectoryPoints = trajectoryPoints;
+    l.endPosition = AlignUp(sizeof(SharedStateSlot));
+    l.angle = l.endPosition + AlignUp(pendulumCount * 2 * sizeof(double));
+    l.linkCount = l.angle + AlignUp(links * sizeof(double));
+    l.position = l.linkCount + AlignUp(pendulumCount * sizeof(std::uint32_t));
+    l.sketch = l.position + AlignUp(links * 2 * sizeof(double));
+    l.trajectory = l.sketch + AlignUp(QuantileSketch::bucketCount * sizeof(std::uint32_t));
+    l.trajectoryIndex = l.trajectory + AlignUp(pendulumCount * trajectoryPoints * 2 * sizeof(double));
+    l.size = l.trajectoryIndex + AlignUp(trajectoryPoints > 0 ? pendulumCount * sizeof(std::uint32_t) : 0);
+    return l;
+}
+
+#if SHARED_STATE_SUPPORTED
+
+// Map the region with room for two slots of wanted, growing it as needed,
+// and lay the slots out, return false if it failed
+static bool MapRegion(const SlotLayout& wanted)
+{
+    const std::size_t needed = AlignUp(sizeof(SharedStateHeader)) + wanted.size * 2;
+
+    auto header = (SharedStateHeader*)region;
+    if (needed > regionSize)
+    {
+        // Readers retry while the layout is odd
+        if (header)
+        {
+            header->layout.fetch_add(1, std::memory_order_acq_rel);
+            munmap(region, regionSize);
+            region = nullptr;
+        }
+
+        if (ftruncate(descriptor, (off_t)needed) != 0)
+        {
+            TraceLog(LOG_ERROR, TextFormat("SHARED: Failed to resize %s to %zu bytes: %s", requestedName.c_str(), needed, std::strerror(errno)));
+            return false;
+        }
+        void* mapped = mmap(nullptr, needed, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        if (mapped == MAP_FAILED)
+        {
+            TraceLog(LOG_ERROR, TextFormat("SHARED: Failed to map %s: %s", requestedName.c_str(), std::strerror(errno)));
+            return false;
+        }
+        region = (unsigned char*)mapped;
+        regionSize = needed;
+        header = (SharedStateHeader*)region;
+
+        // Left over from another run with a different layout, start over
+        if (std::memcmp(header->magic, sharedStateMagic, sizeof(sharedStateMagic)) != 0 || header->version != sharedStateVersion)
+        {
+            std::memset((void*)region, 0, sizeof(SharedStateHeader));
+        }
+        if (header->layout.load(std::memory_order_relaxed) % 2 == 0)
+        {
+            header->layout.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+    else
+    {
+        header->layout.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    std::memcpy(header->magic, sharedStateMagic, sizeof(sharedStateMagic));
+    header->version = sharedStateVersion;
+    header->headerSize = sizeof(SharedStateHeader);
+    header->regionSize = regionSize;
+    for (std::size_t s = 0; s < 2; s++)
+    {
+        header->slotOffset[s] = AlignUp(sizeof(SharedStateHeader)) + wanted.size * s;
+        auto slot = (SharedStateSlot*)(region + header->slotOffset[s]);
+        slot->pendulums = 0; // Nothing to read until written again
+        slot->trajectoryPoints = wanted.trajectoryPoints;
+        slot->endPositionOffset = wanted.endPosition;
+        slot->angleOffset = wanted.angle;
+        slot->linkCountOffset = wanted.linkCount;
+        slot->positionOffset = wanted.position;
+        slot->sketchOffset = wanted.sketch;
+        slot->trajectoryOffset = wanted.trajectory;
+        slot->trajectoryIndexOffset = wanted.trajectoryIndex;
+    }
+    header->layout.fetch_add(1, std::memory_order_release);
+
+    layout = wanted;
+    return true;
+}
+
+// Create or open the region requestedName, return false if it failed
+static bool OpenRegion()
+{
+    descriptor = shm_open(requestedName.c_str(), O_CREAT | O_RDWR, 0644);
+    if (descriptor < 0)
+    {
+        TraceLog(LOG_ERROR, TextFormat("SHARED: Failed to open %s: %s", requestedName.c_str(), std::strerror(errno)));
+        return false;
+    }
+
+    TraceLog(LOG_INFO, TextFormat("SHARED: Publishing state to %s", requestedName.c_str()));
+    return true;
+}
+
+#endif
+
+void PublishSharedState([[maybe_unused]] const DivergenceStats& divergence, [[maybe_unused]] bool trajectories, [[maybe_unused]] std::uint64_t resets)
+{
+    if (settings.sharedMemoryName != requestedName)
+    {
+        CloseSharedState();
+        requestedName = settings.sharedMemoryName;
+        openFailed = false;
+    }
+    if (requestedName == "none" || requestedName.empty() || openFailed)
+    {
+        return;
+    }
+
+#if SHARED_STATE_SUPPORTED
+    std::size_t links = 0;
+    for (auto& jp : pendulums)
+    {
+        links += jp.pendulums.size();
+    }
+    const std::size_t points = trajectories && !pendulums.empty() ? pendulums.front().trajectories.size() : 0;
+
+    if (descriptor < 0 && !OpenRegion())
+    {
+        openFailed = true;
+        return;
+    }
+    const SlotLayout wanted = GetSlotLayout(pendulums.size(), links, points);
+    if (!region || !(layout == wanted))
+    {
+        if (!MapRegion(wanted))
+        {
+            CloseSharedState();
+            openFailed = true;
+            return;
+        }
+    }
+
+    // Fill the slot readers are not on, then point them to it
+    auto header = (SharedStateHeader*)region;
+    const std::uint64_t target = 1 - header->latest.load(std::memory_order_relaxed);
+    auto slotStart = region + header->slotOffset[target];
+    auto slot = (SharedStateSlot*)slotStart;
+
+    const std::uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->step = simulationStep;
+    slot->resets = resets;
+    slot->pendulums = pendulums.size();
+    slot->links = links;
+    slot->first = GetEnsembleSliceFirst();
+    slot->ensemble = settings.joinedPendulumsCount;
+    slot->divergenceCount = divergence.count;
+    slot->divergenceMean = divergence.mean;
+    slot->divergenceStandardDeviation = divergence.StandardDeviation();
+    slot->divergenceMedian = divergence.sketch.Quantile(0.5);
+    slot->divergenceMax = divergence.max;
+    std::memcpy(slotStart + layout.sketch, divergence.sketch.counts.data(), sizeof(divergence.sketch.counts));
+
+    auto endPosition = (double*)(slotStart + layout.endPosition);
+    auto angle = (double*)(slotStart + layout.angle);
+    auto linkCount = (std::uint32_t*)(slotStart + layout.linkCount);
+    auto position = (double*)(slotStart + layout.position);
+    auto trajectory = (double*)(slotStart + layout.trajectory);
+    auto trajectoryIndex = (std::uint32_t*)(slotStart + layout.trajectoryIndex);
+    for (std::size_t i = 0; i < pendulums.size(); i++)
+    {
+        auto& jp = pendulums[i];
+        auto& end = jp.pendulums.back().position;
+        endPosition[i * 2] = end.x;
+        endPosition[i * 2 + 1] = end.y;
+        linkCount[i] = (std::uint32_t)jp.pendulums.size();
+        for (auto& p : jp.pendulums)
+        {
+            *angle++ = p.angle;
+            *position++ = p.position.x;
+            *position++ = p.position.y;
+        }
+
+        if (points > 0)
+        {
+            std::memcpy(trajectory + i * points * 2, jp.trajectories.data(), points * sizeof(Vector2Double));
+            trajectoryIndex[i] = (std::uint32_t)jp.trajectoryIndex;
+        }
+    }
+
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+    header->latest.store(target, std::memory_order_release);
+#else
+    TraceLog(LOG_WARNING, "SHARED: Shared memory export is not supported on this platform");
+    openFailed = true;
+#endif
+}
+
+SharedStateHeader* GetSharedStateHeader()
+{
+    return (SharedStateHeader*)region;
+}
+
+void CloseSharedState()
+{
+#if SHARED_STATE_SUPPORTED
+    if (region)
+    {
+        munmap(region, regionSize);
+    }
+    if (descriptor >= 0)
+    {
+        close(descriptor);
+        shm_unlink(requestedName.c_str());
+    }
+#endif
+    region = nullptr;
+    regionSize = 0;
+    descriptor = -1;
+    layout = SlotLayout();
+}
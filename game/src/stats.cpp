@@ -0,0 +1,65 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Ensemble statistics source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "stats.hpp"
+
+#include <algorithm>
+
+double QuantileSketch::Quantile(double q) const
+{
+    if (total == 0)
+    {
+        return 0.0;
+    }
+
+    // Rank of the value, then the bucket holding it
+    auto rank = (std::uint64_t)std::ceil(std::clamp(q, 0.0, 1.0) * total);
+    rank = std::max<std::uint64_t>(rank, 1);
+
+    std::uint64_t seen = 0;
+    std::size_t bucket = 0;
+    for (; bucket < bucketCount - 1; bucket++)
+    {
+        seen += counts[bucket];
+        if (seen >= rank)
+        {
+            break;
+        }
+    }
+
+    if (bucket == 0)
+    {
+        return 0.0;
+    }
+
+    int exponent = (int)(bucket >> subBucketBits) + minExponent;
+    double sub = (double)(bucket & ((1 << subBucketBits) - 1));
+    return std::ldexp(1.0 + (sub + 0.5) / (1 << subBucketBits), exponent);
+}
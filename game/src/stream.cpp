@@ -0,0 +1,575 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Remote viewing source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "stream.hpp"
+#include "kernels.hpp"
+#include "net.hpp"
+#include "pendulum.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using StreamClock = std::chrono::steady_clock;
+
+// Message types, server to viewers and back
+enum StreamMessage : std::uint32_t {
+    StreamInit = 1,     // Reset count and settings, reinitializes the mirror
+    StreamSettings = 2, // Settings that do not need a reset
+    StreamFrame = 3,    // Divergence, fade and position deltas of a step
+    StreamAck = 4,      // Serial of the last frame a viewer took
+    StreamOptions = 5,  // Whether a viewer wants every link
+    StreamReset = 6,    // Viewer asks for a reset
+};
+
+// Leads every Init, a viewer of another version or byte order refuses it
+constexpr std::uint32_t streamProtocol = 0x48445631; // "HDV1"
+
+// Seconds between statistics in the log, while there are viewers
+constexpr double streamLogInterval = 10.0;
+
+// Seconds between connection attempts of a viewer
+constexpr double streamReconnectInterval = 2.0;
+
+// Set by SIGINT and SIGTERM to stop serving
+static volatile std::sig_atomic_t streamStopping = 0;
+
+// Position in quanta
+static std::int64_t Quantize(double value)
+{
+    return (std::int64_t)std::llround(value / streamPositionQuantum);
+}
+
+// Links of every pendulum together
+static std::size_t GetTotalLinks()
+{
+    std::size_t links = 0;
+    for (const auto& jp : pendulums)
+    {
+        links += jp.pendulums.size();
+    }
+    return links;
+}
+
+// StreamViewer, a viewer as seen by the server
+struct StreamViewer {
+    Connection connection;
+    bool full = false;                   // Asked for every link
+    bool quantizedFull = false;          // quantized holds every link
+    std::vector<std::int64_t> quantized; // (x, y) positions sent last, in quanta
+    std::uint64_t sent = 0;              // Serial of the last frame sent
+    std::uint64_t acknowledged = 0;
+    std::uint32_t dropped = 0;           // Since the last frame sent
+};
+
+// Reinitialize the mirror of viewer
+static void SendStreamInit(StreamViewer& viewer, int resets, const std::string& text)
+{
+    MessageWriter message;
+    message.Put(streamProtocol);
+    message.Put<std::int64_t>(resets);
+    message.PutBytes(text.data(), text.size());
+    viewer.connection.Send(StreamInit, message);
+    viewer.quantized.clear();
+}
+
+// Frame of the last step for viewer, positions delta coded against the ones
+// sent to it last, which are updated to positions
+static void WriteStreamFrame(MessageWriter& message, StreamViewer& viewer, const DivergenceStats& divergence, float alpha, const std::vector<std::int64_t>& positions)
+{
+    viewer.sent++;
+    message.Put<std::uint64_t>(viewer.sent);
+    message.Put<std::uint64_t>(simulationStep);
+    message.Put(alpha);
+    message.Put(viewer.dropped);
+    message.Put<std::uint8_t>(viewer.full);
+    WriteDivergence(message, divergence, divergence.sketch);
+
+    // Switching between end positions and every link starts over from zero
+    if (viewer.quantizedFull != viewer.full || viewer.quantized.size() != positions.size())
+    {
+        viewer.quantized.assign(positions.size(), 0);
+        viewer.quantizedFull = viewer.full;
+    }
+    message.PutVarint(positions.size() / 2);
+    for (std::size_t i = 0; i < positions.size(); i++)
+    {
+        message.PutSignedVarint(positions[i] - viewer.quantized[i]);
+        viewer.quantized[i] = positions[i];
+    }
+    viewer.dropped = 0;
+}
+
+int RunStreamServer(std::string_view address, const char* settingsFilename)
+{
+    int modTime = 0;
+    auto loadSettings = [&]() {
+        bool needsReset = false;
+        if (FileExists(settingsFilename))
+        {
+            needsReset = settings.LoadSettings(settingsFilename);
+            modTime = GetFileModTime(settingsFilename);
+        }
+        return needsReset;
+    };
+
+    loadSettings();
+    SelectKernels(settings.kernelLevel, settings.deterministic);
+    workers.Start(settings.workerThreads, settings.numaAware);
+
+    const int listener = ListenSocket(address);
+    if (listener < 0)
+    {
+        workers.Stop();
+        return 1;
+    }
+    std::signal(SIGINT, [](int) { streamStopping = 1; });
+    std::signal(SIGTERM, [](int) { streamStopping = 1; });
+
+    int resets = 0;
+    InitializePendulums(resets);
+    TraceLog(LOG_INFO, TextFormat("STREAM: Serving %zu pendulums on %s at %.0f steps/s", pendulums.size(), std::string(address).c_str(), streamStepRate));
+
+    std::vector<std::unique_ptr<StreamViewer>> viewers;
+    std::string text = settings.FormatSettings();
+    bool resetRequested = false;
+    MessageHeader header;
+    std::vector<unsigned char> payload;
+
+    // Take new viewers and their acknowledgements and requests
+    auto serve = [&]() {
+        for (int s = AcceptSocket(listener); s >= 0; s = AcceptSocket(listener))
+        {
+            viewers.push_back(std::make_unique<StreamViewer>());
+            viewers.back()->connection.Open(s);
+            SendStreamInit(*viewers.back(), resets, text);
+            TraceLog(LOG_INFO, TextFormat("STREAM: Viewer %zu connected", viewers.size() - 1));
+        }
+
+        for (std::size_t v = 0; v < viewers.size(); v++)
+        {
+            auto& viewer = *viewers[v];
+            while (viewer.connection.Receive(header, payload))
+            {
+                MessageReader reader(payload);
+                if (header.type == StreamAck)
+                {
+                    viewer.acknowledged = std::max(viewer.acknowledged, std::min(reader.Get<std::uint64_t>(), viewer.sent));
+                }
+                else if (header.type == StreamOptions)
+                {
+                    viewer.full = reader.Get<std::uint8_t>() != 0;
+                }
+                else if (header.type == StreamReset)
+                {
+                    resetRequested = true;
+                }
+                else
+                {
+                    TraceLog(LOG_WARNING, TextFormat("STREAM: Unexpected message %u from viewer %zu", header.type, v));
+                    viewer.connection.Close();
+                }
+            }
+            viewer.connection.Flush();
+            if (viewer.connection.closed)
+            {
+                TraceLog(LOG_INFO, TextFormat("STREAM: Viewer %zu disconnected", v));
+            }
+        }
+        std::erase_if(viewers, [](const auto& viewer) { return viewer->connection.closed; });
+    };
+
+    const auto interval = std::chrono::duration_cast<StreamClock::duration>(std::chrono::duration<double>(1.0 / streamStepRate));
+    auto next = StreamClock::now();
+    auto logged = next;
+    StreamClock::time_point fadeEnd;
+    bool fading = false;
+    float alpha = 1.0f;
+    DivergenceStats divergence;
+    std::vector<std::int64_t> ends;
+    std::vector<std::int64_t> links;
+    std::uint64_t framesSent = 0;
+    std::uint64_t framesDropped = 0;
+    std::uint64_t bytesSent = 0;
+    MessageWriter frame;
+    while (!streamStopping)
+    {
+        // Serve viewers until the next step is due, without catching up on
+        // steps missed while stalled
+        for (auto now = StreamClock::now(); now < next; now = StreamClock::now())
+        {
+            std::vector<int> sockets = { listener };
+            for (auto& viewer : viewers)
+            {
+                sockets.push_back(viewer->connection.socket);
+            }
+            WaitForInput(sockets, std::chrono::duration<double>(next - now).count());
+            serve();
+        }
+        serve();
+        next = std::max(next + interval, StreamClock::now() - interval);
+
+        if (FileExists(settingsFilename) && GetFileModTime(settingsFilename) != modTime)
+        {
+            std::size_t threads = settings.workerThreads;
+            bool needsReset = loadSettings();
+            SelectKernels(settings.kernelLevel, settings.deterministic);
+            if (settings.workerThreads != threads)
+            {
+                workers.Start(settings.workerThreads, settings.numaAware);
+            }
+
+            text = settings.FormatSettings();
+            if (needsReset)
+            {
+                resets = 0;
+                fading = false;
+                alpha = 1.0f;
+                InitializePendulums(resets);
+            }
+            for (auto& viewer : viewers)
+            {
+                if (needsReset)
+                {
+                    SendStreamInit(*viewer, resets, text);
+                }
+                else
+                {
+                    viewer->connection.Send(StreamSettings, text.data(), text.size());
+                }
+            }
+            TraceLog(LOG_INFO, TextFormat("STREAM: Reloaded %s%s", settingsFilename, needsReset ? " and reset simulation" : ""));
+        }
+
+        // Fade out, then reset, as the window does
+        auto now = StreamClock::now();
+        if (!fading && (resetRequested || divergence.Statistic(settings.resetQuantile) > settings.resetThreshold))
+        {
+            fading = true;
+            fadeEnd = now + std::chrono::duration_cast<StreamClock::duration>(std::chrono::duration<double>(settings.resetFadeTime));
+        }
+        resetRequested = false;
+        if (fading)
+        {
+            double left = std::chrono::duration<double>(fadeEnd - now).count();
+            alpha = settings.resetFadeTime > 0.0 ? (float)std::clamp(left / settings.resetFadeTime, 0.0, 1.0) : 0.0f;
+            if (left <= 0.0)
+            {
+                resets++;
+                fading = false;
+                alpha = 1.0f;
+                InitializePendulums(resets);
+                for (auto& viewer : viewers)
+                {
+                    SendStreamInit(*viewer, resets, text);
+                }
+            }
+        }
+
+        UpdatePendulums();
+        divergence = GetDivergence();
+
+        // Quantized once for every viewer, every link only if one asked
+        ends.resize(pendulums.size() * 2);
+        for (std::size_t i = 0; i < pendulums.size(); i++)
+        {
+            auto position = pendulums[i].pendulums.empty() ? Vector2Double() : pendulums[i].pendulums.back().position;
+            ends[i * 2] = Quantize(position.x);
+            ends[i * 2 + 1] = Quantize(position.y);
+        }
+        links.clear();
+        if (std::any_of(viewers.begin(), viewers.end(), [](const auto& viewer) { return viewer->full; }))
+        {
+            links.reserve(GetTotalLinks() * 2);
+            for (const auto& jp : pendulums)
+            {
+                for (const auto& p : jp.pendulums)
+                {
+                    links.push_back(Quantize(p.position.x));
+                    links.push_back(Quantize(p.position.y));
+                }
+            }
+        }
+
+        // Drop frames for viewers that did not take the earlier ones yet
+        for (auto& viewer : viewers)
+        {
+            if (viewer->connection.Pending() > 0 || viewer->sent - viewer->acknowledged >= streamFramesInFlight)
+            {
+                viewer->dropped++;
+                framesDropped++;
+                continue;
+            }
+
+            frame.data.clear();
+            WriteStreamFrame(frame, *viewer, divergence, alpha, viewer->full ? links : ends);
+            viewer->connection.Send(StreamFrame, frame);
+            framesSent++;
+            bytesSent += frame.data.size() + sizeof(MessageHeader);
+        }
+
+        if (std::chrono::duration<double>(now - logged).count() >= streamLogInterval && !viewers.empty())
+        {
+            TraceLog(LOG_INFO, TextFormat("STREAM: %zu viewers, %llu frames sent (%.1f KB each), %llu dropped",
+                viewers.size(), (unsigned long long)framesSent, framesSent > 0 ? bytesSent / 1024.0 / framesSent : 0.0, (unsigned long long)framesDropped));
+            logged = now;
+        }
+    }
+
+    viewers.clear();
+    CloseSocket(listener);
+    if (address.starts_with("unix:"))
+    {
+        std::remove(std::string(address.substr(5)).c_str());
+    }
+    workers.Stop();
+    TraceLog(LOG_INFO, "STREAM: Stopped");
+    return 0;
+}
+
+static std::string viewerAddress;       // Empty if not a viewer
+static Connection viewerConnection;
+static SimulationSettings viewerLocal;  // Settings of this machine, before the server's
+static StreamView view;
+static bool viewerFull = false;         // Asked the server for every link
+static bool quantizedFull = false;      // viewerQuantized holds every link
+static std::vector<std::int64_t> viewerQuantized;
+static std::uint64_t viewerSerial = 0;  // Of the last frame taken
+static std::uint64_t viewerAcknowledged = 0;
+static double viewerAttempt = -streamReconnectInterval;
+
+// Settings of the server, with the ones about this machine kept
+static void ApplyStreamSettings(std::string_view text)
+{
+    SimulationSettings loaded = settings;
+    loaded.LoadSettingsText(text);
+    loaded.kernelLevel = viewerLocal.kernelLevel;
+    loaded.deterministic = viewerLocal.deterministic;
+    loaded.workerThreads = viewerLocal.workerThreads;
+    loaded.workChunkSize = viewerLocal.workChunkSize;
+    loaded.numaAware = viewerLocal.numaAware;
+    loaded.autoTune = viewerLocal.autoTune;
+    loaded.sharedMemoryName = viewerLocal.sharedMemoryName;
+    settings = loaded;
+}
+
+// Mirror a frame into pendulums, false if it does not match them
+static bool ReadStreamFrame(const std::vector<unsigned char>& payload, bool capture)
+{
+    MessageReader reader(payload);
+    std::uint64_t serial = reader.Get<std::uint64_t>();
+    std::uint64_t step = reader.Get<std::uint64_t>();
+    float alpha = reader.Get<float>();
+    std::uint32_t dropped = reader.Get<std::uint32_t>();
+    bool full = reader.Get<std::uint8_t>() != 0;
+    DistanceMoments moments;
+    QuantileSketch sketch;
+    if (!ReadDivergence(reader, moments, sketch))
+    {
+        return false;
+    }
+
+    std::size_t count = reader.GetVarint();
+    if (count != (full ? GetTotalLinks() : pendulums.size()))
+    {
+        return false;
+    }
+    if (quantizedFull != full || viewerQuantized.size() != count * 2)
+    {
+        viewerQuantized.assign(count * 2, 0);
+        quantizedFull = full;
+    }
+
+    std::size_t index = 0;
+    auto next = [&]() {
+        auto& x = viewerQuantized[index * 2];
+        auto& y = viewerQuantized[index * 2 + 1];
+        x += reader.GetSignedVarint();
+        y += reader.GetSignedVarint();
+        index++;
+        return Vector2Double(x * streamPositionQuantum, y * streamPositionQuantum);
+    };
+    for (auto& jp : pendulums)
+    {
+        if (full)
+        {
+            for (auto& p : jp.pendulums)
+            {
+                p.position = next();
+            }
+        }
+        else if (!jp.pendulums.empty())
+        {
+            jp.pendulums.back().position = next();
+        }
+        if (capture)
+        {
+            jp.CaptureTrajectory();
+        }
+    }
+    if (!reader.ok)
+    {
+        return false;
+    }
+
+    viewerSerial = serial;
+    view.step = step;
+    view.alpha = alpha;
+    view.frames++;
+    view.dropped += dropped;
+    view.divergence = DivergenceStats();
+    view.divergence.Merge(moments.count, moments.mean, moments.m2, moments.max);
+    view.divergence.sketch = sketch;
+    return true;
+}
+
+void StartStreamViewer(std::string_view address)
+{
+    StopStreamViewer();
+    viewerAddress = address;
+    viewerLocal = settings;
+    view = StreamView();
+}
+
+void StopStreamViewer()
+{
+    viewerConnection.Close();
+    viewerAddress.clear();
+    view.connected = false;
+}
+
+bool StreamViewerRunning()
+{
+    return !viewerAddress.empty();
+}
+
+const StreamView& ReceiveStream(bool full, bool capture)
+{
+    if (!StreamViewerRunning())
+    {
+        return view;
+    }
+
+    // The server may be starting or restarting
+    if (viewerConnection.closed)
+    {
+        view.connected = false;
+        if (GetTime() - viewerAttempt < streamReconnectInterval)
+        {
+            return view;
+        }
+        viewerAttempt = GetTime();
+        viewerConnection.Open(ConnectSocket(viewerAddress));
+        if (viewerConnection.closed)
+        {
+            return view;
+        }
+        TraceLog(LOG_INFO, TextFormat("STREAM: Connected to %s", viewerAddress.c_str()));
+        view.connected = true;
+        viewerFull = false;
+        viewerSerial = 0;
+        viewerAcknowledged = 0;
+    }
+
+    if (full != viewerFull)
+    {
+        std::uint8_t option = full;
+        viewerConnection.Send(StreamOptions, &option, sizeof(option));
+        viewerFull = full;
+    }
+
+    MessageHeader header;
+    std::vector<unsigned char> payload;
+    while (viewerConnection.Receive(header, payload))
+    {
+        MessageReader reader(payload);
+        bool valid = true;
+        if (header.type == StreamInit)
+        {
+            valid = reader.Get<std::uint32_t>() == streamProtocol;
+            if (valid)
+            {
+                view.resets = (int)reader.Get<std::int64_t>();
+                ApplyStreamSettings(reader.GetRest());
+                InitializePendulums(view.resets);
+                viewerQuantized.clear();
+            }
+            else
+            {
+                TraceLog(LOG_ERROR, "STREAM: Server speaks another protocol version or byte order");
+            }
+        }
+        else if (header.type == StreamSettings)
+        {
+            ApplyStreamSettings(reader.GetRest());
+        }
+        else
+        {
+            valid = header.type == StreamFrame && ReadStreamFrame(payload, capture);
+            if (!valid)
+            {
+                TraceLog(LOG_WARNING, TextFormat("STREAM: Unexpected message %u from server", header.type));
+            }
+        }
+
+        if (!valid)
+        {
+            viewerConnection.Close();
+            break;
+        }
+    }
+
+    // Taking frames as fast as they come in lets the server send more
+    if (!viewerConnection.closed && viewerSerial != viewerAcknowledged)
+    {
+        viewerConnection.Send(StreamAck, &viewerSerial, sizeof(viewerSerial));
+        viewerAcknowledged = viewerSerial;
+    }
+    if (viewerConnection.closed && view.connected)
+    {
+        TraceLog(LOG_WARNING, TextFormat("STREAM: Disconnected from %s", viewerAddress.c_str()));
+        view.connected = false;
+    }
+    return view;
+}
+
+void RequestStreamReset()
+{
+    if (!viewerConnection.closed)
+    {
+        viewerConnection.Send(StreamReset, nullptr, 0);
+    }
+}
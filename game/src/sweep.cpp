@@ -0,0 +1,655 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Parameter sweep source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "sweep.hpp"
+#include "kernels.hpp"
+#include "net.hpp"
+#include "pendulum.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define SWEEP_PROCESSES 1
+#else
+#define SWEEP_PROCESSES 0
+#endif
+
+// Message types, coordinator to workers and back
+enum SweepMessage : std::uint32_t {
+    SweepJobMessage = 1,    // Job index, step limit and settings
+    SweepResultMessage = 2, // Job index and SweepResult fields
+};
+
+// Leads every message, a worker or coordinator of another version or byte
+// order refuses it
+constexpr std::uint32_t sweepProtocol = 0x48445331; // "HDS1"
+
+// Connection attempts of a worker before giving up, a second apart
+constexpr int sweepConnectAttempts = 30;
+
+// Seconds between progress lines
+constexpr double sweepProgressInterval = 1.0;
+
+// Result fields one by one, so the message does not depend on struct layout
+static void PutSweepResult(MessageWriter& message, const SweepResult& result)
+{
+    message.Put<std::uint64_t>(result.steps);
+    message.Put<std::uint8_t>(result.diverged);
+    message.Put(result.divergenceTime);
+    message.Put(result.energyDrift);
+    message.Put(result.stepNanoseconds);
+    message.Put(result.stepSeconds);
+}
+
+static SweepResult GetSweepResult(MessageReader& reader)
+{
+    SweepResult result = {};
+    result.steps = reader.Get<std::uint64_t>();
+    result.diverged = reader.Get<std::uint8_t>() != 0;
+    result.divergenceTime = reader.Get<double>();
+    result.energyDrift = reader.Get<double>();
+    result.stepNanoseconds = reader.Get<double>();
+    result.stepSeconds = reader.Get<double>();
+    return result;
+}
+
+std::vector<SweepParameter> ParseSweep(std::string_view text)
+{
+    // Keys are checked against a settings file, so typos do not sweep nothing
+    const std::string known = SimulationSettings().FormatSettings();
+
+    std::vector<SweepParameter> parameters;
+    std::istringstream lines{ std::string(text) };
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        line = line.substr(0, line.find(';'));
+        std::istringstream tokens(line);
+        SweepParameter parameter;
+        if (!(tokens >> parameter.key))
+        {
+            continue;
+        }
+        if (known.find("\n" + parameter.key + " ") == std::string::npos)
+        {
+            throw std::invalid_argument("Unknown setting " + parameter.key);
+        }
+
+        for (std::string token; tokens >> token;)
+        {
+            auto first = token.find(':');
+            auto second = token.find(':', first + 1);
+            if (first == std::string::npos)
+            {
+                parameter.values.push_back(token);
+                continue;
+            }
+            if (second == std::string::npos)
+            {
+                throw std::invalid_argument("Expected start:stop:count for " + parameter.key);
+            }
+
+            double start = std::stod(token.substr(0, first));
+            double stop = std::stod(token.substr(first + 1, second - first - 1));
+            std::size_t count = std::stoul(token.substr(second + 1));
+            for (std::size_t i = 0; i < count; i++)
+            {
+                double value = count > 1 ? start + (stop - start) * i / (count - 1) : start;
+                parameter.values.push_back(TextFormat("%.15g", value));
+            }
+        }
+        if (parameter.values.empty())
+        {
+            throw std::invalid_argument("No values for " + parameter.key);
+        }
+        parameters.push_back(std::move(parameter));
+    }
+    return parameters;
+}
+
+std::vector<std::vector<std::string>> ExpandSweep(const std::vector<SweepParameter>& parameters)
+{
+    std::vector<std::vector<std::string>> combinations(1);
+    for (auto& parameter : parameters)
+    {
+        std::vector<std::vector<std::string>> expanded;
+        for (auto& combination : combinations)
+        {
+            for (auto& value : parameter.values)
+            {
+                expanded.push_back(combination);
+                expanded.back().push_back(value);
+            }
+        }
+        combinations = std::move(expanded);
+    }
+    return combinations;
+}
+
+SweepResult RunSweepJob(std::uint64_t steps)
+{
+    using Clock = std::chrono::steady_clock;
+
+    InitializePendulums();
+    const EnergyTotals initial = GetEnergy();
+
+    SweepResult result = {};
+    double seconds = 0.0;
+    while (result.steps < steps)
+    {
+        auto start = Clock::now();
+        UpdatePendulums();
+        seconds += std::chrono::duration<double>(Clock::now() - start).count();
+        result.steps++;
+
+        if (GetDivergence().Statistic(settings.resetQuantile) > settings.resetThreshold)
+        {
+            result.diverged = true;
+            result.divergenceTime = result.steps * settings.fixedDeltaTime;
+            break;
+        }
+    }
+
+    const EnergyTotals final = GetEnergy();
+    result.energyDrift = initial.scale > 0.0 ? (final.energy - initial.energy) / initial.scale : 0.0;
+    const double pendulumSteps = (double)result.steps * pendulums.size();
+    result.stepNanoseconds = pendulumSteps > 0.0 ? seconds * 1e9 / pendulumSteps : 0.0;
+    result.stepSeconds = seconds;
+    return result;
+}
+
+// SweepJob, a combination and how it went
+struct SweepJob {
+    std::vector<std::string> values;
+    int attempts = 0;
+    bool done = false;
+    bool failed = false; // Handed out sweepAttempts times without a result
+    SweepResult result = {};
+};
+
+// SweepLink, a connected worker and the job it runs, -1 if idle
+struct SweepLink {
+    Connection connection;
+    std::ptrdiff_t job = -1;
+};
+
+#if SWEEP_PROCESSES
+
+// Start a worker process of executable connecting to address
+static pid_t SpawnSweepWorker(const char* executable, const std::string& address)
+{
+#ifdef __linux__
+    executable = "/proc/self/exe";
+#endif
+    std::string argument = "--sweep-worker=" + address;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execl(executable, executable, argument.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+    if (pid < 0)
+    {
+        TraceLog(LOG_ERROR, TextFormat("SWEEP: Failed to start worker process: %s", std::strerror(errno)));
+    }
+    return pid;
+}
+
+#endif
+
+// Table of results, a column per parameter and per measurement, aligned
+static std::string FormatSweepTable(const std::vector<SweepParameter>& parameters, const std::vector<SweepJob>& jobs)
+{
+    std::vector<std::vector<std::string>> rows;
+    std::vector<std::string> header;
+    for (auto& parameter : parameters)
+    {
+        header.push_back(parameter.key);
+    }
+    for (auto name : { "divergenceTime", "energyDrift", "nsPerStep", "steps", "attempts" })
+    {
+        header.push_back(name);
+    }
+    rows.push_back(header);
+
+    for (auto& job : jobs)
+    {
+        auto row = job.values;
+        if (job.failed)
+        {
+            row.insert(row.end(), { "failed", "-", "-", "-" });
+        }
+        else
+        {
+            row.push_back(job.result.diverged ? TextFormat("%.3f", job.result.divergenceTime) : "never");
+            row.push_back(TextFormat("%.3e", job.result.energyDrift));
+            row.push_back(TextFormat("%.2f", job.result.stepNanoseconds));
+            row.push_back(std::to_string(job.result.steps));
+        }
+        row.push_back(std::to_string(job.attempts));
+        rows.push_back(row);
+    }
+
+    std::vector<std::size_t> widths(header.size(), 0);
+    for (auto& row : rows)
+    {
+        for (std::size_t c = 0; c < row.size(); c++)
+        {
+            widths[c] = std::max(widths[c], row[c].size());
+        }
+    }
+
+    std::string table;
+    for (auto& row : rows)
+    {
+        for (std::size_t c = 0; c < row.size(); c++)
+        {
+            table += row[c];
+            table += c + 1 < row.size() ? std::string(widths[c] - row[c].size() + 2, ' ') : "\n";
+        }
+    }
+    return table;
+}
+
+// Field of a comma separated row, quoted if it holds a comma (link mixes)
+static std::string CsvField(const std::string& value)
+{
+    if (value.find_first_of(",\"") == std::string::npos)
+    {
+        return value;
+    }
+    std::string quoted = "\"";
+    for (char c : value)
+    {
+        quoted += c == '"' ? "\"\"" : std::string(1, c);
+    }
+    return quoted + "\"";
+}
+
+// Same results as comma separated values, numbers only, empty where there is
+// no value (time of jobs that never diverged, measurements of failed jobs)
+static std::string FormatSweepCsv(const std::vector<SweepParameter>& parameters, const std::vector<SweepJob>& jobs)
+{
+    std::string csv;
+    for (auto& parameter : parameters)
+    {
+        csv += CsvField(parameter.key) + ",";
+    }
+    csv += "diverged,divergenceTime,steps,stepSeconds,nsPerStep,energyDrift,attempts,failed\n";
+
+    for (auto& job : jobs)
+    {
+        for (auto& value : job.values)
+        {
+            csv += CsvField(value) + ",";
+        }
+        const auto& r = job.result;
+        if (job.failed)
+        {
+            csv += TextFormat(",,,,,,%d,1\n", job.attempts);
+            continue;
+        }
+        csv += TextFormat("%d,", (int)r.diverged);
+        csv += r.diverged ? TextFormat("%.6f,", r.divergenceTime) : ",";
+        csv += TextFormat("%llu,%.6f,%.3f,%.6e,%d,0\n", (unsigned long long)r.steps, r.stepSeconds, r.stepNanoseconds, r.energyDrift, job.attempts);
+    }
+    return csv;
+}
+
+int RunSweep(const char* sweepFilename, const char* settingsFilename, const char* resultsFilename, const char* csvFilename, std::size_t localWorkers, std::string_view listenAddress, std::uint64_t steps, [[maybe_unused]] const char* executable)
+{
+    using Clock = std::chrono::steady_clock;
+
+    if (!FileExists(sweepFilename))
+    {
+        std::printf("Sweep file %s not found\n", sweepFilename);
+        return 1;
+    }
+    auto sweepText = LoadFileText(sweepFilename);
+    std::vector<SweepParameter> parameters;
+    try
+    {
+        parameters = ParseSweep(sweepText);
+    }
+
+    // Probably std::invalid_argument
+    catch (const std::exception& e)
+    {
+        UnloadFileText(sweepText);
+        std::printf("Invalid sweep file %s: %s\n", sweepFilename, e.what());
+        return 1;
+    }
+    UnloadFileText(sweepText);
+
+    if (FileExists(settingsFilename))
+    {
+        settings.LoadSettings(settingsFilename);
+    }
+    const std::string base = settings.FormatSettings();
+
+    std::vector<SweepJob> jobs;
+    for (auto& values : ExpandSweep(parameters))
+    {
+        jobs.push_back({ values });
+    }
+    std::deque<std::size_t> queue(jobs.size());
+    for (std::size_t j = 0; j < jobs.size(); j++)
+    {
+        queue[j] = j;
+    }
+
+    // Local workers on a Unix domain socket, others on listenAddress
+    std::vector<int> listeners;
+    std::string localAddress;
+#if SWEEP_PROCESSES
+    localAddress = "unix:/tmp/hdp_sweep_" + std::to_string((long)getpid()) + ".sock";
+    if (localWorkers > 0)
+    {
+        listeners.push_back(ListenSocket(localAddress));
+    }
+#else
+    if (localWorkers > 0)
+    {
+        TraceLog(LOG_WARNING, "SWEEP: Worker processes are not supported on this platform, only connecting workers run jobs");
+    }
+    localWorkers = 0;
+#endif
+    if (!listenAddress.empty())
+    {
+        listeners.push_back(ListenSocket(listenAddress));
+    }
+    if (listeners.empty() || std::find(listeners.begin(), listeners.end(), -1) != listeners.end())
+    {
+        for (int listener : listeners)
+        {
+            CloseSocket(listener);
+        }
+        std::printf("No workers to run the sweep on\n");
+        return 1;
+    }
+
+#if SWEEP_PROCESSES
+    std::vector<pid_t> processes;
+    for (std::size_t w = 0; w < localWorkers; w++)
+    {
+        processes.push_back(SpawnSweepWorker(executable, localAddress));
+    }
+
+    // Workers that exit are started again while jobs are left, within reason
+    std::size_t restartsLeft = jobs.size() * sweepAttempts;
+#endif
+
+    std::printf("Sweep: %zu jobs of %llu steps over %zu parameters, %zu local workers\n", jobs.size(), (unsigned long long)steps, parameters.size(), localWorkers);
+    std::vector<std::unique_ptr<SweepLink>> links;
+    std::size_t finished = 0;
+    std::size_t retried = 0;
+    auto start = Clock::now();
+    auto progress = start;
+    MessageHeader header;
+    std::vector<unsigned char> payload;
+    while (finished < jobs.size())
+    {
+        for (int listener : listeners)
+        {
+            for (int s = AcceptSocket(listener); s >= 0; s = AcceptSocket(listener))
+            {
+                links.push_back(std::make_unique<SweepLink>());
+                links.back()->connection.Open(s);
+            }
+        }
+
+        for (std::size_t l = 0; l < links.size();)
+        {
+            auto& link = *links[l];
+            while (link.connection.Receive(header, payload))
+            {
+                MessageReader reader(payload);
+                const bool protocol = reader.Get<std::uint32_t>() == sweepProtocol;
+                const std::uint64_t index = reader.Get<std::uint64_t>();
+                const SweepResult result = GetSweepResult(reader);
+                if (header.type != SweepResultMessage || !protocol || !reader.ok || (std::ptrdiff_t)index != link.job)
+                {
+                    TraceLog(LOG_WARNING, "SWEEP: Unexpected message from a worker, disconnecting it");
+                    link.connection.Close();
+                    break;
+                }
+                jobs[index].result = result;
+                jobs[index].done = true;
+                link.job = -1;
+                finished++;
+            }
+
+            // Its job goes back to the queue, or fails after enough attempts
+            if (link.connection.closed)
+            {
+                if (link.job >= 0)
+                {
+                    auto& job = jobs[link.job];
+                    if (job.attempts >= sweepAttempts)
+                    {
+                        job.failed = true;
+                        finished++;
+                    }
+                    else
+                    {
+                        queue.push_front(link.job);
+                        retried++;
+                    }
+                }
+                links.erase(links.begin() + l);
+                continue;
+            }
+            l++;
+        }
+
+#if SWEEP_PROCESSES
+        for (auto& pid : processes)
+        {
+            if (pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid)
+            {
+                pid = -1;
+            }
+            if (pid < 0 && restartsLeft > 0 && !queue.empty())
+            {
+                restartsLeft--;
+                pid = SpawnSweepWorker(executable, localAddress);
+            }
+        }
+
+        // Without workers left to come, the rest of the jobs fail
+        bool starting = std::any_of(processes.begin(), processes.end(), [](pid_t pid) { return pid > 0; });
+        if (links.empty() && !starting && listenAddress.empty())
+        {
+            TraceLog(LOG_ERROR, "SWEEP: No workers left to run the remaining jobs");
+            for (auto index : queue)
+            {
+                jobs[index].failed = true;
+                finished++;
+            }
+            queue.clear();
+        }
+#endif
+
+        for (auto& link : links)
+        {
+            if (link->job < 0 && !queue.empty())
+            {
+                const std::size_t index = queue.front();
+                queue.pop_front();
+                auto& job = jobs[index];
+                job.attempts++;
+                link->job = (std::ptrdiff_t)index;
+
+                MessageWriter message;
+                message.Put(sweepProtocol);
+                message.Put<std::uint64_t>(index);
+                message.Put<std::uint64_t>(steps);
+                message.PutBytes(base.data(), base.size());
+                for (std::size_t p = 0; p < parameters.size(); p++)
+                {
+                    std::string line = "\n" + parameters[p].key + " " + job.values[p];
+                    message.PutBytes(line.data(), line.size());
+                }
+                link->connection.Send(SweepJobMessage, message);
+            }
+        }
+
+        auto now = Clock::now();
+        if (std::chrono::duration<double>(now - progress).count() >= sweepProgressInterval)
+        {
+            progress = now;
+            std::size_t running = std::count_if(links.begin(), links.end(), [](const auto& link) { return link->job >= 0; });
+            std::printf("Sweep: %zu of %zu jobs done, %zu running on %zu workers, %zu retried, %.0f s\n",
+                finished, jobs.size(), running, links.size(), retried, std::chrono::duration<double>(now - start).count());
+            std::fflush(stdout);
+        }
+
+        std::vector<int> sockets = listeners;
+        for (auto& link : links)
+        {
+            sockets.push_back(link->connection.socket);
+        }
+        WaitForInput(sockets, 0.1);
+    }
+
+    // Workers exit once disconnected
+    links.clear();
+    for (int listener : listeners)
+    {
+        CloseSocket(listener);
+    }
+#if SWEEP_PROCESSES
+    for (auto pid : processes)
+    {
+        if (pid > 0)
+        {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    unlink(localAddress.substr(5).c_str());
+#endif
+
+    std::string table = FormatSweepTable(parameters, jobs);
+    std::printf("Sweep: %zu jobs in %.1f s, %zu retried\n\n%s", jobs.size(), std::chrono::duration<double>(Clock::now() - start).count(), retried, table.c_str());
+    SaveFileText(resultsFilename, table.data());
+    std::string csv = FormatSweepCsv(parameters, jobs);
+    SaveFileText(csvFilename, csv.data());
+    std::printf("\nSaved results to %s and %s\n", resultsFilename, csvFilename);
+    return 0;
+}
+
+int RunSweepWorker(std::string_view address, const char* settingsFilename, [[maybe_unused]] std::size_t localWorkers, [[maybe_unused]] const char* executable)
+{
+#if SWEEP_PROCESSES
+    // The others are plain workers of their own
+    std::vector<pid_t> processes;
+    for (std::size_t w = 1; w < localWorkers; w++)
+    {
+        processes.push_back(SpawnSweepWorker(executable, std::string(address)));
+    }
+#endif
+
+    SimulationSettings local;
+    if (FileExists(settingsFilename))
+    {
+        local.LoadSettings(settingsFilename);
+    }
+
+    // Many single threaded jobs side by side keep every core busy
+    workers.Start(1, false);
+
+    Connection connection;
+    for (int attempt = 0; attempt < sweepConnectAttempts && connection.closed; attempt++)
+    {
+        if (attempt > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        connection.Open(ConnectSocket(address));
+    }
+
+    const bool connected = !connection.closed;
+    MessageHeader header;
+    std::vector<unsigned char> payload;
+    while (connection.Wait(header, payload))
+    {
+        if (header.type != SweepJobMessage)
+        {
+            TraceLog(LOG_ERROR, TextFormat("SWEEP: Unexpected message %u from coordinator", header.type));
+            break;
+        }
+
+        MessageReader reader(payload);
+        if (reader.Get<std::uint32_t>() != sweepProtocol)
+        {
+            TraceLog(LOG_ERROR, "SWEEP: Coordinator speaks another protocol version or byte order");
+            break;
+        }
+        const std::uint64_t index = reader.Get<std::uint64_t>();
+        const std::uint64_t steps = reader.Get<std::uint64_t>();
+        settings = SimulationSettings();
+        settings.LoadSettingsText(reader.GetRest());
+        settings.kernelLevel = local.kernelLevel;
+        settings.workerThreads = 1;
+        settings.numaAware = false;
+        settings.autoTune = false;
+        settings.sharedMemoryName = "none";
+        SelectKernels(settings.kernelLevel, settings.deterministic);
+
+        MessageWriter message;
+        message.Put(sweepProtocol);
+        message.Put(index);
+        PutSweepResult(message, RunSweepJob(steps));
+        connection.Send(SweepResultMessage, message);
+    }
+
+    workers.Stop();
+#if SWEEP_PROCESSES
+    for (auto pid : processes)
+    {
+        if (pid > 0)
+        {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+#endif
+    return connected ? 0 : 1;
+}
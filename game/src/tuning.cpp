@@ -0,0 +1,251 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Startup auto-tuner source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "tuning.hpp"
+#include "kernels.hpp"
+#include "pendulum.hpp"
+#include "workers.hpp"
+
+#include <chrono>
+#include <ranges>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "raylib.h"
+
+std::string GetTuningKey()
+{
+    // Implicit and chain steps cost far more than explicit ones, and a plugin
+    // anything at all
+    std::string plugin = settings.kernelPlugin == "none" ? "" : " | plugin " + settings.kernelPlugin;
+    return TextFormat("%s | %u threads | %zu x %s joined | %s%s%s",
+        GetCpuModelName().c_str(),
+        std::thread::hardware_concurrency(),
+        settings.joinedPendulumsCount,
+        settings.pendulumsJoinedMix == "none" ? TextFormat("%zu", settings.pendulumsJoined) : settings.pendulumsJoinedMix.c_str(),
+        settings.integrator.c_str(),
+        plugin.c_str(),
+        settings.deterministic ? " | deterministic" : ""
+    );
+}
+
+// Average nanoseconds per pendulum step with the current configuration
+static double MeasureStep()
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr double minimumSeconds = 0.01;
+
+    // Warm up caches and thread wake up
+    UpdatePendulums();
+
+    std::size_t steps = 0;
+    double seconds = 0.0;
+    auto start = Clock::now();
+    while (seconds < minimumSeconds && steps < 1000)
+    {
+        UpdatePendulums();
+        steps++;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    return seconds * 1e9 / ((double)steps * std::max<std::size_t>(pendulums.size(), 1));
+}
+
+// Cache lines are "key<TAB>threads<TAB>chunk<TAB>level<TAB>ns"
+static bool LoadTuning(std::string_view cacheFilename, const std::string& key, TuningResult& result)
+{
+    std::string filename(cacheFilename);
+    if (!FileExists(filename.c_str()))
+    {
+        return false;
+    }
+
+    auto tmp = LoadFileText(filename.c_str());
+    auto text = std::string(tmp);
+    UnloadFileText(tmp);
+
+    std::istringstream lines(text);
+    for (std::string line; std::getline(lines, line);)
+    {
+        std::vector<std::string> fields;
+        for (auto field : line | std::views::split('\t'))
+        {
+            fields.emplace_back(field.begin(), field.end());
+        }
+
+        if (fields.size() != 5 || fields[0] != key)
+        {
+            continue;
+        }
+
+        try
+        {
+            result.workerThreads = std::stoul(fields[1]);
+            result.workChunkSize = std::stoul(fields[2]);
+            result.nanosecondsPerStep = std::stod(fields[4]);
+            result.cached = true;
+            return ParseCpuFeatureLevel(fields[3], result.kernelLevel);
+        }
+
+        // Probably std::invalid_argument, calibrate again
+        catch (const std::exception& e)
+        {
+            TraceLog(LOG_WARNING, TextFormat("TUNING: Invalid cache line in %s: %s", filename.c_str(), e.what()));
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// Replace or append the line for key
+static void SaveTuning(std::string_view cacheFilename, const std::string& key, const TuningResult& result)
+{
+    std::string filename(cacheFilename);
+    std::string text;
+    if (FileExists(filename.c_str()))
+    {
+        auto tmp = LoadFileText(filename.c_str());
+        std::istringstream lines(tmp);
+        UnloadFileText(tmp);
+
+        for (std::string line; std::getline(lines, line);)
+        {
+            if (!line.empty() && !line.starts_with(key + "\t"))
+            {
+                text += line + "\n";
+            }
+        }
+    }
+
+    text += TextFormat("%s\t%zu\t%zu\t%s\t%f\n",
+        key.c_str(),
+        result.workerThreads,
+        result.workChunkSize,
+        CpuFeatureLevelName(result.kernelLevel),
+        result.nanosecondsPerStep
+    );
+    SaveFileText(filename.c_str(), text.data());
+}
+
+// Measure candidates, kernel level first on one thread, then threads and chunk
+// sizes with the fastest level
+static TuningResult Calibrate()
+{
+    TuningResult best = {};
+    best.nanosecondsPerStep = 1e300;
+
+    InitializePendulums();
+
+    workers.Start(1, settings.numaAware);
+    CpuFeatureLevel detected = DetectCpuFeatureLevel();
+    for (int i = 0; i <= (int)detected; i++)
+    {
+        const Kernels* candidate = GetCompiledKernels((CpuFeatureLevel)i, settings.deterministic);
+        if (!candidate)
+        {
+            continue;
+        }
+
+        activeKernels = candidate;
+        double ns = MeasureStep();
+        if (ns < best.nanosecondsPerStep)
+        {
+            best.kernelLevel = candidate->level;
+            best.nanosecondsPerStep = ns;
+        }
+    }
+    activeKernels = GetCompiledKernels(best.kernelLevel, settings.deterministic);
+
+    // More threads than kernel blocks can never help
+    std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t blocks = (settings.joinedPendulumsCount + kernelBlockSize - 1) / kernelBlockSize;
+    std::size_t maxThreads = std::max<std::size_t>(1, std::min(cores, blocks));
+
+    std::vector<std::size_t> threadCounts;
+    for (std::size_t t = 1; t < maxThreads; t *= 2)
+    {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    best.nanosecondsPerStep = 1e300;
+    for (std::size_t t : threadCounts)
+    {
+        workers.Start(t, settings.numaAware);
+        for (std::size_t chunk = kernelBlockSize; chunk <= 4096; chunk *= 2)
+        {
+            // Chunks larger than a thread's share leave threads idle
+            if (chunk > kernelBlockSize && chunk * t > settings.joinedPendulumsCount)
+            {
+                break;
+            }
+
+            settings.workChunkSize = chunk;
+            double ns = MeasureStep();
+            if (ns < best.nanosecondsPerStep)
+            {
+                best.workerThreads = t;
+                best.workChunkSize = chunk;
+                best.nanosecondsPerStep = ns;
+            }
+        }
+    }
+
+    InitializePendulums();
+    return best;
+}
+
+TuningResult AutoTune(std::string_view cacheFilename, bool recalibrate)
+{
+    std::string key = GetTuningKey();
+
+    TuningResult result = {};
+    if (recalibrate || !LoadTuning(cacheFilename, key, result))
+    {
+        TraceLog(LOG_INFO, TextFormat("TUNING: Calibrating for %s", key.c_str()));
+        result = Calibrate();
+        SaveTuning(cacheFilename, key, result);
+    }
+
+    TraceLog(LOG_INFO, TextFormat("TUNING: %s %zu threads, chunk %zu, %s kernels, %.2f ns per pendulum step",
+        result.cached ? "Cached" : "Calibrated",
+        result.workerThreads,
+        result.workChunkSize,
+        CpuFeatureLevelName(result.kernelLevel),
+        result.nanosecondsPerStep
+    ));
+
+    settings.workerThreads = result.workerThreads;
+    settings.workChunkSize = result.workChunkSize;
+    settings.kernelLevel = CpuFeatureLevelName(result.kernelLevel);
+    return result;
+}
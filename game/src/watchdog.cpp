@@ -0,0 +1,390 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Watchdog source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "watchdog.hpp"
+#include "format.hpp"
+#include "profiler.hpp"
+#include "raylib.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+
+#endif
+
+using WatchdogClock = std::chrono::steady_clock;
+
+// WatchdogFrameTimes, stage timings of a finished frame
+struct WatchdogFrameTimes {
+    std::uint64_t frame = 0;
+    double seconds = 0.0;
+    std::vector<double> phases; // Sized once, by stage
+};
+
+// What is watched, set by StartWatchdog
+static const FramePipeline* watchedPipeline = nullptr;
+static std::vector<std::string> watchedStages;
+static double watchedDeadline = 0.0;
+static std::string watchedFilename;
+
+static std::thread watchdogThread;
+static std::mutex watchdogMutex;
+static std::condition_variable watchdogWake;
+static bool watchdogStopping = false;
+
+// Guarded by watchdogMutex, frames count from 1, 0 before the first
+static std::uint64_t watchedFrame = 0;
+static WatchdogClock::time_point watchedFrameStart;
+static std::array<WatchdogFrameTimes, watchdogHistory> watchedHistory; // By frame % watchdogHistory
+static bool hitchPending = false; // Logged, waiting for the frame to finish
+
+#ifdef __linux__
+
+// Main thread stack written by its SIGUSR2 handler, depth -1 until written
+static pthread_t watchedThread;
+static void* watchdogFrames[watchdogMaxDepth + 2];
+static std::atomic<int> watchdogDepth = -1;
+
+// Take the interrupted main thread's stack, backtrace was warmed up by
+// StartWatchdog
+static void WatchdogSignal(int)
+{
+    int savedErrno = errno;
+    watchdogDepth.store(backtrace(watchdogFrames, (int)std::size(watchdogFrames)), std::memory_order_release);
+    errno = savedErrno;
+}
+
+// Stack of the main thread right now, outermost frames past watchdogMaxDepth
+// left out, empty if it did not answer in time
+static std::vector<std::string> SampleMainStack()
+{
+    watchdogDepth.store(-1, std::memory_order_relaxed);
+    if (pthread_kill(watchedThread, SIGUSR2) != 0)
+    {
+        return {};
+    }
+    auto giveUp = WatchdogClock::now() + std::chrono::milliseconds(100);
+    while (watchdogDepth.load(std::memory_order_acquire) < 0)
+    {
+        if (WatchdogClock::now() > giveUp)
+        {
+            return {};
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // The handler and the signal trampoline
+    int depth = watchdogDepth.load(std::memory_order_relaxed);
+    int skip = std::min(depth, 2);
+    return SymbolizeStack(watchdogFrames + skip, (std::size_t)(depth - skip));
+}
+
+#else
+
+static std::vector<std::string> SampleMainStack()
+{
+    return {};
+}
+
+#endif
+
+// Append text as a quoted JSON string
+static void AppendString(std::string& out, const std::string& text)
+{
+    out += '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            AppendFormat(out, "\\u%04x", (unsigned)c);
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// Append "phases":{...} with seconds of each stage
+static void AppendPhases(std::string& out, const WatchdogFrameTimes& times)
+{
+    out += "\"phases\":{";
+    for (std::size_t i = 0; i < times.phases.size() && i < watchedStages.size(); i++)
+    {
+        out += i > 0 ? "," : "";
+        AppendString(out, watchedStages[i]);
+        AppendFormat(out, ":%.6f", times.phases[i]);
+    }
+    out += "}";
+}
+
+// Append a line to the hitch log, from the watchdog thread
+static void WriteHitchLine(const std::string& line)
+{
+    std::ofstream file(watchedFilename, std::ios::app);
+    file << line << '\n';
+    if (!file)
+    {
+        TraceLog(LOG_ERROR, "WATCHDOG: Failed to write the hitch log");
+    }
+}
+
+// Log frame as hitched, past the deadline by elapsed seconds, history copied
+// under the lock
+static void LogHitch(std::uint64_t frame, double elapsed, const std::array<WatchdogFrameTimes, watchdogHistory>& history)
+{
+    // Work queued for the main thread is tagged with its stage, outside of
+    // any it waits on workers or runs the rest of the loop
+    std::size_t stage = watchedPipeline->mainStage.load(std::memory_order_relaxed);
+    std::string phase = stage < watchedStages.size() ? watchedStages[stage] : "none";
+    auto stack = SampleMainStack();
+
+    std::string line = "{\"event\":\"hitch\"";
+    auto wallTime = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    AppendFormat(line, ",\"time\":%.3f,\"frame\":%llu,\"deadline\":%.6f,\"elapsed\":%.6f,\"phase\":", wallTime, (unsigned long long)frame, watchedDeadline, elapsed);
+    AppendString(line, phase);
+    line += ",\"stack\":[";
+    for (std::size_t i = 0; i < stack.size(); i++)
+    {
+        line += i > 0 ? "," : "";
+        AppendString(line, stack[i]);
+    }
+
+    // Oldest first
+    line += "],\"recent\":[";
+    bool first = true;
+    for (std::uint64_t past = frame > watchdogHistory ? frame - watchdogHistory : 1; past < frame; past++)
+    {
+        const auto& times = history[past % watchdogHistory];
+        if (times.frame != past)
+        {
+            continue;
+        }
+        line += first ? "{" : ",{";
+        first = false;
+        AppendFormat(line, "\"frame\":%llu,\"seconds\":%.6f,", (unsigned long long)past, times.seconds);
+        AppendPhases(line, times);
+        line += "}";
+    }
+    line += "]}";
+    WriteHitchLine(line);
+
+    char message[256];
+    std::snprintf(message, sizeof(message), "WATCHDOG: Frame %llu over %.3f s deadline in %s, logged to %s",
+        (unsigned long long)frame, watchedDeadline, phase.c_str(), watchedFilename.c_str());
+    TraceLog(LOG_WARNING, message);
+}
+
+// Log the end of a hitched frame with its stage timings
+static void LogRecovered(const WatchdogFrameTimes& times)
+{
+    std::string line = "{\"event\":\"recovered\"";
+    AppendFormat(line, ",\"frame\":%llu,\"seconds\":%.6f,", (unsigned long long)times.frame, times.seconds);
+    AppendPhases(line, times);
+    line += "}";
+    WriteHitchLine(line);
+}
+
+// Sleep until the frame is due, log it if it is not done by then, and once
+// more when it is
+static void WatchdogMain()
+{
+    auto deadline = std::chrono::duration_cast<WatchdogClock::duration>(std::chrono::duration<double>(watchedDeadline));
+    std::uint64_t hitchFrame = 0;
+
+    std::unique_lock lock(watchdogMutex);
+    while (!watchdogStopping)
+    {
+        if (hitchPending)
+        {
+            if (watchedFrame == hitchFrame)
+            {
+                watchdogWake.wait(lock);
+                continue;
+            }
+            auto times = watchedHistory[hitchFrame % watchdogHistory];
+            hitchPending = false;
+            lock.unlock();
+            LogRecovered(times);
+            lock.lock();
+            continue;
+        }
+
+        // Nothing to watch before the first frame
+        if (watchedFrame == 0)
+        {
+            watchdogWake.wait_for(lock, std::chrono::milliseconds(250));
+            continue;
+        }
+        auto due = watchedFrameStart + deadline;
+        auto now = WatchdogClock::now();
+        if (now < due)
+        {
+            watchdogWake.wait_until(lock, due);
+            continue;
+        }
+
+        hitchFrame = watchedFrame;
+        hitchPending = true;
+        double elapsed = std::chrono::duration<double>(now - watchedFrameStart).count();
+        auto history = watchedHistory;
+        lock.unlock();
+        LogHitch(hitchFrame, elapsed, history);
+        lock.lock();
+    }
+}
+
+bool StartWatchdog(const FramePipeline& pipeline, double deadline, const char* filename)
+{
+    if (watchdogThread.joinable() && watchedPipeline == &pipeline && watchedDeadline == deadline && watchedFilename == filename)
+    {
+        return true;
+    }
+    StopWatchdog();
+    if (deadline <= 0.0)
+    {
+        return false;
+    }
+
+#ifdef __linux__
+    watchedThread = pthread_self();
+
+    // Loads the unwinder now instead of in the first signal
+    void* warmUp[4];
+    backtrace(warmUp, 4);
+
+    // Stays installed, a late answer after StopWatchdog must not terminate
+    struct sigaction action = {};
+    action.sa_handler = WatchdogSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR2, &action, nullptr) != 0)
+    {
+        TraceLog(LOG_WARNING, TextFormat("WATCHDOG: Failed to install the stack handler: %s", std::strerror(errno)));
+    }
+#endif
+
+    watchedPipeline = &pipeline;
+    watchedStages.clear();
+    for (const auto& stage : pipeline.stages)
+    {
+        watchedStages.push_back(stage.name);
+    }
+    watchedDeadline = deadline;
+    watchedFilename = filename;
+
+    watchedFrame = 0;
+    hitchPending = false;
+    for (auto& times : watchedHistory)
+    {
+        times = { 0, 0.0, std::vector<double>(watchedStages.size(), 0.0) };
+    }
+    watchdogStopping = false;
+    watchdogThread = std::thread(WatchdogMain);
+    TraceLog(LOG_INFO, TextFormat("WATCHDOG: Logging frames over %.3f s to %s", deadline, filename));
+    return true;
+}
+
+void StopWatchdog()
+{
+    if (!watchdogThread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard lock(watchdogMutex);
+        watchdogStopping = true;
+    }
+    watchdogWake.notify_all();
+    watchdogThread.join();
+    watchedPipeline = nullptr;
+}
+
+bool WatchdogRunning()
+{
+    return watchedPipeline != nullptr;
+}
+
+void WatchdogFrame()
+{
+    if (!watchedPipeline)
+    {
+        return;
+    }
+
+    bool wake;
+    {
+        std::lock_guard lock(watchdogMutex);
+
+        // Timings of the frame that just finished
+        if (watchedFrame > 0)
+        {
+            auto& times = watchedHistory[watchedFrame % watchdogHistory];
+            times.frame = watchedFrame;
+            times.seconds = watchedPipeline->frameSeconds;
+            for (std::size_t i = 0; i < times.phases.size(); i++)
+            {
+                times.phases[i] = watchedPipeline->stages[i].seconds;
+            }
+        }
+        watchedFrame++;
+        watchedFrameStart = WatchdogClock::now();
+        wake = hitchPending || watchedFrame == 1;
+    }
+
+    // Otherwise it sleeps until the new frame is due and finds it done
+    if (wake)
+    {
+        watchdogWake.notify_all();
+    }
+}
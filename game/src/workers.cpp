@@ -0,0 +1,485 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Worker thread pool source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+#include "workers.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0601 // GetNumaNodeProcessorMaskEx
+#endif
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+WorkerPool workers;
+
+#ifdef __linux__
+
+// Parse a sysfs cpu list such as "0-3,8-11"
+static std::vector<int> ParseCpuList(const std::string& text)
+{
+    std::vector<int> cpus;
+    std::size_t i = 0;
+    while (i < text.size())
+    {
+        std::size_t comma = text.find(',', i);
+        std::string range = text.substr(i, comma == std::string::npos ? std::string::npos : comma - i);
+        i = comma == std::string::npos ? text.size() : comma + 1;
+
+        std::size_t dash = range.find('-');
+        try
+        {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        // Empty or trailing newline
+        catch (const std::exception&)
+        {
+        }
+    }
+
+    return cpus;
+}
+
+std::vector<std::vector<int>> GetNumaNodes()
+{
+    std::vector<std::vector<int>> nodes;
+
+    std::error_code error;
+    for (int node = 0;; node++)
+    {
+        std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+        if (!std::filesystem::exists(path, error))
+        {
+            break;
+        }
+
+        std::ifstream file(path);
+        std::string text;
+        std::getline(file, text);
+
+        // Memory only nodes have no CPUs to run workers on
+        auto cpus = ParseCpuList(text);
+        if (!cpus.empty())
+        {
+            nodes.push_back(cpus);
+        }
+    }
+
+    if (nodes.empty())
+    {
+        nodes.emplace_back();
+    }
+    return nodes;
+}
+
+// Restrict calling thread to the CPUs of a node
+static void PinCurrentThread(const std::vector<int>& cpus)
+{
+    if (cpus.empty())
+    {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Affinity of the calling thread before it was first pinned
+static cpu_set_t savedAffinity;
+static bool affinitySaved = false;
+
+static void SaveCurrentAffinity()
+{
+    if (!affinitySaved)
+    {
+        affinitySaved = pthread_getaffinity_np(pthread_self(), sizeof(savedAffinity), &savedAffinity) == 0;
+    }
+}
+
+static void RestoreCurrentAffinity()
+{
+    if (affinitySaved)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(savedAffinity), &savedAffinity);
+        affinitySaved = false;
+    }
+}
+
+#elif _WIN32
+
+// Node numbers are stored as the only "CPU" of each node, Windows pins by group mask
+std::vector<std::vector<int>> GetNumaNodes()
+{
+    std::vector<std::vector<int>> nodes;
+
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest))
+    {
+        for (ULONG node = 0; node <= highest; node++)
+        {
+            GROUP_AFFINITY affinity = {};
+            if (GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) && affinity.Mask != 0)
+            {
+                nodes.push_back({ (int)node });
+            }
+        }
+    }
+
+    if (nodes.empty())
+    {
+        nodes.emplace_back();
+    }
+    return nodes;
+}
+
+static void PinCurrentThread(const std::vector<int>& node)
+{
+    GROUP_AFFINITY affinity = {};
+    if (!node.empty() && GetNumaNodeProcessorMaskEx((USHORT)node[0], &affinity))
+    {
+        SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+    }
+}
+
+// Affinity of the calling thread before it was first pinned
+static GROUP_AFFINITY savedAffinity = {};
+static bool affinitySaved = false;
+
+static void SaveCurrentAffinity()
+{
+    if (!affinitySaved)
+    {
+        affinitySaved = GetThreadGroupAffinity(GetCurrentThread(), &savedAffinity);
+    }
+}
+
+static void RestoreCurrentAffinity()
+{
+    if (affinitySaved)
+    {
+        SetThreadGroupAffinity(GetCurrentThread(), &savedAffinity, nullptr);
+        affinitySaved = false;
+    }
+}
+
+#else
+
+std::vector<std::vector<int>> GetNumaNodes()
+{
+    return { {} };
+}
+
+static void PinCurrentThread(const std::vector<int>&)
+{
+}
+
+static void SaveCurrentAffinity()
+{
+}
+
+static void RestoreCurrentAffinity()
+{
+}
+
+#endif
+
+// Name the calling worker thread, as debuggers and profiles show it
+static void NameCurrentThread([[maybe_unused]] std::size_t index)
+{
+#ifdef __linux__
+    pthread_setname_np(pthread_self(), ("worker " + std::to_string(index)).c_str());
+#endif
+}
+
+// Index of this thread in its pool
+static thread_local std::size_t threadIndex = 0;
+
+std::size_t WorkerPool::ThreadIndex()
+{
+    return threadIndex;
+}
+
+void WorkerPool::Start(std::size_t total, bool numa)
+{
+    if (total == 0)
+    {
+        total = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    if (total == Size() && numa == numaAware && partitions)
+    {
+        return;
+    }
+
+    Stop();
+    stopping = false;
+    numaAware = numa;
+    owner = std::this_thread::get_id();
+
+    // Spread threads evenly over nodes, a contiguous run of threads per node
+    auto numaNodes = numa ? GetNumaNodes() : std::vector<std::vector<int>>{ {} };
+    nodes = numaNodes.size();
+    partitions = std::make_unique<Partition[]>(total);
+    for (std::size_t i = 0; i < total; i++)
+    {
+        partitions[i].node = i * nodes / total;
+    }
+
+    // Nothing to gain from pinning on a single node
+    auto pinTo = [&](std::size_t i) {
+        return nodes > 1 ? numaNodes[partitions[i].node] : std::vector<int>();
+    };
+
+    // The caller is pinned like a worker, and unpinned again when it is not
+    auto callerCpus = pinTo(0);
+    if (callerCpus.empty())
+    {
+        RestoreCurrentAffinity();
+    }
+    else
+    {
+        SaveCurrentAffinity();
+        PinCurrentThread(callerCpus);
+    }
+    for (std::size_t i = 1; i < total; i++)
+    {
+        threads.emplace_back(&WorkerPool::WorkerMain, this, i, generation, pinTo(i));
+    }
+}
+
+void WorkerPool::Stop()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    threads.clear();
+    if (std::this_thread::get_id() == owner)
+    {
+        RestoreCurrentAffinity();
+    }
+
+    // Nobody left to run these
+    while (!tasks.empty())
+    {
+        TaskFunction task = std::move(tasks.front());
+        tasks.pop_front();
+        task();
+    }
+}
+
+void WorkerPool::Submit(TaskFunction task)
+{
+    if (threads.empty())
+    {
+        task();
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void WorkerPool::ParallelFor(std::size_t count, std::size_t chunkSize, const RangeFunction& function)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    chunkSize = std::max<std::size_t>(chunkSize, 1);
+
+    // Not worth waking anyone, or called from a task
+    if (threads.empty() || count <= chunkSize || std::this_thread::get_id() != owner)
+    {
+        function(0, count);
+        return;
+    }
+
+    // Same count and chunk size always give a thread the same partition
+    const std::size_t chunks = (count + chunkSize - 1) / chunkSize;
+    const std::size_t size = Size();
+    {
+        std::lock_guard lock(mutex);
+        job = &function;
+        jobCount = count;
+        jobChunk = chunkSize;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            partitions[i].next = i * chunks / size;
+            partitions[i].end = (i + 1) * chunks / size;
+        }
+        remaining = chunks;
+        generation++;
+    }
+    wake.notify_all();
+
+    RunChunks(0);
+
+    // Threads busy with a task join late or not at all, only wait for those
+    // that took part
+    std::unique_lock lock(mutex);
+    done.wait(lock, [this] { return remaining == 0 && busy == 0; });
+    job = nullptr;
+}
+
+void WorkerPool::RunPartition(Partition& partition, std::size_t keep)
+{
+    while (true)
+    {
+        // Cheap check first, so idle thieves do not hammer the counter
+        std::size_t next = partition.next.load(std::memory_order_relaxed);
+        if (next + keep >= partition.end)
+        {
+            return;
+        }
+
+        std::size_t c = partition.next.fetch_add(1);
+        if (c >= partition.end)
+        {
+            return;
+        }
+
+        std::size_t begin = c * jobChunk;
+        (*job)(begin, std::min(begin + jobChunk, jobCount));
+        FinishChunk();
+    }
+}
+
+void WorkerPool::FinishChunk()
+{
+    if (remaining.fetch_sub(1) == 1)
+    {
+        std::lock_guard lock(mutex);
+        done.notify_all();
+    }
+}
+
+void WorkerPool::RunChunks(std::size_t self)
+{
+    const std::size_t size = Size();
+    const std::size_t node = partitions[self].node;
+
+    RunPartition(partitions[self], 0);
+
+    // Steal from the same node first
+    for (std::size_t i = 1; i < size; i++)
+    {
+        auto& victim = partitions[(self + i) % size];
+        if (victim.node == node)
+        {
+            RunPartition(victim, 0);
+        }
+    }
+
+    // Other nodes, only while their owners are clearly behind
+    for (std::size_t i = 1; i < size; i++)
+    {
+        auto& victim = partitions[(self + i) % size];
+        if (victim.node != node)
+        {
+            RunPartition(victim, crossNodeStealMinimum - 1);
+        }
+    }
+}
+
+void WorkerPool::WorkerMain(std::size_t self, std::uint64_t seen, std::vector<int> pinTo)
+{
+    PinCurrentThread(pinTo);
+    NameCurrentThread(self);
+    threadIndex = self;
+
+    while (true)
+    {
+        TaskFunction task;
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [&] { return stopping || (job && generation != seen) || !tasks.empty(); });
+            if (stopping)
+            {
+                return;
+            }
+
+            // Loops first, the owner is waiting on them
+            if (job && generation != seen)
+            {
+                seen = generation;
+                busy++;
+            }
+            else
+            {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+        }
+
+        if (task)
+        {
+            task();
+            continue;
+        }
+
+        RunChunks(self);
+
+        {
+            std::lock_guard lock(mutex);
+            busy--;
+        }
+        done.notify_all();
+    }
+}
@@ -0,0 +1,126 @@
+/*
+ *  @author  Anstro Pleuton (https://github.com/anstropleuton)
+ *  @brief   Example kernel plugin source file.
+ *
+ *  @copyright  Copyright (C) 2024 Anstro Pleuton
+ *
+ *  Hypnotizing Double Pendulum simulates thousands of Double Pendulum with
+ *  trajectories to create fancy visually pleasing animations.
+ *
+ *  This software is licensed under the terms of MIT License.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to
+ *  deal in the Software without restriction, including without limitation the
+ *  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ *  sell copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ *  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ *  IN THE SOFTWARE.
+ */
+
+// Example kernel plugin, the explicit integrator of the built in kernels with
+// the standard library's sin and cos, as a starting point for new kernels
+// Build from the repository root, then set kernelPlugin in settings.txt:
+//   g++ -std=c++20 -O2 -shared -fPIC -Igame/include plugins/explicit_kernel.cpp -o explicit_kernel.so
+
+#include "kernelplugin.hpp"
+
+#include <cmath>
+#include <cstddef>
+
+// Angular accelerations of link pairs, same pairwise formula as the built in
+// explicit kernels
+static void Accelerate(const HdpPluginBlock& b)
+{
+    const std::size_t w = b.stride;
+    for (std::size_t k = 0; k + 1 < b.links; k++)
+    {
+        const std::size_t i = k * w;
+        const std::size_t j = (k + 1) * w;
+        for (std::size_t m = 0; m < w; m++)
+        {
+            double a1 = b.angle[i + m];
+            double a2 = b.angle[j + m];
+            double w1 = b.angularVelocity[i + m];
+            double w2 = b.angularVelocity[j + m];
+            double l1 = b.length[i + m];
+            double l2 = b.length[j + m];
+            double m1 = b.mass[i + m];
+            double m2 = b.mass[j + m];
+            double g = b.gravity[m];
+
+            double n1 = -g * (2.0 * m1 + m2) * std::sin(a1);
+            double n2 = -m2 * g * std::sin(a1 - 2.0 * a2);
+            double n3 = -2.0 * std::sin(a1 - a2) * m2;
+            double n4 = w2 * w2 * l2 + w1 * w1 * l1 * std::cos(a1 - a2);
+            double d = 2.0 * m1 + m2 - m2 * std::cos(2.0 * a1 - 2.0 * a2);
+            b.angularAcceleration[i + m] = (n1 + n2 + n3 * n4) / (l1 * d);
+
+            double n5 = 2.0 * std::sin(a1 - a2);
+            double n6 = w1 * w1 * l1 * (m1 + m2) + g * (m1 + m2) * std::cos(a1) + w2 * w2 * l2 * m2 * std::cos(a1 - a2);
+            b.angularAcceleration[j + m] = n5 * n6 / (l2 * d);
+        }
+    }
+}
+
+static void Step(const HdpPluginBlock* block, std::size_t steps, double deltaTime)
+{
+    const HdpPluginBlock& b = *block;
+    const std::size_t w = b.stride;
+    for (std::size_t s = 0; s < steps; s++)
+    {
+        // Lone pendulum, velocity is not accumulated there either
+        if (b.links == 1)
+        {
+            for (std::size_t m = 0; m < w; m++)
+            {
+                b.angularAcceleration[m] = -b.gravity[m] / b.length[m] * std::sin(b.angle[m]);
+                b.angularVelocity[m] = b.angularAcceleration[m] * deltaTime;
+                b.angle[m] += b.angularVelocity[m] * deltaTime;
+            }
+            continue;
+        }
+
+        Accelerate(b);
+        for (std::size_t i = 0; i < b.links * w; i++)
+        {
+            b.angularVelocity[i] += b.angularAcceleration[i] * deltaTime;
+            b.angle[i] += b.angularVelocity[i] * deltaTime;
+        }
+    }
+}
+
+// End positions, first link anchored at the center
+static void Positions(const HdpPluginBlock* block)
+{
+    const HdpPluginBlock& b = *block;
+    const std::size_t w = b.stride;
+    for (std::size_t k = 0; k < b.links; k++)
+    {
+        for (std::size_t m = 0; m < w; m++)
+        {
+            const std::size_t i = k * w + m;
+            double x = k == 0 ? 0.0 : b.positionX[i - w];
+            double y = k == 0 ? 0.0 : b.positionY[i - w];
+            b.positionX[i] = x + b.length[i] * std::sin(b.angle[i]);
+            b.positionY[i] = y + b.length[i] * std::cos(b.angle[i]);
+        }
+    }
+}
+
+static const HdpKernelPlugin plugin = { HDP_KERNEL_PLUGIN_ABI, "explicit (libm)", nullptr, Step, Positions, nullptr };
+
+HDP_KERNEL_PLUGIN_EXPORT const HdpKernelPlugin* hdpKernelPlugin(void)
+{
+    return &plugin;
+}
@@ -155,7 +155,7 @@ workspace (workspaceName)
     end
 
 cdialect "C17"
-cppdialect "C++17"
+cppdialect "C++latest"
 check_raylib();
 
 include ("raylib_premake5.lua")